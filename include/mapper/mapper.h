@@ -236,11 +236,89 @@ mpr_list mpr_dev_get_maps(mpr_dev device, mpr_dir direction);
  *  \return             The number of handled messages. May be zero if there was nothing to do. */
 int mpr_dev_poll(mpr_dev device, int block_ms);
 
+/*! Poll this device continuously until an absolute deadline, without blocking. Incoming and
+ *  outgoing maps are processed on every iteration, which suits control loops running at rates
+ *  too high for the millisecond granularity of mpr_dev_poll(). The achieved iteration rate is
+ *  reported by mpr_dev_get_stat() as MPR_DEV_STAT_LOOP_RATE. The deadline is measured against a
+ *  monotonic clock where available, so changes to the system time during the call do not move
+ *  it. A device that is not registered yet is polled using mpr_dev_poll() until it is registered
+ *  or the deadline has passed.
+ *  \param device       The device to check messages for.
+ *  \param deadline     The time at which to return.
+ *  \return             The number of handled messages. */
+int mpr_dev_poll_until(mpr_dev device, mpr_time deadline);
+
+/*! Ask the operating system to busy-poll the device sockets for incoming packets, reducing
+ *  receive latency at the cost of CPU time. Currently only supported on Linux.
+ *  \param device       The device to configure.
+ *  \param usec         The number of microseconds to busy-poll, or 0 to disable.
+ *  \return             1 if the option was set, 0 otherwise. */
+int mpr_dev_set_busy_poll(mpr_dev device, int usec);
+
+/*! Evaluate the expressions of updated outgoing maps using several threads. Maps are evaluated
+ *  in parallel only when many are updated at once; the resulting messages are still sent by the
+ *  polling thread in the order the maps were updated.
+ *  \param device       The device to configure.
+ *  \param num_threads  The number of threads to use, including the polling thread. Values less
+ *                      than two disable parallel evaluation.
+ *  \return             Zero if successful, less than zero otherwise. */
+int mpr_dev_set_num_eval_threads(mpr_dev device, int num_threads);
+
+/*! Retrieve the file descriptors a device needs to watch for incoming messages, for integration
+ *  with an external event loop in place of mpr_dev_poll(). The set includes the descriptors of
+ *  the device's graph and grows once the device has been registered, so it should be retrieved
+ *  again when mpr_dev_get_is_ready() first returns true.
+ *  \param device       The device to query.
+ *  \param fds          An array to fill with file descriptors.
+ *  \param num          The size of the array.
+ *  \return             The number of file descriptors, which may be larger than num. */
+int mpr_dev_get_fds(mpr_dev device, int *fds, int num);
+
+/*! Get the time remaining until the next timed task of a device is due. Call
+ *  mpr_dev_process_timers() once this time has elapsed. Updates arriving over TCP connections
+ *  accepted by the device are not signalled on the descriptors returned by mpr_dev_get_fds() and
+ *  are handled by mpr_dev_process_timers(), so once the device has accepted a TCP connection the
+ *  timeout is at most 100 milliseconds after they were last serviced, the interval at which
+ *  mpr_dev_poll() services them.
+ *  \param device       The device to query.
+ *  \return             The number of milliseconds to wait, or 0 if work is already pending. */
+int mpr_dev_get_timeout(mpr_dev device);
+
+/*! Receive and handle messages waiting on a file descriptor returned by mpr_dev_get_fds(), then
+ *  route any resulting signal updates.
+ *  \param device       The device to process.
+ *  \param fd           The readable file descriptor.
+ *  \return             The number of handled messages. */
+int mpr_dev_process_fd(mpr_dev device, int fd);
+
+/*! Perform the timed tasks of a device: name allocation, clock sync, subscription renewal and
+ *  expiry of remote devices. Messages arriving on accepted TCP connections are also handled here.
+ *  \param device       The device to process. */
+void mpr_dev_process_timers(mpr_dev device);
+
+/*! Set the number of data messages this device will try to receive at the end of each call to
+ *  mpr_dev_poll(). Where available, datagrams are received in batches to reduce system calls.
+ *  \param device       The device to configure.
+ *  \param num_msgs     The maximum number of messages to receive per poll, or 0 to derive the
+ *                      budget from the number of input signals (default). */
+void mpr_dev_set_recv_budget(mpr_dev device, int num_msgs);
+
 /*! Start automatically polling this device for new messages in a separate thread.
  *  \param device       The device to check messages for.
  *  \return             Zero if successful, less than zero otherwise. */
 int mpr_dev_start_polling(mpr_dev device);
 
+/*! Start processing signal updates for this device in a dedicated worker thread, so that several
+ *  local devices sharing a graph can run on separate cores. A worker does not handle
+ *  administrative messages: they are handled by mpr_dev_poll() on devices of the same graph
+ *  without a worker, or by calling mpr_graph_poll() or mpr_graph_start_polling(), which is
+ *  required once every local device has a worker. Signals and maps should be modified from the
+ *  thread handling administrative messages, and signal values updated from other threads using
+ *  mpr_sig_set_value_async(). Use mpr_dev_stop_polling() to stop the worker.
+ *  \param device       The device to process.
+ *  \return             Zero if successful, less than zero otherwise. */
+int mpr_dev_start_worker(mpr_dev device);
+
 /*! Stop automatically polling this device for new messages in a separate thread.
  *  \param device       The device to check messages for.
  *  \return             Zero if successful, less than zero otherwise. */
@@ -257,6 +335,12 @@ int mpr_dev_get_is_ready(mpr_dev device);
  *  \return             The current time. */
 mpr_time mpr_dev_get_time(mpr_dev device);
 
+/*! Get a statistic describing the recent activity of a local device.
+ *  \param device       The device to query.
+ *  \param stat         The statistic to retrieve.
+ *  \return             The value of the statistic, or zero if the device is not local. */
+double mpr_dev_get_stat(mpr_dev device, mpr_dev_stat stat);
+
 /*! Set the time for a device. Use only if user code has access to a more accurate
  *  timestamp than the operating system.
  *  \param device       The device to use.
@@ -334,6 +418,22 @@ void mpr_sig_free(mpr_sig signal);
 void mpr_sig_set_value(mpr_sig signal, mpr_id instance, int length, mpr_type type,
                        const void *value);
 
+/*! Update the value of a local signal instance from a thread other than the one polling its
+ *  device. The update is copied into a queue and routed during the next call to mpr_dev_poll(),
+ *  which is interrupted if it is currently blocking. The queue is allocated by the first call
+ *  for each signal; after that this function never blocks or allocates memory. Updates should
+ *  not be pushed while the signal is being freed.
+ *  \param signal       The signal to operate on.
+ *  \param instance     The identifier of the instance to update, or 0 for the default instance.
+ *  \param length       Length of the value argument, or 0 to release the instance.
+ *  \param type         Data type of the value argument.
+ *  \param value        A pointer to a new value for this signal, or NULL to release the
+ *                      instance.
+ *  \return             Non-zero if the update was queued, zero if the queue is full or the
+ *                      value is invalid. */
+int mpr_sig_set_value_async(mpr_sig signal, mpr_id instance, int length, mpr_type type,
+                            const void *value);
+
 /*! Get the value of a signal instance.
  *  \param signal       The signal to operate on.
  *  \param instance     A pointer to the identifier of the instance to query,
@@ -644,6 +744,32 @@ const char *mpr_graph_get_address(mpr_graph graph);
  *  \return             The number of handled messages. */
 int mpr_graph_poll(mpr_graph graph, int block_ms);
 
+/*! Retrieve the file descriptors a graph needs to watch for incoming messages, for integration
+ *  with an external event loop in place of mpr_graph_poll().
+ *  \param graph        The graph to query.
+ *  \param fds          An array to fill with file descriptors.
+ *  \param num          The size of the array.
+ *  \return             The number of file descriptors, which may be larger than num. */
+int mpr_graph_get_fds(mpr_graph graph, int *fds, int num);
+
+/*! Get the time remaining until the next timed task of a graph is due. Call
+ *  mpr_graph_process_timers() once this time has elapsed. Local devices should be driven using
+ *  mpr_dev_get_timeout() instead, which also accounts for their TCP connections.
+ *  \param graph        The graph to query.
+ *  \return             The number of milliseconds to wait, or 0 if work is already pending. */
+int mpr_graph_get_timeout(mpr_graph graph);
+
+/*! Receive and handle messages waiting on a file descriptor returned by mpr_graph_get_fds().
+ *  \param graph        The graph to process.
+ *  \param fd           The readable file descriptor.
+ *  \return             The number of handled messages. */
+int mpr_graph_process_fd(mpr_graph graph, int fd);
+
+/*! Perform the timed tasks of a graph: clock sync, subscription renewal and expiry of remote
+ *  devices.
+ *  \param graph        The graph to process. */
+void mpr_graph_process_timers(mpr_graph graph);
+
 /*! Start automatically synchonizing a local graph copy in a separate thread.
  *  \param graph        The graph to update.
  *  \return             Zero if successful, less than zero otherwise. */
@@ -152,6 +152,18 @@ typedef enum {
     MPR_STEAL_NEWEST    /*!< Steal the newest instance. */
 } mpr_steal_type;
 
+/*! Statistics describing the recent activity of a local device.
+ *  @ingroup device */
+typedef enum {
+    MPR_DEV_STAT_SENDS_SAVED,       /*!< Send system calls saved by batching datagrams since
+                                     *   the start of the last call to mpr_dev_poll(). */
+    MPR_DEV_STAT_SENDS_SAVED_TOTAL, /*!< Send system calls saved by batching datagrams since
+                                     *   the device was created. */
+    MPR_DEV_STAT_LOOP_RATE,         /*!< Iterations per second achieved by the last call to
+                                     *   mpr_dev_poll_until(). */
+    MPR_DEV_NUM_STATS
+} mpr_dev_stat;
+
 /*! The set of possible graph events, used to inform callbacks.
  *  @ingroup graph */
 typedef enum {
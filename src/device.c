@@ -1,8 +1,13 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for recvmmsg() */
+#endif
 #include <lo/lo.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <math.h>
 #ifdef _MSC_VER
 #include <windows.h>
 #include <malloc.h>
@@ -20,6 +25,27 @@
 #include "config.h"
 #include <mapper/mapper.h>
 
+#ifdef HAVE_ARPA_INET_H
+ #include <sys/socket.h>
+ #include <netinet/in.h>
+ #define CLOSE_SOCKET close
+#else
+ #ifdef HAVE_WINSOCK2_H
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+  #define CLOSE_SOCKET closesocket
+ #endif
+#endif
+
+#ifdef HAVE_RECVMMSG
+#define RECV_BATCH 16
+#define MAX_DATAGRAM_SIZE 65527   /* largest UDP payload */
+#endif
+
+/* An empty OSC message addressed to "/", used to interrupt a blocking poll. */
+#define WAKE_PATH "/"
+static const char wake_msg[8] = {'/', 0, 0, 0, ',', 0, 0, 0};
+
 #ifdef HAVE_LIBPTHREAD
 #include <pthread.h>
 static void* device_thread_func(void *data);
@@ -33,10 +59,11 @@ extern const char* net_msg_strings[NUM_MSG_STRINGS];
 
 /* prototypes */
 static void mpr_dev_start_servers(mpr_local_dev dev);
+static int _poll_data(mpr_local_dev dev, int block_ms, int admin);
 static void mpr_dev_remove_idmap(mpr_local_dev dev, int group, mpr_id_map rem);
+static void _rehash_idmaps(mpr_local_dev dev, int group, int size);
 MPR_INLINE static int _process_outgoing_maps(mpr_local_dev dev);
 
-mpr_time ts = {0,1};
 
 static int cmp_qry_linked(const void *ctx, mpr_dev dev)
 {
@@ -117,6 +144,9 @@ mpr_dev mpr_dev_new(const char *name_prefix, mpr_graph g)
     init_dev_prop_tbl((mpr_dev)dev);
 
     dev->prefix = strdup(name_prefix);
+    dev->wake_fd = -1;
+    dev->bundle_time.frac = 1;
+    mpr_mutex_init(&dev->lock);
     mpr_dev_start_servers(dev);
 
     if (!dev->servers[SERVER_UDP] || !dev->servers[SERVER_TCP]) {
@@ -135,6 +165,7 @@ mpr_dev mpr_dev_new(const char *name_prefix, mpr_graph g)
     dev->ordinal_allocator.val = 1;
     dev->idmaps.active = (mpr_id_map*) malloc(sizeof(mpr_id_map));
     dev->idmaps.active[0] = 0;
+    dev->idmaps.tbls = (mpr_id_map_tbl_t*) calloc(1, sizeof(mpr_id_map_tbl_t));
     dev->num_sig_groups = 1;
 
     mpr_net_add_dev(&g->net, dev);
@@ -160,6 +191,9 @@ void mpr_dev_free(mpr_dev dev)
     gph = dev->obj.graph;
     net = &gph->net;
 
+    if (ldev->is_worker)
+        mpr_dev_stop_polling(dev);
+
     /* free any queued graph messages without sending */
     mpr_net_free_msgs(net);
 
@@ -225,8 +259,12 @@ void mpr_dev_free(mpr_dev dev)
             ldev->idmaps.active[i] = map->next;
             free(map);
         }
+        FUNC_IF(free, ldev->idmaps.tbls[i].LID);
+        FUNC_IF(free, ldev->idmaps.tbls[i].GID);
     }
     free(ldev->idmaps.active);
+    free(ldev->idmaps.tbls);
+    FUNC_IF(free, ldev->send_links);
 
     while (ldev->idmaps.reserve) {
         mpr_id_map map = ldev->idmaps.reserve;
@@ -237,10 +275,17 @@ void mpr_dev_free(mpr_dev dev)
     FUNC_IF(free, dev->prefix);
 
     mpr_expr_stack_free(ldev->expr_stack);
+    mpr_dev_set_num_eval_threads(dev, 0);
+
+    if (ldev->wake_fd >= 0)
+        CLOSE_SOCKET(ldev->wake_fd);
+    FUNC_IF(free, ldev->wake_sa);
 
     FUNC_IF(lo_server_free, ldev->servers[SERVER_UDP]);
     FUNC_IF(lo_server_free, ldev->servers[SERVER_TCP]);
 
+    mpr_mutex_free(&ldev->lock);
+
     mpr_graph_remove_dev(gph, dev, MPR_OBJ_REM, 1);
     if (!gph->own)
         mpr_graph_free(gph);
@@ -261,7 +306,11 @@ void mpr_dev_on_registered(mpr_local_dev dev)
                 idmap->GID |= dev->obj.id;
         }
         sig->obj.id |= dev->obj.id;
+        mpr_sig_rehash_idmaps(sig);
     }
+    /* GIDs may have changed so the id map tables need to be rebuilt */
+    for (i = 0; i < dev->num_sig_groups; i++)
+        _rehash_idmaps(dev, i, dev->idmaps.tbls[i].size);
     qry = mpr_list_new_query((const void**)&dev->obj.graph->sigs, (void*)cmp_qry_dev_sigs,
                              "hi", dev->obj.id, MPR_DIR_ANY);
     mpr_tbl_set(dev->obj.props.synced, PROP(SIG), NULL, 1, MPR_LIST, qry,
@@ -291,7 +340,7 @@ MPR_INLINE static int check_types(const mpr_type *types, int len, mpr_type type,
 
 int mpr_dev_bundle_start(lo_timetag t, void *data)
 {
-    mpr_time_set(&ts, t);
+    mpr_time_set(&((mpr_local_dev)data)->bundle_time, t);
     return 0;
 }
 
@@ -316,19 +365,12 @@ int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc
 {
     mpr_local_sig sig = (mpr_local_sig)data;
     mpr_local_dev dev;
-    mpr_sig_inst si;
-    mpr_rtr rtr = sig->obj.graph->net.rtr;
-    int i, val_len = 0, vals, size, all;
-    int idmap_idx, inst_idx, slot_idx = -1, map_manages_inst = 0;
+    int i, val_len = 0, slot_idx = -1, size = 0, has_null = 0;
     mpr_id GID = 0;
-    mpr_id_map idmap;
-    mpr_local_map map = 0;
-    mpr_local_slot slot = 0;
-    float diff;
+    const void *val = 0;
 
     TRACE_RETURN_UNLESS(sig && (dev = sig->dev), 0,
                         "error in mpr_dev_handler, cannot retrieve user data\n");
-    TRACE_DEV_RETURN_UNLESS(sig->num_inst, 0, "signal '%s' has no instances.\n", sig->name);
     RETURN_ARG_UNLESS(argc, 0);
 
     /* We need to consider that there may be properties appended to the msg
@@ -360,6 +402,48 @@ int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc
         }
     }
 
+    /* Non-null arguments are stored contiguously in the message, so the vector can be used in
+     * place unless some of its elements are null. */
+    for (i = 0; i < val_len; i++) {
+        if (types[i] == MPR_NULL)
+            has_null = 1;
+        else if (!size)
+            size = mpr_type_get_size(types[i]);
+        else
+            RETURN_ARG_UNLESS(mpr_type_get_size(types[i]) == size, 0);
+    }
+    if (size && has_null) {
+        char *buf = alloca(val_len * size);
+        for (i = 0; i < val_len; i++) {
+            if (types[i] != MPR_NULL)
+                memcpy(buf + i * size, argv[i], size);
+        }
+        val = buf;
+    }
+    else if (size)
+        val = argv[0];
+    return mpr_dev_handle_update(sig, types, val_len, val, GID, slot_idx);
+}
+
+int mpr_dev_handle_update(mpr_local_sig sig, const mpr_type *types, int val_len, const void *val,
+                          mpr_id GID, int slot_idx)
+{
+    mpr_local_dev dev;
+    mpr_sig_inst si;
+    mpr_time ts;
+    mpr_rtr rtr = sig->obj.graph->net.rtr;
+    int i, vals, size, all;
+    int idmap_idx, inst_idx, map_manages_inst = 0;
+    mpr_id_map idmap;
+    mpr_local_map map = 0;
+    mpr_local_slot slot = 0;
+    float diff;
+
+    TRACE_RETURN_UNLESS(sig && (dev = sig->dev), 0,
+                        "error in mpr_dev_handle_update, missing signal\n");
+    TRACE_DEV_RETURN_UNLESS(sig->num_inst, 0, "signal '%s' has no instances.\n", sig->name);
+    ts = dev->bundle_time;
+
     if (slot_idx >= 0) {
         /* retrieve mapping associated with this slot */
         slot = mpr_rtr_get_slot(rtr, sig, slot_idx);
@@ -397,12 +481,13 @@ int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc
                 /* special case: do a dry-run to check whether this map will
                  * cause a release. If so, don't bother stealing an instance. */
                 mpr_value *src;
-                mpr_value_t v = {0, 0, 1, 0, 1};
-                mpr_value_buffer_t b = {0, 0, -1};
-                b.samps = argv[0];
+                mpr_value_t v = {.num_inst = 1};
+                mpr_value_buffer_t b = {.pos = -1};
+                b.samps = (void*)val;
                 v.inst = &b;
                 v.vlen = val_len;
                 v.type = slot->sig->type;
+                v.mlen = 1;
                 src = alloca(map->num_src * sizeof(mpr_value));
                 for (i = 0; i < map->num_src; i++)
                     src[i] = (i == slot->id) ? &v : 0;
@@ -502,11 +587,10 @@ int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc
                 inst_idx = si->idx;
                 /* Setting to local timestamp here */
                 /* TODO: jitter mitigation etc. */
-                mpr_value_set_samp(&slot->val, inst_idx, argv[0], dev->time);
+                mpr_value_set_samp(&slot->val, inst_idx, (void*)val, dev->time);
                 if (slot->causes_update) {
                     set_bitflag(map->updated_inst, inst_idx);
-                    map->updated = 1;
-                    dev->receiving = 1;
+                    mpr_dev_queue_map(dev, map, MPR_DIR_IN);
                 }
             }
             if (!all)
@@ -522,7 +606,7 @@ int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc
             for (i = 0; i < sig->len; i++) {
                 if (types[i] == MPR_NULL)
                     continue;
-                memcpy((char*)si->val + i * size, argv[i], size);
+                memcpy((char*)si->val + i * size, (char*)val + i * size, size);
                 set_bitflag(si->has_val_flags, i);
             }
             if (!compare_bitflags(si->has_val_flags, sig->vec_known, sig->len))
@@ -680,48 +764,342 @@ mpr_link mpr_dev_get_link_by_remote(mpr_local_dev dev, mpr_dev remote)
     return 0;
 }
 
+void mpr_dev_queue_map(mpr_local_dev dev, mpr_local_map map, mpr_dir dir)
+{
+    mpr_map_worklist_t *wl;
+    if (MPR_DIR_OUT == dir) {
+        wl = &dev->maps_out;
+        dev->sending = 1;
+    }
+    else {
+        wl = &dev->maps_in;
+        dev->receiving = 1;
+    }
+    RETURN_UNLESS(!map->updated);
+    map->updated = 1;
+    map->worklist = wl;
+    map->next_updated = 0;
+    if (wl->tail)
+        wl->tail->next_updated = map;
+    else
+        wl->head = map;
+    wl->tail = map;
+}
+
+void mpr_dev_dequeue_map(mpr_local_map map)
+{
+    mpr_local_map *m, prev = 0;
+    mpr_map_worklist_t *wl = map->worklist;
+    RETURN_UNLESS(wl);
+    for (m = &wl->head; *m; prev = *m, m = &(*m)->next_updated) {
+        if (*m == map) {
+            *m = map->next_updated;
+            if (wl->tail == map)
+                wl->tail = prev;
+            break;
+        }
+    }
+    map->next_updated = 0;
+    map->worklist = 0;
+}
+
+/* Returns 1 if the stack was previously empty. */
+static int _push_async_sig(mpr_local_dev dev, mpr_local_sig sig)
+{
+    mpr_local_sig head;
+    do {
+        head = dev->async_sigs;
+        sig->async.next = head;
+    } while (!mpr_atomic_cas_ptr((void * volatile*)&dev->async_sigs, head, sig));
+    return !head;
+}
+
+void mpr_dev_wake(mpr_local_dev dev)
+{
+    if (dev->wake_fd >= 0)
+        sendto(dev->wake_fd, wake_msg, sizeof(wake_msg), 0, (struct sockaddr*)dev->wake_sa,
+               dev->wake_sa_len);
+}
+
+void mpr_dev_push_async_sig(mpr_local_dev dev, mpr_local_sig sig)
+{
+    /* only the first pending signal needs to wake the polling thread */
+    if (_push_async_sig(dev, sig))
+        mpr_dev_wake(dev);
+}
+
+void mpr_dev_remove_async_sig(mpr_local_dev dev, mpr_local_sig sig)
+{
+    mpr_local_sig head, newer, *s;
+    RETURN_UNLESS(sig->async.pending);
+    /* take the whole stack and splice the signal out, keeping the others in order */
+    head = mpr_atomic_xchg_ptr((void * volatile*)&dev->async_sigs, 0);
+    for (s = &head; *s; s = &(*s)->async.next) {
+        if (*s == sig) {
+            *s = sig->async.next;
+            break;
+        }
+    }
+    sig->async.next = 0;
+
+    /* push the remainder back in one step, below any signals pushed in the meantime */
+    while (head && !mpr_atomic_cas_ptr((void * volatile*)&dev->async_sigs, 0, head)) {
+        newer = mpr_atomic_xchg_ptr((void * volatile*)&dev->async_sigs, 0);
+        for (s = &newer; *s; s = &(*s)->async.next) {}
+        *s = head;
+        head = newer;
+    }
+}
+
+/* Route signal updates that were pushed from other threads. */
+MPR_INLINE static int _process_async_sigs(mpr_local_dev dev)
+{
+    int count = 0;
+    mpr_local_sig sig, next, prev = 0;
+    RETURN_ARG_UNLESS(dev->async_sigs, 0);
+    sig = mpr_atomic_xchg_ptr((void * volatile*)&dev->async_sigs, 0);
+
+    /* reverse the stack so signals are processed in the order they were first updated */
+    for (; sig; sig = next) {
+        next = sig->async.next;
+        sig->async.next = prev;
+        prev = sig;
+    }
+    for (sig = prev; sig; sig = next) {
+        /* the signal may be pushed again as soon as it is processed */
+        next = sig->async.next;
+        count += mpr_sig_process_async(sig);
+    }
+    return count;
+}
+
+MPR_INLINE static mpr_local_map _pop_map(mpr_map_worklist_t *wl)
+{
+    mpr_local_map map = wl->head;
+    RETURN_ARG_UNLESS(map, 0);
+    if (!(wl->head = map->next_updated))
+        wl->tail = 0;
+    map->next_updated = 0;
+    map->worklist = 0;
+    return map;
+}
+
 /* TODO: handle interrupt-driven updates that omit call to this function */
 MPR_INLINE static void _process_incoming_maps(mpr_local_dev dev)
 {
-    mpr_graph graph;
-    mpr_list maps;
+    mpr_local_map map;
     RETURN_UNLESS(dev->receiving);
-    graph = dev->obj.graph;
-    /* process and send updated maps */
-    /* TODO: speed this up! */
     dev->receiving = 0;
-    maps = mpr_list_from_data(graph->maps);
-    while (maps) {
-        mpr_local_map map = *(mpr_local_map*)maps;
-        maps = mpr_list_get_next(maps);
-        if (map->is_local && map->updated && map->expr && !map->muted)
+    /* process updated maps */
+    while ((map = _pop_map(&dev->maps_in))) {
+        if (map->expr && !map->muted)
             mpr_map_receive(map, dev->time);
+        map->updated = 0;
+    }
+}
+
+#ifdef HAVE_LIBPTHREAD
+/* Threads evaluating the expressions of updated outgoing maps. Each thread has its own expression
+ * stack and claims maps one at a time from a shared index, so that threads which finish early
+ * take over the remaining work. Messages are still added by the polling thread afterwards, in
+ * worklist order. */
+typedef struct _mpr_eval_thread {
+    struct _mpr_eval_pool *pool;
+    mpr_expr_stack stk;
+    pthread_t thread;
+} mpr_eval_thread_t;
+
+typedef struct _mpr_eval_pool {
+    mpr_eval_thread_t *threads;
+    int num_threads;
+    mpr_local_map *maps;                /*!< Maps to evaluate during the current pass. */
+    int num_maps;
+    int size;
+    volatile unsigned int next;         /*!< Index of the next map to claim. */
+    mpr_time time;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finish;
+    int pass;
+    int num_busy;
+    int quit;
+} mpr_eval_pool_t;
+
+/* Evaluate at least this many maps before waking the pool. */
+#define MIN_POOL_MAPS 8
+
+static void _eval_maps(struct _mpr_eval_pool *pool, mpr_expr_stack stk)
+{
+    unsigned int i;
+    while ((i = mpr_atomic_fetch_add(&pool->next, 1)) < (unsigned int)pool->num_maps)
+        mpr_map_eval(pool->maps[i], stk, pool->time);
+}
+
+static void *_eval_thread_func(void *data)
+{
+    mpr_eval_thread_t *thread = (mpr_eval_thread_t*)data;
+    struct _mpr_eval_pool *pool = thread->pool;
+    int pass = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pass == pool->pass && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+            break;
+        pass = pool->pass;
+        pthread_mutex_unlock(&pool->lock);
+
+        _eval_maps(pool, thread->stk);
+
+        pthread_mutex_lock(&pool->lock);
+        if (!--pool->num_busy)
+            pthread_cond_signal(&pool->finish);
     }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/* Evaluate the maps queued in the pool, with the calling thread taking part. */
+static void _run_eval_pool(struct _mpr_eval_pool *pool, mpr_expr_stack stk)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->next = 0;
+    pool->num_busy = pool->num_threads;
+    ++pool->pass;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    _eval_maps(pool, stk);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->num_busy)
+        pthread_cond_wait(&pool->finish, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void _free_eval_pool(struct _mpr_eval_pool *pool)
+{
+    int i;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i].thread, NULL);
+        mpr_expr_stack_free(pool->threads[i].stk);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->finish);
+    FUNC_IF(free, pool->maps);
+    free(pool->threads);
+    free(pool);
+}
+
+static struct _mpr_eval_pool *_new_eval_pool(int num_threads)
+{
+    int i;
+    struct _mpr_eval_pool *pool = calloc(1, sizeof(mpr_eval_pool_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finish, NULL);
+    pool->threads = calloc(num_threads, sizeof(mpr_eval_thread_t));
+    for (i = 0; i < num_threads; i++) {
+        pool->threads[i].pool = pool;
+        pool->threads[i].stk = mpr_expr_stack_new();
+        if (pthread_create(&pool->threads[i].thread, 0, _eval_thread_func, &pool->threads[i])) {
+            mpr_expr_stack_free(pool->threads[i].stk);
+            break;
+        }
+        ++pool->num_threads;
+    }
+    if (!pool->num_threads) {
+        _free_eval_pool(pool);
+        return 0;
+    }
+    return pool;
+}
+
+/* Queue the maps on the outgoing worklist in the pool and evaluate them in parallel. */
+static void _eval_outgoing_maps(mpr_local_dev dev)
+{
+    struct _mpr_eval_pool *pool = dev->eval_pool;
+    mpr_local_map map;
+    pool->num_maps = 0;
+    for (map = dev->maps_out.head; map; map = map->next_updated) {
+        if (!map->expr || map->muted)
+            continue;
+        if (pool->num_maps >= pool->size) {
+            pool->size = pool->size ? pool->size * 2 : 64;
+            pool->maps = realloc(pool->maps, pool->size * sizeof(mpr_local_map));
+        }
+        pool->maps[pool->num_maps++] = map;
+    }
+    RETURN_UNLESS(pool->num_maps >= MIN_POOL_MAPS);
+    pool->time = dev->time;
+    _run_eval_pool(pool, dev->expr_stack);
+}
+#endif /* HAVE_LIBPTHREAD */
+
+int mpr_dev_set_num_eval_threads(mpr_dev dev, int num_threads)
+{
+    mpr_local_dev ldev = (mpr_local_dev)dev;
+    RETURN_ARG_UNLESS(dev && dev->is_local, -1);
+#ifdef HAVE_LIBPTHREAD
+    if (ldev->eval_pool) {
+        _free_eval_pool(ldev->eval_pool);
+        ldev->eval_pool = 0;
+    }
+    /* the polling thread also evaluates maps */
+    if (num_threads > 1 && !(ldev->eval_pool = _new_eval_pool(num_threads - 1)))
+        return -1;
+    return 0;
+#else
+    return num_threads > 1 ? -1 : 0;
+#endif
 }
 
 /* TODO: handle interrupt-driven updates that omit call to this function */
 MPR_INLINE static int _process_outgoing_maps(mpr_local_dev dev)
 {
-    int msgs = 0;
+    int msgs = 0, num_links = 0;
     mpr_list list;
-    mpr_graph graph;
+    mpr_local_map map;
     RETURN_ARG_UNLESS(dev->sending, 0);
 
-    graph = dev->obj.graph;
+#ifdef HAVE_LIBPTHREAD
+    if (dev->eval_pool)
+        _eval_outgoing_maps(dev);
+#endif
+
     /* process and send updated maps */
-    /* TODO: speed this up! */
-    list = mpr_list_from_data(graph->maps);
-    while (list) {
-        mpr_local_map map = *(mpr_local_map*)list;
-        list = mpr_list_get_next(list);
-        if (map->is_local && map->updated && map->expr && !map->muted)
+    while ((map = _pop_map(&dev->maps_out))) {
+        if (map->expr && !map->muted)
             mpr_map_send(map, dev->time);
+        map->updated = 0;
     }
     dev->sending = 0;
-    list = mpr_list_from_data(graph->links);
+    list = mpr_list_from_data(dev->obj.graph->links);
     while (list) {
-        msgs += mpr_link_process_bundles((mpr_link)*list, dev->time, 0);
+        mpr_link link = (mpr_link)*list;
         list = mpr_list_get_next(list);
+        /* links of other local devices may be processed concurrently by their own threads */
+        if (link->devs[LOCAL_DEV] != (mpr_dev)dev)
+            continue;
+        msgs += mpr_link_process_bundles(link, dev->time, 0);
+        if (!link->bundles[0].buf.num_msgs)
+            continue;
+        /* collect serialized bundles so they can be sent together */
+        if (num_links >= dev->send_links_size) {
+            dev->send_links_size = dev->send_links_size ? dev->send_links_size * 2 : 8;
+            dev->send_links = realloc(dev->send_links, sizeof(mpr_link) * dev->send_links_size);
+        }
+        dev->send_links[num_links++] = link;
+    }
+    if (num_links) {
+        int saved = mpr_link_send_bufs(dev->send_links, num_links, 0);
+        dev->stats[MPR_DEV_STAT_SENDS_SAVED] += saved;
+        dev->stats[MPR_DEV_STAT_SENDS_SAVED_TOTAL] += saved;
     }
     return msgs ? 1 : 0;
 }
@@ -733,14 +1111,85 @@ void mpr_dev_update_maps(mpr_dev dev) {
         _process_outgoing_maps((mpr_local_dev)dev);
 }
 
+void mpr_dev_send_changed_state(mpr_local_dev ldev)
+{
+    mpr_dev dev = (mpr_dev)ldev;
+    if (dev->obj.props.synced->dirty && mpr_dev_get_is_ready(dev) && ldev->subscribers) {
+        /* inform device subscribers of changed properties */
+        mpr_net_use_subscribers(&dev->obj.graph->net, ldev, MPR_DEV);
+        mpr_dev_send_state(dev, MSG_DEV);
+    }
+}
+
+#ifdef HAVE_RECVMMSG
+/* Receive up to 'budget' datagrams from the UDP server of a device using as few system calls as
+ * possible, and dispatch them to the server's handlers. The receive buffer is shared by the
+ * local devices of a graph; if it is in use by another thread or cannot be allocated the
+ * datagrams are received through liblo instead. */
+static int _recv_udp_batch(mpr_local_dev dev, int budget)
+{
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iov[RECV_BATCH];
+    mpr_net net = &dev->obj.graph->net;
+    int i, n, num, count = 0, fd = lo_server_get_socket_fd(dev->servers[SERVER_UDP]);
+    if (!mpr_atomic_cas(&net->recv_buf_busy, 0, 1))
+        goto fallback;
+    if (!net->recv_buf && !(net->recv_buf = malloc(RECV_BATCH * MAX_DATAGRAM_SIZE))) {
+        mpr_atomic_store(&net->recv_buf_busy, 0);
+        goto fallback;
+    }
+    while (count < budget) {
+        num = (budget - count < RECV_BATCH) ? budget - count : RECV_BATCH;
+        memset(msgs, 0, sizeof(struct mmsghdr) * num);
+        for (i = 0; i < num; i++) {
+            iov[i].iov_base = net->recv_buf + i * MAX_DATAGRAM_SIZE;
+            iov[i].iov_len = MAX_DATAGRAM_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        if ((n = recvmmsg(fd, msgs, num, MSG_DONTWAIT, NULL)) <= 0)
+            break;
+        for (i = 0; i < n; i++) {
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                trace_dev(dev, "dropping truncated datagram of %u bytes\n", msgs[i].msg_len);
+                continue;
+            }
+            lo_server_dispatch_data(dev->servers[SERVER_UDP], iov[i].iov_base, msgs[i].msg_len);
+        }
+        count += n;
+        if (n < num)
+            break;
+    }
+    mpr_atomic_store(&net->recv_buf_busy, 0);
+    return count;
+
+  fallback:
+    while (count < budget && lo_server_recv_noblock(dev->servers[SERVER_UDP], 0))
+        ++count;
+    return count;
+}
+#endif
+
+void mpr_dev_set_recv_budget(mpr_dev dev, int num_msgs)
+{
+    RETURN_UNLESS(dev && dev->is_local);
+    ((mpr_local_dev)dev)->recv_budget = num_msgs > 0 ? num_msgs : 0;
+}
+
 int mpr_dev_poll(mpr_dev dev, int block_ms)
 {
-    int admin_count = 0, device_count = 0, status[4];
+    int admin_count = 0, device_count = 0, status[4], budget;
     mpr_local_dev ldev = (mpr_local_dev)dev;
     mpr_net net;
     lo_server servers[4];
     RETURN_ARG_UNLESS(dev && dev->is_local, 0);
     net = &dev->obj.graph->net;
+
+    /* once a graph has worker threads, devices without one still handle administrative
+     * messages unless another thread is already polling the graph */
+    if (net->num_workers)
+        return ldev->is_worker ? 0 : _poll_data(ldev, block_ms, 1);
+
     mpr_net_poll(net);
     mpr_graph_housekeeping(dev->obj.graph);
 
@@ -755,7 +1204,9 @@ int mpr_dev_poll(mpr_dev dev, int block_ms)
 
     ldev->polling = 1;
     ldev->time_is_stale = 1;
+    ldev->stats[MPR_DEV_STAT_SENDS_SAVED] = 0;
     mpr_dev_get_time(dev);
+    _process_async_sigs(ldev);
     _process_outgoing_maps(ldev);
     ldev->polling = 0;
 
@@ -783,6 +1234,7 @@ int mpr_dev_poll(mpr_dev dev, int block_ms)
             }
             /* check if any signal update bundles need to be sent */
             _process_incoming_maps(ldev);
+            _process_async_sigs(ldev);
             _process_outgoing_maps(ldev);
             ldev->polling = 0;
 
@@ -796,35 +1248,276 @@ int mpr_dev_poll(mpr_dev dev, int block_ms)
         }
     }
 
-    /* When done, or if non-blocking, check for remaining messages up to a
-     * proportion of the number of input signals. Arbitrarily choosing 1 for
-     * now, but perhaps could be a heuristic based on a recent number of
-     * messages per channel per poll. */
-    while (device_count < (dev->num_inputs + ldev->n_output_callbacks)*1
-           && (lo_servers_recv_noblock(ldev->servers, &status[2], 2, 0)))
+    /* When done, or if non-blocking, check for remaining messages up to the receive budget. By
+     * default this is a proportion of the number of input signals. Arbitrarily choosing 1 for
+     * now, but perhaps could be a heuristic based on a recent number of messages per channel
+     * per poll. */
+    budget = ldev->recv_budget ? ldev->recv_budget : (dev->num_inputs + ldev->n_output_callbacks);
+#ifdef HAVE_RECVMMSG
+    if (device_count < budget)
+        device_count += _recv_udp_batch(ldev, budget - device_count);
+    while (device_count < budget && lo_server_recv_noblock(ldev->servers[SERVER_TCP], 0))
+        ++device_count;
+#else
+    while (device_count < budget && (lo_servers_recv_noblock(ldev->servers, &status[2], 2, 0)))
         device_count += (status[2] > 0) + (status[3] > 0);
+#endif
 
     /* process incoming maps */
     ldev->polling = 1;
     _process_incoming_maps(ldev);
     ldev->polling = 0;
 
-    if (dev->obj.props.synced->dirty && mpr_dev_get_is_ready(dev) && ldev->subscribers) {
-        /* inform device subscribers of changed properties */
-        mpr_net_use_subscribers(net, ldev, MPR_DEV);
-        mpr_dev_send_state(dev, MSG_DEV);
-    }
+    mpr_dev_send_changed_state(ldev);
 
     net->msgs_recvd |= admin_count;
     return admin_count + device_count;
 }
 
+/* Route received updates and anything that was queued while the device was idle. */
+static void _process_maps(mpr_local_dev ldev)
+{
+    ldev->polling = 1;
+    ldev->time_is_stale = 1;
+    mpr_dev_get_time((mpr_dev)ldev);
+    _process_incoming_maps(ldev);
+    _process_async_sigs(ldev);
+    _process_outgoing_maps(ldev);
+    ldev->polling = 0;
+}
+
+/* Poll the data servers of a device, holding its lock while messages and updates are
+ * processed. If admin is set and no other thread is handling administrative messages, the
+ * graph servers are polled as well. */
+static int _poll_data(mpr_local_dev ldev, int block_ms, int admin)
+{
+    int count = 0, status[4], wait_ms, left_ms = block_ms, num_servers;
+    mpr_graph g = ldev->obj.graph;
+    lo_server servers[4];
+    double then = mpr_get_current_time();
+
+    memcpy(servers, ldev->servers, sizeof(lo_server) * 2);
+    memcpy(servers + 2, g->net.servers, sizeof(lo_server) * 2);
+    do {
+        /* wait without holding the lock so the control thread is not stalled */
+        wait_ms = left_ms > 100 ? 100 : left_ms;
+        if (ldev->sending && wait_ms > 1) {
+            /* updates to another local device were deferred, retry soon */
+            wait_ms = 1;
+        }
+        num_servers = (admin && mpr_mutex_trylock(&g->net.admin_lock)) ? 4 : 2;
+        lo_servers_wait(servers, status, num_servers, wait_ms);
+        if (num_servers > 2) {
+            count += mpr_graph_poll_admin(g, 0);
+            mpr_mutex_unlock(&g->net.admin_lock);
+        }
+
+        mpr_mutex_lock(&ldev->lock);
+        ldev->data_locked = 1;
+        if (ldev->registered) {
+            ldev->polling = 1;
+            while (lo_servers_recv_noblock(ldev->servers, status, 2, 0))
+                count += (status[0] > 0) + (status[1] > 0);
+            _process_maps(ldev);
+        }
+        ldev->data_locked = 0;
+        mpr_mutex_unlock(&ldev->lock);
+
+        left_ms = block_ms - (int)((mpr_get_current_time() - then) * 1000);
+    } while (left_ms > 0);
+    return count;
+}
+
+int mpr_dev_poll_until(mpr_dev dev, mpr_time deadline)
+{
+    int count = 0, loops = 0, status[4];
+    double start, now, end, checked_admin;
+    mpr_local_dev ldev = (mpr_local_dev)dev;
+    mpr_net net;
+    lo_server servers[4];
+    mpr_time t;
+    RETURN_ARG_UNLESS(dev && dev->is_local, 0);
+    net = &dev->obj.graph->net;
+    /* devices running on a worker thread are polled by that thread */
+    RETURN_ARG_UNLESS(!net->num_workers || !ldev->is_worker, 0);
+
+    /* convert the deadline once so the loop only needs to read the monotonic clock, which is not
+     * affected by adjustments to the system time */
+    mpr_time_set(&t, MPR_NOW);
+    start = checked_admin = now = mpr_get_monotonic_time();
+    end = start + mpr_time_get_diff(deadline, t);
+
+    /* until the device is registered there are no data messages to spin on */
+    while (!ldev->registered && now < end) {
+        int left_ms = (int)((end - now) * 1000);
+        count += mpr_dev_poll(dev, left_ms);
+        now = mpr_get_monotonic_time();
+    }
+    RETURN_ARG_UNLESS(now < end, count);
+    start = now;
+
+    if (net->num_workers) {
+        /* as in mpr_dev_poll(), process updates under the device lock and leave administrative
+         * messages to other threads if they are already handling them */
+        int admin;
+        ldev->stats[MPR_DEV_STAT_SENDS_SAVED] = 0;
+        do {
+            if ((admin = !loops || now - checked_admin > 0.1))
+                checked_admin = now;
+            count += _poll_data(ldev, 0, admin);
+            ++loops;
+            now = mpr_get_monotonic_time();
+        } while (now < end);
+        ldev->stats[MPR_DEV_STAT_LOOP_RATE] = now > start ? loops / (now - start) : 0;
+        return count;
+    }
+
+    mpr_net_poll(net);
+    mpr_graph_housekeeping(dev->obj.graph);
+    ldev->stats[MPR_DEV_STAT_SENDS_SAVED] = 0;
+
+    memcpy(servers, net->servers, sizeof(lo_server) * 2);
+    memcpy(servers + 2, ldev->servers, sizeof(lo_server) * 2);
+
+    /* spin on non-blocking receives, routing updates on every iteration */
+    do {
+        ldev->polling = 1;
+        if (lo_servers_recv_noblock(servers, status, 4, 0)) {
+            net->msgs_recvd |= (status[0] > 0) + (status[1] > 0);
+            count += (status[0] > 0) + (status[1] > 0) + (status[2] > 0) + (status[3] > 0);
+        }
+        _process_maps(ldev);
+        ++loops;
+
+        now = mpr_get_monotonic_time();
+        if (now - checked_admin > 0.1) {
+            mpr_net_poll(net);
+            mpr_graph_housekeeping(dev->obj.graph);
+            checked_admin = now;
+        }
+    } while (now < end);
+    mpr_dev_send_changed_state(ldev);
+
+    ldev->stats[MPR_DEV_STAT_LOOP_RATE] = now > start ? loops / (now - start) : 0;
+    return count;
+}
+
+int mpr_dev_set_busy_poll(mpr_dev dev, int usec)
+{
+    RETURN_ARG_UNLESS(dev && dev->is_local && ((mpr_local_dev)dev)->servers[SERVER_UDP], 0);
+#ifdef SO_BUSY_POLL
+    {
+        int i;
+        mpr_local_dev ldev = (mpr_local_dev)dev;
+        for (i = 0; i < 2; i++) {
+            if (setsockopt(lo_server_get_socket_fd(ldev->servers[i]), SOL_SOCKET, SO_BUSY_POLL,
+                           &usec, sizeof(int))) {
+                trace_dev(ldev, "could not set SO_BUSY_POLL on device socket\n");
+                return 0;
+            }
+        }
+        return 1;
+    }
+#else
+    return 0;
+#endif
+}
+
+int mpr_dev_get_fds(mpr_dev dev, int *fds, int num)
+{
+    int i, count;
+    mpr_local_dev ldev = (mpr_local_dev)dev;
+    RETURN_ARG_UNLESS(dev && dev->is_local, 0);
+    count = mpr_graph_get_fds(dev->obj.graph, fds, num);
+    /* device servers are started once the device has been registered */
+    RETURN_ARG_UNLESS(ldev->servers[SERVER_UDP], count);
+    for (i = 0; i < 2; i++, count++) {
+        if (count < num)
+            fds[count] = lo_server_get_socket_fd(ldev->servers[i]);
+    }
+    return count;
+}
+
+int mpr_dev_get_timeout(mpr_dev dev)
+{
+    int timeout;
+    mpr_local_dev ldev = (mpr_local_dev)dev;
+    RETURN_ARG_UNLESS(dev && dev->is_local, 0);
+    /* pending updates should be routed without waiting for a timer */
+    RETURN_ARG_UNLESS(!ldev->async_sigs && !ldev->sending, 0);
+    timeout = mpr_graph_get_timeout(dev->obj.graph);
+    /* connections accepted by the TCP server are only received in mpr_dev_process_timers(), so
+     * once there are any service them as often as mpr_dev_poll() would */
+    if (ldev->tcp_clients) {
+        int tcp_ms = (int)ceil((ldev->tcp_checked + 0.1 - mpr_get_current_time()) * 1000);
+        if (tcp_ms < timeout)
+            timeout = tcp_ms > 0 ? tcp_ms : 0;
+    }
+    return timeout;
+}
+
+int mpr_dev_process_fd(mpr_dev dev, int fd)
+{
+    int count = 0, budget;
+    mpr_local_dev ldev = (mpr_local_dev)dev;
+    RETURN_ARG_UNLESS(dev && dev->is_local, 0);
+    if (!ldev->registered)
+        return mpr_graph_process_fd(dev->obj.graph, fd);
+
+    /* drain the socket unless a receive budget has been set */
+    budget = ldev->recv_budget ? ldev->recv_budget : INT_MAX;
+    ldev->polling = 1;
+    if (fd == lo_server_get_socket_fd(ldev->servers[SERVER_UDP])) {
+#ifdef HAVE_RECVMMSG
+        count = _recv_udp_batch(ldev, budget);
+#else
+        while (count < budget && lo_server_recv_noblock(ldev->servers[SERVER_UDP], 0))
+            ++count;
+#endif
+    }
+    else if (fd == lo_server_get_socket_fd(ldev->servers[SERVER_TCP])) {
+        /* the listening socket is readable when a connection is waiting to be accepted */
+        ldev->tcp_clients = 1;
+        while (count < budget && lo_server_recv_noblock(ldev->servers[SERVER_TCP], 0))
+            ++count;
+    }
+    else {
+        ldev->polling = 0;
+        return mpr_graph_process_fd(dev->obj.graph, fd);
+    }
+    _process_maps(ldev);
+    mpr_dev_send_changed_state(ldev);
+    return count;
+}
+
+void mpr_dev_process_timers(mpr_dev dev)
+{
+    mpr_local_dev ldev = (mpr_local_dev)dev;
+    RETURN_UNLESS(dev && dev->is_local);
+    mpr_graph_process_timers(dev->obj.graph);
+    if (!ldev->registered) {
+        ldev->bundle_idx = 1;
+        return;
+    }
+    /* connections accepted by the TCP server are not exposed by liblo, so service them here */
+    ldev->polling = 1;
+    while (lo_server_recv_noblock(ldev->servers[SERVER_TCP], 0))
+        ldev->tcp_clients = 1;
+    ldev->tcp_checked = mpr_get_current_time();
+    _process_maps(ldev);
+    mpr_dev_send_changed_state(ldev);
+}
+
 #ifdef HAVE_LIBPTHREAD
 static void *device_thread_func(void *data)
 {
     mpr_thread_data td = (mpr_thread_data)data;
+    mpr_local_dev dev = (mpr_local_dev)td->object;
     while (td->is_active) {
-        mpr_dev_poll((mpr_dev)td->object, 100);
+        if (dev->is_worker)
+            _poll_data(dev, 100, 0);
+        else
+            mpr_dev_poll((mpr_dev)dev, 100);
     }
     td->is_done = 1;
     pthread_exit(NULL);
@@ -836,8 +1529,12 @@ static void *device_thread_func(void *data)
 static unsigned __stdcall device_thread_func(void *data)
 {
     mpr_thread_data td = (mpr_thread_data)data;
+    mpr_local_dev dev = (mpr_local_dev)td->object;
     while (td->is_active) {
-        mpr_dev_poll((mpr_dev)td->object, 100);
+        if (dev->is_worker)
+            _poll_data(dev, 100, 0);
+        else
+            mpr_dev_poll((mpr_dev)dev, 100);
     }
     td->is_done = 1;
     _endthread();
@@ -912,9 +1609,33 @@ int mpr_dev_stop_polling(mpr_dev dev)
 
     free(((mpr_local_dev)dev)->thread_data);
     ((mpr_local_dev)dev)->thread_data = 0;
+    if (((mpr_local_dev)dev)->is_worker) {
+        ((mpr_local_dev)dev)->is_worker = 0;
+        --dev->obj.graph->net.num_workers;
+    }
     return result;
 }
 
+int mpr_dev_start_worker(mpr_dev dev)
+{
+    int result;
+    mpr_local_dev ldev = (mpr_local_dev)dev;
+    RETURN_ARG_UNLESS(dev && dev->is_local && !ldev->thread_data, 0);
+    ldev->is_worker = 1;
+    ++dev->obj.graph->net.num_workers;
+    if ((result = mpr_dev_start_polling(dev))) {
+        ldev->is_worker = 0;
+        --dev->obj.graph->net.num_workers;
+    }
+    return result;
+}
+
+double mpr_dev_get_stat(mpr_dev dev, mpr_dev_stat stat)
+{
+    RETURN_ARG_UNLESS(dev && dev->is_local && stat >= 0 && stat < MPR_DEV_NUM_STATS, 0);
+    return ((mpr_local_dev)dev)->stats[stat];
+}
+
 mpr_time mpr_dev_get_time(mpr_dev dev)
 {
     RETURN_ARG_UNLESS(dev && dev->is_local, MPR_NOW);
@@ -955,9 +1676,38 @@ static void print_idmaps(mpr_local_dev dev)
 }
 #endif
 
+/* Rebuild the hash tables for a group of id maps with a given number of buckets. Id maps are
+ * appended to bucket chains in list order, so the most recently added map is found first. */
+static void _rehash_idmaps(mpr_local_dev dev, int group, int size)
+{
+    mpr_id_map map, *LID, *GID;
+    mpr_id_map_tbl_t *tbl = &dev->idmaps.tbls[group];
+    RETURN_UNLESS(size);
+    LID = (mpr_id_map*) calloc(1, sizeof(mpr_id_map) * size);
+    GID = (mpr_id_map*) calloc(1, sizeof(mpr_id_map) * size);
+    for (map = dev->idmaps.active[group]; map; map = map->next) {
+        mpr_id_map *b = &LID[mpr_id_hash(map->LID) & (size - 1)];
+        while (*b)
+            b = &(*b)->next_LID;
+        *b = map;
+        map->next_LID = 0;
+        b = &GID[mpr_id_hash(map->GID) & (size - 1)];
+        while (*b)
+            b = &(*b)->next_GID;
+        *b = map;
+        map->next_GID = 0;
+    }
+    FUNC_IF(free, tbl->LID);
+    FUNC_IF(free, tbl->GID);
+    tbl->LID = LID;
+    tbl->GID = GID;
+    tbl->size = size;
+}
+
 mpr_id_map mpr_dev_add_idmap(mpr_local_dev dev, int group, mpr_id LID, mpr_id GID)
 {
     mpr_id_map map;
+    mpr_id_map_tbl_t *tbl;
     if (!dev->idmaps.reserve)
         mpr_dev_reserve_idmap(dev);
     map = dev->idmaps.reserve;
@@ -969,6 +1719,18 @@ mpr_id_map mpr_dev_add_idmap(mpr_local_dev dev, int group, mpr_id LID, mpr_id GI
     dev->idmaps.reserve = map->next;
     map->next = dev->idmaps.active[group];
     dev->idmaps.active[group] = map;
+
+    tbl = &dev->idmaps.tbls[group];
+    if (++tbl->count > tbl->size)
+        _rehash_idmaps(dev, group, tbl->size ? tbl->size * 2 : 16);
+    else {
+        mpr_id_map *b = &tbl->LID[mpr_id_hash(LID) & (tbl->size - 1)];
+        map->next_LID = *b;
+        *b = map;
+        b = &tbl->GID[mpr_id_hash(map->GID) & (tbl->size - 1)];
+        map->next_GID = *b;
+        *b = map;
+    }
 #ifdef DEBUG
     print_idmaps(dev);
 #endif
@@ -978,6 +1740,7 @@ mpr_id_map mpr_dev_add_idmap(mpr_local_dev dev, int group, mpr_id LID, mpr_id GI
 static void mpr_dev_remove_idmap(mpr_local_dev dev, int group, mpr_id_map rem)
 {
     mpr_id_map *map = &dev->idmaps.active[group];
+    mpr_id_map_tbl_t *tbl = &dev->idmaps.tbls[group];
     trace_dev(dev, "mpr_dev_remove_idmap(%s) %"PR_MPR_ID" -> %"PR_MPR_ID"\n",
               dev->name, rem->LID, rem->GID);
     while (*map) {
@@ -985,10 +1748,23 @@ static void mpr_dev_remove_idmap(mpr_local_dev dev, int group, mpr_id_map rem)
             *map = (*map)->next;
             rem->next = dev->idmaps.reserve;
             dev->idmaps.reserve = rem;
+            --tbl->count;
             break;
         }
         map = &(*map)->next;
     }
+    if (tbl->size) {
+        map = &tbl->LID[mpr_id_hash(rem->LID) & (tbl->size - 1)];
+        while (*map && *map != rem)
+            map = &(*map)->next_LID;
+        if (*map)
+            *map = rem->next_LID;
+        map = &tbl->GID[mpr_id_hash(rem->GID) & (tbl->size - 1)];
+        while (*map && *map != rem)
+            map = &(*map)->next_GID;
+        if (*map)
+            *map = rem->next_GID;
+    }
 #ifdef DEBUG
     print_idmaps(dev);
 #endif
@@ -1028,26 +1804,59 @@ int mpr_dev_GID_decref(mpr_local_dev dev, int group, mpr_id_map map)
 
 mpr_id_map mpr_dev_get_idmap_by_LID(mpr_local_dev dev, int group, mpr_id LID)
 {
-    mpr_id_map map = dev->idmaps.active[group];
+    mpr_id_map map;
+    mpr_id_map_tbl_t *tbl = &dev->idmaps.tbls[group];
+    RETURN_ARG_UNLESS(tbl->size, 0);
+    map = tbl->LID[mpr_id_hash(LID) & (tbl->size - 1)];
     while (map) {
         if (map->LID == LID)
             return map;
-        map = map->next;
+        map = map->next_LID;
     }
     return 0;
 }
 
 mpr_id_map mpr_dev_get_idmap_by_GID(mpr_local_dev dev, int group, mpr_id GID)
 {
-    mpr_id_map map = dev->idmaps.active[group];
+    mpr_id_map map;
+    mpr_id_map_tbl_t *tbl = &dev->idmaps.tbls[group];
+    RETURN_ARG_UNLESS(tbl->size, 0);
+    map = tbl->GID[mpr_id_hash(GID) & (tbl->size - 1)];
     while (map) {
         if (map->GID == GID)
             return map;
-        map = map->next;
+        map = map->next_GID;
     }
     return 0;
 }
 
+static int handler_wake(const char *path, const char *types, lo_arg **argv, int argc,
+                        lo_message msg, void *user_data)
+{
+    /* nothing to do: pending updates are routed once the poll returns */
+    return 0;
+}
+
+/* Open a socket for waking the polling thread by sending a datagram to our own UDP server. */
+static void _init_wakeup(mpr_local_dev dev)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    RETURN_UNLESS(!getsockname(lo_server_get_socket_fd(dev->servers[SERVER_UDP]),
+                               (struct sockaddr*)&addr, &len));
+    if (AF_INET == addr.ss_family)
+        ((struct sockaddr_in*)&addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    else if (AF_INET6 == addr.ss_family)
+        ((struct sockaddr_in6*)&addr)->sin6_addr = in6addr_loopback;
+    else
+        return;
+    RETURN_UNLESS((dev->wake_fd = socket(addr.ss_family, SOCK_DGRAM, 0)) >= 0);
+    dev->wake_sa = malloc(len);
+    memcpy(dev->wake_sa, &addr, len);
+    dev->wake_sa_len = len;
+    lo_server_add_method(dev->servers[SERVER_UDP], WAKE_PATH, "", handler_wake, NULL);
+}
+
 /* Internal LibLo error handler */
 static void handler_error(int num, const char *msg, const char *where)
 {
@@ -1073,6 +1882,8 @@ static void mpr_dev_start_servers(mpr_local_dev dev)
         /* Add bundle handlers */
         lo_server_add_bundle_handlers(dev->servers[SERVER_UDP], mpr_dev_bundle_start, NULL, (void*)dev);
         lo_server_add_bundle_handlers(dev->servers[SERVER_TCP], mpr_dev_bundle_start, NULL, (void*)dev);
+
+        _init_wakeup(dev);
     }
 
     portnum = lo_server_get_port(dev->servers[SERVER_UDP]);
@@ -8,9 +8,10 @@
 #include <float.h>
 #include "mapper_internal.h"
 
-#define MAX_HIST_SIZE 100
+#define MAX_HIST_SIZE 32767
 #define STACK_SIZE 64
 #define N_USER_VARS 16
+#define MAX_FIR_COEFS 256
 #ifdef DEBUG
     #define TRACE_PARSE 0 /* Set non-zero to see trace during parse. */
     #define TRACE_EVAL 0 /* Set non-zero to see trace during evaluation. */
@@ -287,6 +288,286 @@ SUMNUM_VFUNC(vsumnumi, int, i)
 SUMNUM_VFUNC(vsumnumf, float, f)
 SUMNUM_VFUNC(vsumnumd, double, d)
 
+/* Kernels for reductions and element-wise arithmetic on long float and double vectors. Values
+ * on the evaluation stack are unions, so doubles are contiguous while floats have a stride of
+ * two. The scalar kernels are replaced at runtime by SSE2 or AVX versions where available. Short
+ * vectors keep using the generic code above so that their results are unchanged. */
+#define MIN_KERNEL_LEN 16
+
+typedef float vec_reduce_f(mpr_expr_val a, mpr_expr_val b, int len);
+typedef double vec_reduce_d(mpr_expr_val a, mpr_expr_val b, int len);
+typedef void vec_binop_fn(mpr_expr_val dst, mpr_expr_val a, mpr_expr_val b, int len);
+
+/* Element-wise kernels, in the same order as the binop handlers used by compiled expressions. */
+enum {
+    KERNEL_ADD,
+    KERNEL_SUB,
+    KERNEL_MUL,
+    KERNEL_DIV,
+    KERNEL_MAX,
+    KERNEL_MIN,
+    N_BINOP_KERNELS
+};
+
+#define SCALAR_KERNELS(TYPE, T)                                             \
+static TYPE k_sum_##T(mpr_expr_val a, mpr_expr_val b, int len)              \
+{                                                                           \
+    TYPE sum = 0;                                                           \
+    int i;                                                                  \
+    for (i = 0; i < len; i++)                                               \
+        sum += a[i].T;                                                      \
+    return sum;                                                             \
+}                                                                           \
+static TYPE k_dot_##T(mpr_expr_val a, mpr_expr_val b, int len)              \
+{                                                                           \
+    TYPE dot = 0;                                                           \
+    int i;                                                                  \
+    for (i = 0; i < len; i++)                                               \
+        dot += a[i].T * b[i].T;                                             \
+    return dot;                                                             \
+}                                                                           \
+static TYPE k_max_##T(mpr_expr_val a, mpr_expr_val b, int len)              \
+{                                                                           \
+    TYPE max = a[0].T;                                                      \
+    int i;                                                                  \
+    for (i = 1; i < len; i++) {                                             \
+        if (a[i].T > max)                                                   \
+            max = a[i].T;                                                   \
+    }                                                                       \
+    return max;                                                             \
+}                                                                           \
+static TYPE k_min_##T(mpr_expr_val a, mpr_expr_val b, int len)              \
+{                                                                           \
+    TYPE min = a[0].T;                                                      \
+    int i;                                                                  \
+    for (i = 1; i < len; i++) {                                             \
+        if (a[i].T < min)                                                   \
+            min = a[i].T;                                                   \
+    }                                                                       \
+    return min;                                                             \
+}
+
+#define SCALAR_BINOP_KERNEL(NAME, T, CALC)                                  \
+static void k_v##NAME##_##T(mpr_expr_val dst, mpr_expr_val a, mpr_expr_val b, int len)\
+{                                                                           \
+    int i;                                                                  \
+    for (i = 0; i < len; i++)                                               \
+        dst[i].T = CALC;                                                    \
+}
+
+#define SCALAR_BINOP_KERNELS(T)                                             \
+SCALAR_BINOP_KERNEL(add, T, a[i].T + b[i].T)                                \
+SCALAR_BINOP_KERNEL(sub, T, a[i].T - b[i].T)                                \
+SCALAR_BINOP_KERNEL(mul, T, a[i].T * b[i].T)                                \
+SCALAR_BINOP_KERNEL(div, T, a[i].T / b[i].T)                                \
+SCALAR_BINOP_KERNEL(max, T, b[i].T > a[i].T ? b[i].T : a[i].T)              \
+SCALAR_BINOP_KERNEL(min, T, b[i].T < a[i].T ? b[i].T : a[i].T)
+
+SCALAR_KERNELS(float, f)
+SCALAR_KERNELS(double, d)
+SCALAR_BINOP_KERNELS(f)
+SCALAR_BINOP_KERNELS(d)
+
+static struct {
+    vec_reduce_f *sumf, *dotf, *maxf, *minf;
+    vec_reduce_d *sumd, *dotd, *maxd, *mind;
+    vec_binop_fn *binopf[N_BINOP_KERNELS];
+    vec_binop_fn *binopd[N_BINOP_KERNELS];
+} kernels = {
+    k_sum_f, k_dot_f, k_max_f, k_min_f,
+    k_sum_d, k_dot_d, k_max_d, k_min_d,
+    { k_vadd_f, k_vsub_f, k_vmul_f, k_vdiv_f, k_vmax_f, k_vmin_f },
+    { k_vadd_d, k_vsub_d, k_vmul_d, k_vdiv_d, k_vmax_d, k_vmin_d }
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+
+/* Generate the x86 kernels for one instruction set. VEC is the number of elements per register,
+ * LOAD and STORE move registers between registers and the evaluation stack, and HSUM, HMAX and
+ * HMIN finish reductions across the elements of a register. */
+#define X86_KERNELS(ISA, ATTR, T, TYPE, REG, VEC, LOAD, STORE, ADD, SUB, MUL, DIV, MAX, MIN, SET1, ZERO)\
+ATTR static TYPE k_##ISA##_sum_##T(mpr_expr_val a, mpr_expr_val b, int len) \
+{                                                                           \
+    TYPE tmp[VEC], sum = 0;                                                 \
+    REG acc = ZERO();                                                       \
+    int i, j;                                                               \
+    for (i = 0; i + VEC <= len; i += VEC)                                   \
+        acc = ADD(acc, LOAD(a + i));                                        \
+    memcpy(tmp, &acc, sizeof(tmp));                                         \
+    for (j = 0; j < VEC; j++)                                               \
+        sum += tmp[j];                                                      \
+    for (; i < len; i++)                                                    \
+        sum += a[i].T;                                                      \
+    return sum;                                                             \
+}                                                                           \
+ATTR static TYPE k_##ISA##_dot_##T(mpr_expr_val a, mpr_expr_val b, int len) \
+{                                                                           \
+    TYPE tmp[VEC], dot = 0;                                                 \
+    REG acc = ZERO();                                                       \
+    int i, j;                                                               \
+    for (i = 0; i + VEC <= len; i += VEC)                                   \
+        acc = ADD(acc, MUL(LOAD(a + i), LOAD(b + i)));                      \
+    memcpy(tmp, &acc, sizeof(tmp));                                         \
+    for (j = 0; j < VEC; j++)                                               \
+        dot += tmp[j];                                                      \
+    for (; i < len; i++)                                                    \
+        dot += a[i].T * b[i].T;                                             \
+    return dot;                                                             \
+}                                                                           \
+ATTR static TYPE k_##ISA##_max_##T(mpr_expr_val a, mpr_expr_val b, int len) \
+{                                                                           \
+    TYPE tmp[VEC], max = a[0].T;                                            \
+    REG acc = SET1(max);                                                    \
+    int i, j;                                                               \
+    for (i = 0; i + VEC <= len; i += VEC)                                   \
+        acc = MAX(LOAD(a + i), acc);                                        \
+    memcpy(tmp, &acc, sizeof(tmp));                                         \
+    for (j = 0; j < VEC; j++) {                                             \
+        if (tmp[j] > max)                                                   \
+            max = tmp[j];                                                   \
+    }                                                                       \
+    for (; i < len; i++) {                                                  \
+        if (a[i].T > max)                                                   \
+            max = a[i].T;                                                   \
+    }                                                                       \
+    return max;                                                             \
+}                                                                           \
+ATTR static TYPE k_##ISA##_min_##T(mpr_expr_val a, mpr_expr_val b, int len) \
+{                                                                           \
+    TYPE tmp[VEC], min = a[0].T;                                            \
+    REG acc = SET1(min);                                                    \
+    int i, j;                                                               \
+    for (i = 0; i + VEC <= len; i += VEC)                                   \
+        acc = MIN(LOAD(a + i), acc);                                        \
+    memcpy(tmp, &acc, sizeof(tmp));                                         \
+    for (j = 0; j < VEC; j++) {                                             \
+        if (tmp[j] < min)                                                   \
+            min = tmp[j];                                                   \
+    }                                                                       \
+    for (; i < len; i++) {                                                  \
+        if (a[i].T < min)                                                   \
+            min = a[i].T;                                                   \
+    }                                                                       \
+    return min;                                                             \
+}                                                                           \
+X86_BINOP_KERNEL(ISA, ATTR, add, T, VEC, LOAD, STORE, ADD(LOAD(a + i), LOAD(b + i)), a[i].T + b[i].T)\
+X86_BINOP_KERNEL(ISA, ATTR, sub, T, VEC, LOAD, STORE, SUB(LOAD(a + i), LOAD(b + i)), a[i].T - b[i].T)\
+X86_BINOP_KERNEL(ISA, ATTR, mul, T, VEC, LOAD, STORE, MUL(LOAD(a + i), LOAD(b + i)), a[i].T * b[i].T)\
+X86_BINOP_KERNEL(ISA, ATTR, div, T, VEC, LOAD, STORE, DIV(LOAD(a + i), LOAD(b + i)), a[i].T / b[i].T)\
+X86_BINOP_KERNEL(ISA, ATTR, max, T, VEC, LOAD, STORE, MAX(LOAD(b + i), LOAD(a + i)),         \
+                 b[i].T > a[i].T ? b[i].T : a[i].T)                                         \
+X86_BINOP_KERNEL(ISA, ATTR, min, T, VEC, LOAD, STORE, MIN(LOAD(b + i), LOAD(a + i)),         \
+                 b[i].T < a[i].T ? b[i].T : a[i].T)
+
+#define X86_BINOP_KERNEL(ISA, ATTR, NAME, T, VEC, LOAD, STORE, CALC, SCALAR_CALC)   \
+ATTR static void k_##ISA##_v##NAME##_##T(mpr_expr_val dst, mpr_expr_val a, mpr_expr_val b, int len)\
+{                                                                           \
+    int i;                                                                  \
+    for (i = 0; i + VEC <= len; i += VEC)                                   \
+        STORE(dst + i, CALC);                                               \
+    for (; i < len; i++)                                                    \
+        dst[i].T = SCALAR_CALC;                                             \
+}
+
+/* Floats occupy every second 32-bit word of the stack, so they are packed after loading and
+ * interleaved again before storing; the unused words of each union are overwritten. */
+#define SSE_LOAD_D(p) _mm_loadu_pd(&(p)->d)
+#define SSE_STORE_D(p, r) _mm_storeu_pd(&(p)->d, r)
+#define SSE_LOAD_F(p) _mm_shuffle_ps(_mm_loadu_ps(&(p)->f), _mm_loadu_ps(&(p)[2].f), \
+                                     _MM_SHUFFLE(2, 0, 2, 0))
+#define SSE_STORE_F(p, r) { __m128 _r = r;                      \
+                            _mm_storeu_ps(&(p)->f, _mm_unpacklo_ps(_r, _r));      \
+                            _mm_storeu_ps(&(p)[2].f, _mm_unpackhi_ps(_r, _r)); }
+#define AVX_LOAD_D(p) _mm256_loadu_pd(&(p)->d)
+#define AVX_STORE_D(p, r) _mm256_storeu_pd(&(p)->d, r)
+/* the packed order differs from the stack order but is restored by AVX_STORE_F */
+#define AVX_LOAD_F(p) _mm256_shuffle_ps(_mm256_loadu_ps(&(p)->f), _mm256_loadu_ps(&(p)[4].f), \
+                                        _MM_SHUFFLE(2, 0, 2, 0))
+#define AVX_STORE_F(p, r) { __m256 _r = r;                      \
+                            _mm256_storeu_ps(&(p)->f, _mm256_unpacklo_ps(_r, _r));    \
+                            _mm256_storeu_ps(&(p)[4].f, _mm256_unpackhi_ps(_r, _r)); }
+#define AVX_ATTR __attribute__((target("avx")))
+
+X86_KERNELS(sse, , f, float, __m128, 4, SSE_LOAD_F, SSE_STORE_F, _mm_add_ps, _mm_sub_ps,
+            _mm_mul_ps, _mm_div_ps, _mm_max_ps, _mm_min_ps, _mm_set1_ps, _mm_setzero_ps)
+X86_KERNELS(sse, , d, double, __m128d, 2, SSE_LOAD_D, SSE_STORE_D, _mm_add_pd, _mm_sub_pd,
+            _mm_mul_pd, _mm_div_pd, _mm_max_pd, _mm_min_pd, _mm_set1_pd, _mm_setzero_pd)
+X86_KERNELS(avx, AVX_ATTR, f, float, __m256, 8, AVX_LOAD_F, AVX_STORE_F, _mm256_add_ps,
+            _mm256_sub_ps, _mm256_mul_ps, _mm256_div_ps, _mm256_max_ps, _mm256_min_ps,
+            _mm256_set1_ps, _mm256_setzero_ps)
+X86_KERNELS(avx, AVX_ATTR, d, double, __m256d, 4, AVX_LOAD_D, AVX_STORE_D, _mm256_add_pd,
+            _mm256_sub_pd, _mm256_mul_pd, _mm256_div_pd, _mm256_max_pd, _mm256_min_pd,
+            _mm256_set1_pd, _mm256_setzero_pd)
+
+#define SET_KERNELS(ISA)                                                    \
+    kernels.sumf = k_##ISA##_sum_f;                                         \
+    kernels.dotf = k_##ISA##_dot_f;                                         \
+    kernels.maxf = k_##ISA##_max_f;                                         \
+    kernels.minf = k_##ISA##_min_f;                                         \
+    kernels.sumd = k_##ISA##_sum_d;                                         \
+    kernels.dotd = k_##ISA##_dot_d;                                         \
+    kernels.maxd = k_##ISA##_max_d;                                         \
+    kernels.mind = k_##ISA##_min_d;                                         \
+    kernels.binopf[KERNEL_ADD] = k_##ISA##_vadd_f;                          \
+    kernels.binopf[KERNEL_SUB] = k_##ISA##_vsub_f;                          \
+    kernels.binopf[KERNEL_MUL] = k_##ISA##_vmul_f;                          \
+    kernels.binopf[KERNEL_DIV] = k_##ISA##_vdiv_f;                          \
+    kernels.binopf[KERNEL_MAX] = k_##ISA##_vmax_f;                          \
+    kernels.binopf[KERNEL_MIN] = k_##ISA##_vmin_f;                          \
+    kernels.binopd[KERNEL_ADD] = k_##ISA##_vadd_d;                          \
+    kernels.binopd[KERNEL_SUB] = k_##ISA##_vsub_d;                          \
+    kernels.binopd[KERNEL_MUL] = k_##ISA##_vmul_d;                          \
+    kernels.binopd[KERNEL_DIV] = k_##ISA##_vdiv_d;                          \
+    kernels.binopd[KERNEL_MAX] = k_##ISA##_vmax_d;                          \
+    kernels.binopd[KERNEL_MIN] = k_##ISA##_vmin_d;
+
+/* Select the fastest kernels supported by this processor. This runs once when the library is
+ * loaded, before any thread can evaluate an expression. Other platforms use the scalar kernels. */
+__attribute__((constructor)) static void init_kernels(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        SET_KERNELS(avx);
+    }
+    else {
+        SET_KERNELS(sse);
+    }
+}
+#endif /* x86 */
+
+#define KERNEL_VFUNC(NAME, GENERIC, T, CALC)                                \
+static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)          \
+{                                                                           \
+    mpr_expr_val a = stk + idx * inc;                                       \
+    int len = dim[idx];                                                     \
+    if (len < MIN_KERNEL_LEN)                                               \
+        GENERIC(stk, dim, idx, inc);                                        \
+    else {                                                                  \
+        CALC;                                                               \
+    }                                                                       \
+}
+#define KERNEL_VFUNCS(T)                                                    \
+KERNEL_VFUNC(ksum##T, vsum##T, T, a[0].T = kernels.sum##T(a, 0, len))       \
+KERNEL_VFUNC(kmean##T, vmean##T, T, a[0].T = kernels.sum##T(a, 0, len) / len)\
+KERNEL_VFUNC(kcenter##T, vcenter##T, T,                                     \
+             a[0].T = (kernels.max##T(a, 0, len) + kernels.min##T(a, 0, len)) * 0.5)\
+KERNEL_VFUNC(kmax##T, vmax##T, T, a[0].T = kernels.max##T(a, 0, len))       \
+KERNEL_VFUNC(kmin##T, vmin##T, T, a[0].T = kernels.min##T(a, 0, len))       \
+KERNEL_VFUNC(knorm##T, vnorm##T, T, a[0].T = sqrt##T(kernels.dot##T(a, a, len)))\
+KERNEL_VFUNC(kdot##T, vdot##T, T, a[0].T = kernels.dot##T(a, a + inc, len)) \
+KERNEL_VFUNC(kmaxmin##T, vmaxmin##T, T,                                     \
+             kernels.binop##T[KERNEL_MAX](a, a, a + 2 * inc, len);          \
+             kernels.binop##T[KERNEL_MIN](a + inc, a + inc, a + 2 * inc, len))\
+KERNEL_VFUNC(ksumnum##T, vsumnum##T, T,                                     \
+             int i;                                                         \
+             kernels.binop##T[KERNEL_ADD](a, a, a + 2 * inc, len);          \
+             for (i = 0; i < len; i++)                                      \
+                 a[inc + i].T += 1)
+KERNEL_VFUNCS(f)
+KERNEL_VFUNCS(d)
+
 #define TYPED_EMA(TYPE, T)                              \
 static TYPE ema##T(TYPE memory, TYPE val, TYPE weight)  \
     { return val * weight + memory * (1 - weight); }
@@ -412,6 +693,12 @@ typedef enum {
     FN_SIG_IDX,
     FN_VEC_IDX,
     FN_UNIFORM,
+    /* filters keep running state for each instance */
+    FN_LOWPASS,
+    FN_HIGHPASS,
+    FN_BANDPASS,
+    FN_ONEPOLE,
+    FN_FIR,
     N_FN
 } expr_fn_t;
 
@@ -463,6 +750,12 @@ static struct {
     { "sig_idx",  1, 0, (void*)1,     0,                0                },
     { "vec_idx",  1, 0, (void*)1,     0,                0                },
     { "uniform",  1, 0, 0,            (void*)uniformf,  (void*)uniformd  },
+    { "lowpass",  3, 0, 0,            0,                0                },
+    { "highpass", 3, 0, 0,            0,                0                },
+    { "bandpass", 3, 0, 0,            0,                0                },
+    { "onepole",  2, 0, 0,            0,                0                },
+    /* the coefficients of fir() are moved out of the stack during parsing */
+    { "fir",      1, 0, 0,            0,                0                },
 };
 
 typedef enum {
@@ -495,17 +788,17 @@ static struct {
 } vfn_tbl[] = {
     { "all",    1, 1, 1, valli,    vallf,    valld    },
     { "any",    1, 1, 1, vanyi,    vanyf,    vanyd    },
-    { "center", 1, 1, 1, 0,        vcenterf, vcenterd },
-    { "max",    1, 1, 1, vmaxi,    vmaxf,    vmaxd    },
-    { "mean",   1, 1, 1, 0,        vmeanf,   vmeand   },
-    { "min",    1, 1, 1, vmini,    vminf,    vmind    },
-    { "sum",    1, 1, 1, vsumi,    vsumf,    vsumd    },
-    { "norm",   1, 1, 1, 0,        vnormf,   vnormd   },
+    { "center", 1, 1, 1, 0,        kcenterf, kcenterd },
+    { "max",    1, 1, 1, vmaxi,    kmaxf,    kmaxd    },
+    { "mean",   1, 1, 1, 0,        kmeanf,   kmeand   },
+    { "min",    1, 1, 1, vmini,    kminf,    kmind    },
+    { "sum",    1, 1, 1, vsumi,    ksumf,    ksumd    },
+    { "norm",   1, 1, 1, 0,        knormf,   knormd   },
     { "sort",   2, 0, 1, vsorti,   vsortf,   vsortd   },
-    { "maxmin", 3, 0, 0, vmaxmini, vmaxminf, vmaxmind },
-    { "sumnum", 3, 0, 0, vsumnumi, vsumnumf, vsumnumd },
+    { "maxmin", 3, 0, 0, vmaxmini, kmaxminf, kmaxmind },
+    { "sumnum", 3, 0, 0, vsumnumi, ksumnumf, ksumnumd },
     { "angle",  2, 1, 0, 0,        vanglef,  vangled  },
-    { "dot",    2, 1, 0, vdoti,    vdotf,    vdotd    }
+    { "dot",    2, 1, 0, vdoti,    kdotf,    kdotd    }
 };
 
 typedef enum {
@@ -642,6 +935,8 @@ enum toktype {
     TOK_LOOP_END,
     TOK_SP_ADD,                         /* Stack pointer offset */
     TOK_REDUCING,
+    TOK_WINDOW,                         /* Windowed history reduction */
+    TOK_POOL,                           /* Instance reduction read from running aggregates */
     TOK_END             = 0x2000000
 };
 
@@ -701,6 +996,9 @@ struct function_type {
     /* end of generic_type */
     int8_t idx;
     uint8_t arity;          /* used by TOK_FN, TOK_VFN, TOK_VECTORIZE */
+    uint8_t state;          /* only used by filter functions */
+    uint8_t n_taps;         /* only used by fir() */
+    uint16_t coef_idx;      /* only used by fir() */
 };
 
 enum reduce_type {
@@ -721,9 +1019,31 @@ struct control_type {
     uint8_t flags;
     /* end of generic_type */
     int8_t cache_offset;
-    uint8_t reduce_start;
-    uint8_t reduce_stop;
     uint8_t branch_offset;
+    uint16_t reduce_start;
+    uint16_t reduce_stop;
+};
+
+enum window_op {
+    WIN_SUM,
+    WIN_MEAN,
+    WIN_MAX,
+    WIN_MIN,
+    WIN_MAXMIN              /* both extremes, only used while lowering */
+};
+
+struct window_type {
+    enum toktype toktype;
+    mpr_type datatype;
+    mpr_type casttype;
+    uint8_t vec_len;
+    uint8_t flags;
+    /* end of generic_type */
+    int8_t idx;             /* input signal, as for TOK_VAR */
+    uint8_t vec_idx;
+    uint16_t len;           /* number of samples in the window */
+    uint8_t op;             /* enum window_op */
+    uint8_t state;          /* index of the running state kept by each instance */
 };
 
 typedef union _token {
@@ -734,6 +1054,7 @@ typedef union _token {
     struct variable_type var;
     struct function_type fn;
     struct control_type con;
+    struct window_type win;
 } mpr_token_t, *mpr_token;
 
 #define VAR_ASSIGNED    0x0001
@@ -1147,8 +1468,23 @@ struct _mpr_expr
     int8_t mute_ctl;
     int8_t n_ins;
     uint16_t max_in_hist_size;
+    struct _mpr_expr_prog *prog;    /* compiled final statement, or 0 */
+    uint8_t n_parsed_tokens;        /* number of tokens before optimization */
+    struct _expr_cache_entry *cached;   /* shared expression this one refers to, or 0 */
+    uint8_t n_states;               /* number of windows and filters keeping running state */
+    struct _expr_state **inst_state; /* running state of each window or filter per instance */
+    int n_inst_state;               /* number of instances with room in inst_state */
+    double *coefs;                  /* fir() coefficients, shared with cached copies */
 };
 
+static void expr_prog_free(struct _mpr_expr_prog *prog);
+static void expr_cache_release(struct _expr_cache_entry *entry);
+
+void mpr_expr_stack_reserve(mpr_expr_stack stk, mpr_expr expr)
+{
+    expr_stack_realloc(stk, expr->stack_size * expr->vec_len);
+}
+
 static void free_stack_vliterals(mpr_token_t *stk, int top)
 {
     while (top >= 0) {
@@ -1158,10 +1494,29 @@ static void free_stack_vliterals(mpr_token_t *stk, int top)
     }
 }
 
+static void free_inst_state(mpr_expr expr)
+{
+    int i;
+    RETURN_UNLESS(expr->inst_state);
+    for (i = 0; i < expr->n_inst_state * expr->n_states; i++)
+        FUNC_IF(free, expr->inst_state[i]);
+    free(expr->inst_state);
+}
+
 void mpr_expr_free(mpr_expr expr)
 {
     int i;
+    free_inst_state(expr);
+    if (expr->cached) {
+        /* only the variable flags and running state belong to this copy */
+        FUNC_IF(free, expr->vars);
+        expr_cache_release(expr->cached);
+        free(expr);
+        return;
+    }
     FUNC_IF(free, expr->in_hist_size);
+    FUNC_IF(free, expr->coefs);
+    FUNC_IF(expr_prog_free, expr->prog);
     free_stack_vliterals(expr->tokens, expr->n_tokens - 1);
     FUNC_IF(free, expr->tokens);
     if (expr->n_vars && expr->vars) {
@@ -1313,6 +1668,18 @@ static void printtoken(mpr_token_t *t, mpr_var_t *vars, int show_locks)
                 snprintf(s, len, "REDUCE\t%s[%d:%d]", dims[t->con.flags & REDUCE_TYPE_MASK],
                          t->con.reduce_start, t->con.reduce_stop);
             break;
+        case TOK_WINDOW: {
+            const char *ops[] = {"sum", "mean", "max", "min"};
+            snprintf(s, len, "WINDOW\tvar.x$%d[%u].history(%d).%s()", t->win.idx - VAR_X,
+                     t->win.vec_idx, t->win.len, ops[t->win.op]);
+            break;
+        }
+        case TOK_POOL: {
+            const char *ops[] = {"sum", "mean", "max", "min"};
+            snprintf(s, len, "POOL\tvar.x$%d[%u].instance.%s()", t->win.idx - VAR_X,
+                     t->win.vec_idx, ops[t->win.op]);
+            break;
+        }
         case TOK_LOOP_END:
             switch (t->con.flags & REDUCE_TYPE_MASK) {
                 case RT_HISTORY:
@@ -1390,6 +1757,8 @@ static void printstack(const char *s, mpr_token_t *stk, int sp, mpr_var_t *vars,
                     break;
                 case TOK_RFN:
                 case TOK_VAR:
+                case TOK_WINDOW:
+                case TOK_POOL:
                     if (stk[i].var.idx >= VAR_X)
                         can_advance = 0;
                     break;
@@ -1629,9 +1998,9 @@ error:
 static int precompute(mpr_expr_stack eval_stk, mpr_token_t *stk, int len, int vec_len)
 {
     int i;
-    struct _mpr_expr e = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1, -1};
-    mpr_value_t v = {0, 0, 1, 1, 0, 1};
-    mpr_value_buffer_t b = {0, 0, -1};
+    struct _mpr_expr e = {.inst_ctl = -1, .mute_ctl = -1};
+    mpr_value_t v = {.num_inst = 1, .num_active_inst = 1, .mlen = 1};
+    mpr_value_buffer_t b = {.pos = -1};
     void *s;
 
     if (replace_special_constants(stk, len-1))
@@ -1968,7 +2337,8 @@ static int substack_len(mpr_token_t *stk, int sp)
 {
     int idx = sp, arity = 0;
     do {
-        if (stk[idx].toktype < TOK_LOOP_END)
+        if (   stk[idx].toktype < TOK_LOOP_END || TOK_WINDOW == stk[idx].toktype
+            || TOK_POOL == stk[idx].toktype)
             --arity;
         arity += tok_arity(stk[idx]);
         if (TOK_ASSIGN & stk[idx].toktype)
@@ -2094,7 +2464,9 @@ static int _eval_stack_size(mpr_token_t *token_stack, int token_stack_len)
                 if (tok->toktype != TOK_ASSIGN_USE)
                     --sp;
                 break;
-            case TOK_COPY_FROM:         ++sp;                                   break;
+            case TOK_COPY_FROM:
+            case TOK_WINDOW:
+            case TOK_POOL:              ++sp;                                   break;
             case TOK_MOVE:              sp -= tok->con.cache_offset;            break;
             default:
                 return -1;
@@ -2107,6 +2479,446 @@ static int _eval_stack_size(mpr_token_t *token_stack, int token_stack_len)
     return eval_stack_len;
 }
 
+/* Optimization passes over the parsed token stack. These run once parsing and type checking are
+ * complete, and only touch statements that consist of pure arithmetic so that stack offsets used
+ * by reduce loops are never disturbed. */
+
+static int tok_equal(mpr_token_t *a, mpr_token_t *b)
+{
+    int i;
+    if (   a->toktype != b->toktype || a->gen.datatype != b->gen.datatype
+        || a->gen.casttype != b->gen.casttype || a->gen.vec_len != b->gen.vec_len
+        || a->gen.flags != b->gen.flags)
+        return 0;
+    switch (a->toktype) {
+        case TOK_LITERAL:
+            switch (a->gen.datatype) {
+                case MPR_INT32: return a->lit.val.i == b->lit.val.i;
+                case MPR_FLT:   return a->lit.val.f == b->lit.val.f;
+                case MPR_DBL:   return a->lit.val.d == b->lit.val.d;
+                default:        return 0;
+            }
+        case TOK_VLITERAL:
+            for (i = 0; i < a->gen.vec_len; i++) {
+                switch (a->gen.datatype) {
+                    case MPR_INT32: RETURN_ARG_UNLESS(a->lit.val.ip[i] == b->lit.val.ip[i], 0); break;
+                    case MPR_FLT:   RETURN_ARG_UNLESS(a->lit.val.fp[i] == b->lit.val.fp[i], 0); break;
+                    case MPR_DBL:   RETURN_ARG_UNLESS(a->lit.val.dp[i] == b->lit.val.dp[i], 0); break;
+                    default:        return 0;
+                }
+            }
+            return 1;
+        case TOK_VAR:
+        case TOK_TT:
+            return a->var.idx == b->var.idx && a->var.vec_idx == b->var.vec_idx;
+        case TOK_OP:
+            return a->op.idx == b->op.idx;
+        case TOK_FN:
+        case TOK_VFN:
+            return a->fn.idx == b->fn.idx;
+        case TOK_VECTORIZE:
+            return a->fn.arity == b->fn.arity;
+        default:
+            return 0;
+    }
+}
+
+/* Return 1 if a token has no side effects and uses no stack offsets. */
+static int tok_is_pure(mpr_token_t *tok)
+{
+    switch (tok->toktype) {
+        case TOK_LITERAL:
+        case TOK_VLITERAL:
+        case TOK_VAR:
+        case TOK_TT:
+        case TOK_OP:
+        case TOK_VECTORIZE:
+            return 1;
+        case TOK_FN:
+            return tok->fn.idx < FN_DEL_IDX && !fn_tbl[tok->fn.idx].memory;
+        case TOK_VFN:
+            return VFN_MAXMIN != tok->fn.idx && VFN_SUMNUM != tok->fn.idx;
+        default:
+            return 0;
+    }
+}
+
+/* Return the index of the first token of the statement ending at token 'end'. */
+static int stmt_start(mpr_token_t *stk, int end)
+{
+    while (--end >= 0) {
+        if ((stk[end].toktype & TOK_ASSIGN) && (stk[end].gen.flags & CLEAR_STACK))
+            break;
+    }
+    return end + 1;
+}
+
+MPR_INLINE static int tok_cost(mpr_token_t *tok)
+{
+    return TOK_FN == tok->toktype || TOK_VFN == tok->toktype ? 4 : 1;
+}
+
+/* Evaluate a repeated subexpression once into a temporary stack slot beneath the rest of the
+ * statement, replacing each occurrence with a copy from that slot. */
+static int eliminate_common_subexprs(mpr_token_t *stk, int len)
+{
+    mpr_token_t tmp[STACK_SIZE];
+    int start, end, i, j, k, sublen, cost, best, best_root, best_len, best_count, depth;
+
+    for (end = len - 1; end >= 0; end = start - 1) {
+        start = stmt_start(stk, end);
+        if (   !(stk[end].toktype & TOK_ASSIGN) || stk[end].gen.flags & VAR_IDXS
+            || end - start < 2 || substack_len(stk, end - 1) != end - start)
+            continue;
+        for (i = start; i < end; i++) {
+            if (!tok_is_pure(&stk[i]))
+                break;
+        }
+        if (i < end)
+            continue;
+
+        /* find the repeated subexpression that saves the most work */
+        best = best_root = best_len = best_count = 0;
+        for (i = start + 1; i < end - 1; i++) {
+            sublen = substack_len(stk, i);
+            if (sublen < 2)
+                continue;
+            for (j = i - sublen + 1, cost = 0; j <= i; j++)
+                cost += tok_cost(&stk[j]);
+            for (j = i + sublen, k = 1; j < end - 1; j++) {
+                if (substack_len(stk, j) != sublen)
+                    continue;
+                for (depth = 0; depth < sublen; depth++) {
+                    if (!tok_equal(&stk[i - depth], &stk[j - depth]))
+                        break;
+                }
+                if (depth == sublen) {
+                    ++k;
+                    j += sublen - 1;
+                }
+            }
+            /* each occurrence is replaced by a copy, and the temporary is removed at the end,
+             * so only rewrite if that saves work without adding tokens */
+            if (k > 1 && (k - 1) * sublen >= k + 1 && (k - 1) * cost - (k + 1) > best) {
+                best = (k - 1) * cost - (k + 1);
+                best_root = i;
+                best_len = sublen;
+                best_count = k;
+            }
+        }
+        if (!best || len + best_count + 1 - (best_count - 1) * best_len > STACK_SIZE)
+            continue;
+
+#if TRACE_PARSE
+        printf("Replacing %d occurrences of common subexpression ending at token %d.\n",
+               best_count, best_root);
+#endif
+        /* compute the subexpression first */
+        k = 0;
+        for (i = best_root - best_len + 1; i <= best_root; i++)
+            tmp[k++] = stk[i];
+        depth = 0;
+        for (i = start; i < end; i++) {
+            if (i + best_len - 1 < end && substack_len(stk, i + best_len - 1) == best_len) {
+                for (j = 0; j < best_len; j++) {
+                    if (!tok_equal(&stk[best_root - j], &stk[i + best_len - 1 - j]))
+                        break;
+                }
+                if (j == best_len) {
+                    /* replace with a copy from the temporary slot */
+                    if (i != best_root - best_len + 1)
+                        free_stack_vliterals(stk + i, best_len - 1);
+                    memset(&tmp[k], 0, sizeof(mpr_token_t));
+                    tmp[k].toktype = TOK_COPY_FROM;
+                    tmp[k].gen.datatype = (stk[best_root].gen.casttype
+                                           ? stk[best_root].gen.casttype
+                                           : stk[best_root].gen.datatype);
+                    tmp[k].gen.vec_len = stk[best_root].gen.vec_len;
+                    tmp[k].con.cache_offset = depth;
+                    ++k;
+                    ++depth;
+                    i += best_len - 1;
+                    continue;
+                }
+            }
+            depth += 1 - tok_arity(stk[i]);
+            tmp[k++] = stk[i];
+        }
+        /* move the result down over the temporary slot */
+        memset(&tmp[k], 0, sizeof(mpr_token_t));
+        tmp[k].toktype = TOK_MOVE;
+        tmp[k].gen.datatype = (stk[end - 1].gen.casttype ? stk[end - 1].gen.casttype
+                               : stk[end - 1].gen.datatype);
+        tmp[k].gen.vec_len = stk[end - 1].gen.vec_len;
+        tmp[k].con.cache_offset = 1;
+        ++k;
+
+        j = k - (end - start);
+        memmove(stk + end + j, stk + end, (len - end) * sizeof(mpr_token_t));
+        memcpy(stk + start, tmp, k * sizeof(mpr_token_t));
+        len += j;
+    }
+    return len;
+}
+
+/* Replace division by a power-of-two constant with multiplication, and pow(x,1) and pow(x,2)
+ * with x and x*x. Only substitutions that give identical results are made. */
+static int reduce_strength(mpr_token_t *stk, int len)
+{
+    int i, j, n;
+    for (i = 1; i < len; i++) {
+        mpr_token_t *k = &stk[i - 1];
+        if (   TOK_OP == stk[i].toktype && OP_DIVIDE == stk[i].op.idx
+            && (TOK_LITERAL == k->toktype || TOK_VLITERAL == k->toktype)
+            && k->gen.datatype == stk[i].gen.datatype && !k->gen.casttype) {
+            int exact = 1, exp;
+            double r;
+            n = TOK_LITERAL == k->toktype ? 1 : k->gen.vec_len;
+            /* the reciprocal is only exact for powers of two */
+            for (j = 0; j < n && exact; j++) {
+                switch (k->gen.datatype) {
+                    case MPR_FLT:
+                        r = 1 == n ? k->lit.val.f : k->lit.val.fp[j];
+                        exact = 0.5 == fabs(frexp(r, &exp)) && fabs(1.f / (float)r) <= FLT_MAX;
+                        break;
+                    case MPR_DBL:
+                        r = 1 == n ? k->lit.val.d : k->lit.val.dp[j];
+                        exact = 0.5 == fabs(frexp(r, &exp)) && fabs(1. / r) <= DBL_MAX;
+                        break;
+                    default:
+                        exact = 0;
+                }
+            }
+            if (!exact)
+                continue;
+            for (j = 0; j < n; j++) {
+                if (MPR_FLT == k->gen.datatype) {
+                    float *f = 1 == n ? &k->lit.val.f : &k->lit.val.fp[j];
+                    *f = 1.f / *f;
+                }
+                else {
+                    double *d = 1 == n ? &k->lit.val.d : &k->lit.val.dp[j];
+                    *d = 1. / *d;
+                }
+            }
+            stk[i].op.idx = OP_MULTIPLY;
+        }
+        else if (   TOK_FN == stk[i].toktype && FN_POW == stk[i].fn.idx
+                 && TOK_LITERAL == k->toktype && !k->gen.casttype) {
+            mpr_token_t fn = stk[i], tok;
+            double exp;
+            switch (k->gen.datatype) {
+                case MPR_FLT:   exp = k->lit.val.f; break;
+                case MPR_DBL:   exp = k->lit.val.d; break;
+                default:        continue;
+            }
+            /* larger exponents would round differently */
+            if (2 == exp) {
+                /* x COPY * */
+                memset(&tok, 0, sizeof(mpr_token_t));
+                tok.toktype = TOK_COPY_FROM;
+                tok.gen.datatype = fn.gen.datatype;
+                tok.gen.vec_len = fn.gen.vec_len;
+                *k = tok;
+                tok.toktype = TOK_OP;
+                tok.gen.casttype = fn.gen.casttype;
+                tok.op.idx = OP_MULTIPLY;
+                stk[i] = tok;
+            }
+            else if (1 == exp) {
+                /* the base is used directly */
+                memmove(k, stk + i + 1, (len - i - 1) * sizeof(mpr_token_t));
+                len -= 2;
+                i -= 2;
+                if (fn.gen.casttype)
+                    stk[i].gen.casttype = fn.gen.casttype;
+            }
+        }
+    }
+    return len;
+}
+
+/* Return 1 if a literal token holds 'val' for its datatype. */
+static int lit_equals(mpr_token_t *t, int i, float f, double d)
+{
+    RETURN_ARG_UNLESS(TOK_LITERAL == t->toktype && !t->gen.casttype, 0);
+    switch (t->gen.datatype) {
+        case MPR_INT32: return t->lit.val.i == i;
+        case MPR_FLT:   return t->lit.val.f == f;
+        case MPR_DBL:   return t->lit.val.d == d;
+        default:        return 0;
+    }
+}
+
+/* Match a reduction loop at the start of 'stk' that computes the sum, mean, maximum or minimum of
+ * an input signal, or both its maximum and minimum for center() and size(). Returns the number
+ * of tokens to replace, or 0 if the loop does not match, along with the input token and the enum
+ * window_op of the reduction. Both extremes are returned as WIN_MAXMIN and leave two values on
+ * the stack like the loop does. */
+static int match_reduction(mpr_token_t *t, int len, mpr_token_t **x, int *op)
+{
+    mpr_token_t *loop_end, *last;
+    mpr_type type = t[1].gen.datatype;
+    int vlen = t[1].gen.vec_len;
+    RETURN_ARG_UNLESS(len > 4 && !t->gen.casttype, 0);
+    if (TOK_LITERAL == t[2].toktype) {
+        /* mean: LOOP_START 0 0 x sumnum() SP_ADD LOOP_END /
+         * extremes: LOOP_START -max max x maxmin() SP_ADD LOOP_END */
+        if (   len < 7 || t[2].gen.datatype != type || t[2].gen.vec_len != vlen
+            || TOK_VFN != t[4].toktype || t[4].gen.casttype
+            || TOK_SP_ADD != t[5].toktype || 1 != t[5].lit.val.i)
+            return 0;
+        if (VFN_MAXMIN == t[4].fn.idx) {
+            RETURN_ARG_UNLESS(   lit_equals(t + 1, INT_MIN, -FLT_MAX, -DBL_MAX)
+                              && lit_equals(t + 2, INT_MAX, FLT_MAX, DBL_MAX), 0);
+            *op = WIN_MAXMIN;
+            last = t + 6;
+        }
+        else {
+            RETURN_ARG_UNLESS(   len > 7 && VFN_SUMNUM == t[4].fn.idx
+                              && lit_equals(t + 1, 0, 0.f, 0.) && lit_equals(t + 2, 0, 0.f, 0.)
+                              && TOK_OP == t[7].toktype && OP_DIVIDE == t[7].op.idx
+                              && t[7].gen.datatype == type && t[7].gen.vec_len == vlen, 0);
+            *op = WIN_MEAN;
+            last = t + 7;
+        }
+        *x = t + 3;
+        loop_end = t + 6;
+        RETURN_ARG_UNLESS(!loop_end->gen.casttype, 0);
+    }
+    else {
+        /* sum, max, min: LOOP_START init x op LOOP_END */
+        switch (t[3].toktype) {
+            case TOK_OP:
+                *op = OP_ADD == t[3].op.idx ? WIN_SUM : -1;
+                break;
+            case TOK_FN:
+                *op = FN_MAX == t[3].fn.idx ? WIN_MAX : FN_MIN == t[3].fn.idx ? WIN_MIN : -1;
+                break;
+            default:
+                *op = -1;
+        }
+        if (   *op < 0 || t[3].gen.casttype
+            || (WIN_SUM == *op && !lit_equals(t + 1, 0, 0.f, 0.))
+            || (WIN_MAX == *op && !lit_equals(t + 1, INT_MIN, -FLT_MAX, -DBL_MAX))
+            || (WIN_MIN == *op && !lit_equals(t + 1, INT_MAX, FLT_MAX, DBL_MAX)))
+            return 0;
+        *x = t + 2;
+        loop_end = last = t + 4;
+    }
+    /* the loop body must read the input directly and keep the accumulator type */
+    if (   TOK_VAR != (*x)->toktype || (*x)->var.idx < VAR_X || (*x)->gen.flags & VAR_IDXS
+        || (*x)->gen.vec_len != vlen
+        || ((*x)->gen.casttype ? (*x)->gen.casttype : (*x)->gen.datatype) != type
+        || (*x)[1].gen.datatype != type || (*x)[1].gen.vec_len != vlen
+        || TOK_LOOP_END != loop_end->toktype
+        || (t->con.flags & REDUCE_TYPE_MASK) != (loop_end->con.flags & REDUCE_TYPE_MASK)
+        || (   RT_HISTORY == (t->con.flags & REDUCE_TYPE_MASK)
+            && (loop_end->con.reduce_stop || loop_end->con.reduce_start != t->con.reduce_start))
+        || loop_end->con.branch_offset != loop_end - *x)
+        return 0;
+    return last - t + 1;
+}
+
+/* Replace history loops computing the sum, mean, maximum or minimum of an input signal with a
+ * single TOK_WINDOW token that updates running state as new samples arrive. Only loops outside
+ * of other reductions are replaced, since the running state belongs to the instance being
+ * evaluated. The window also needs the sample leaving it, so the input history grows by one. */
+static int lower_windows(mpr_token_t *stk, int len, int *oldest_in, uint8_t *n_states)
+{
+    int i, depth = 0;
+    for (i = 0; i < len; i++) {
+        mpr_token_t *t = stk + i, *x;
+        int n, op, ntok;
+        if (TOK_LOOP_END == t->toktype)
+            --depth;
+        if (TOK_LOOP_START != t->toktype)
+            continue;
+        if (   depth++ || UINT8_MAX == *n_states
+            || RT_HISTORY != (t->con.flags & REDUCE_TYPE_MASK))
+            continue;
+        ntok = match_reduction(t, len - i, &x, &op);
+        if (!ntok || WIN_MAXMIN == op)
+            continue;
+        n = t->con.reduce_start + 1;
+
+        t->gen.casttype = t[ntok - 1].gen.casttype;
+        t->toktype = TOK_WINDOW;
+        t->gen.datatype = t[1].gen.datatype;
+        t->gen.vec_len = t[1].gen.vec_len;
+        t->gen.flags = 0;
+        t->win.idx = x->var.idx;
+        t->win.vec_idx = x->var.vec_idx;
+        t->win.len = n;
+        t->win.op = op;
+        t->win.state = (*n_states)++;
+        if (-n < oldest_in[x->var.idx - VAR_X])
+            oldest_in[x->var.idx - VAR_X] = -n;
+
+        memmove(t + 1, t + ntok, (len - i - ntok) * sizeof(mpr_token_t));
+        len -= ntok - 1;
+        --depth;
+    }
+    return len;
+}
+
+/* Replace instance loops computing the sum, mean, maximum, minimum, center or size of an input
+ * signal with TOK_POOL tokens that read running aggregates kept by the input value. Only
+ * expressions with a single input and without input history are lowered, since the loops then
+ * visit exactly the instances of that input holding a current value. */
+static int lower_pools(mpr_token_t *stk, int len, int n_ins, int *oldest_in)
+{
+    int i, depth = 0;
+    RETURN_ARG_UNLESS(1 == n_ins && !oldest_in[0], len);
+    for (i = 0; i < len; i++) {
+        mpr_token_t *t = stk + i, *x;
+        int op, ntok, n_pools = 1;
+        if (TOK_LOOP_END == t->toktype)
+            --depth;
+        if (TOK_LOOP_START != t->toktype)
+            continue;
+        if (depth++ || RT_INSTANCE != (t->con.flags & REDUCE_TYPE_MASK))
+            continue;
+        if (!(ntok = match_reduction(t, len - i, &x, &op)))
+            continue;
+        /* the aggregates are kept in the input type, so casts to integer must stay in the loop */
+        if (MPR_INT32 == t[1].gen.datatype && MPR_INT32 != x->gen.datatype)
+            continue;
+
+        if (WIN_MAXMIN == op) {
+            /* keep both values on the stack: maximum followed by minimum */
+            n_pools = 2;
+            op = WIN_MAX;
+        }
+        else
+            t->gen.casttype = t[ntok - 1].gen.casttype;
+        t[0].toktype = TOK_POOL;
+        t[0].gen.datatype = t[1].gen.datatype;
+        t[0].gen.vec_len = t[1].gen.vec_len;
+        t[0].gen.flags = 0;
+        t[0].win.idx = x->var.idx;
+        t[0].win.vec_idx = x->var.vec_idx;
+        t[0].win.op = op;
+        if (2 == n_pools) {
+            t[1] = t[0];
+            t[1].win.op = WIN_MIN;
+        }
+
+        memmove(t + n_pools, t + ntok, (len - i - ntok) * sizeof(mpr_token_t));
+        len -= ntok - n_pools;
+        i += n_pools - 1;
+        --depth;
+    }
+    return len;
+}
+
+/* Run the optimization passes, returning the new length of the token stack. */
+static int optimize_stack(mpr_token_t *stk, int len)
+{
+    len = eliminate_common_subexprs(stk, len);
+    return reduce_strength(stk, len);
+}
+
 /* Macros to help express stack operations in parser. */
 #define FAIL(msg) {     \
     trace("%s\n", msg); \
@@ -2251,53 +3063,874 @@ int _squash_to_vector(mpr_token_t *stk, int idx)
                     default:            ((float*)tmp)[vec_len] = a->lit.val.f;          break;
                 }
                 break;
-            case MPR_DBL:
-                tmp = malloc(b->lit.vec_len * sizeof(double));
-                for (i = 0; i < vec_len; i++) {
-                    switch (b->lit.datatype) {
-                        case MPR_INT32: ((double*)tmp)[i] = (double)b->lit.val.ip[i];   break;
-                        case MPR_FLT:   ((double*)tmp)[i] = (double)b->lit.val.fp[i];   break;
-                        default:        ((double*)tmp)[i] = b->lit.val.dp[i];           break;
-                    }
-                }
-                switch (a->lit.datatype) {
-                    case MPR_INT32:     ((double*)tmp)[vec_len] = (double)a->lit.val.i; break;
-                    case MPR_FLT:       ((double*)tmp)[vec_len] = (double)a->lit.val.f; break;
-                    default:            ((double*)tmp)[vec_len] = a->lit.val.d;         break;
+            case MPR_DBL:
+                tmp = malloc(b->lit.vec_len * sizeof(double));
+                for (i = 0; i < vec_len; i++) {
+                    switch (b->lit.datatype) {
+                        case MPR_INT32: ((double*)tmp)[i] = (double)b->lit.val.ip[i];   break;
+                        case MPR_FLT:   ((double*)tmp)[i] = (double)b->lit.val.fp[i];   break;
+                        default:        ((double*)tmp)[i] = b->lit.val.dp[i];           break;
+                    }
+                }
+                switch (a->lit.datatype) {
+                    case MPR_INT32:     ((double*)tmp)[vec_len] = (double)a->lit.val.i; break;
+                    case MPR_FLT:       ((double*)tmp)[vec_len] = (double)a->lit.val.f; break;
+                    default:            ((double*)tmp)[vec_len] = a->lit.val.d;         break;
+                }
+                break;
+        }
+        if (tmp && tmp != b->lit.val.ip) {
+            free(b->lit.val.ip);
+            b->lit.val.ip = tmp;
+        }
+        b->lit.datatype = type;
+        return 1;
+    }
+    return 0;
+}
+
+MPR_INLINE static int _reduce_type_from_fn_idx(int fn)
+{
+    switch (fn) {
+        case RFN_HISTORY:   return RT_HISTORY;
+        case RFN_INSTANCE:  return RT_INSTANCE;
+        case RFN_SIGNAL:    return RT_SIGNAL;
+        case RFN_VECTOR:    return RT_VECTOR;
+        default:            return RT_UNKNOWN;
+    }
+}
+
+static const char* _get_var_str_and_len(const char* str, int last_char, int *len)
+{
+    int idx = last_char;
+    char c = str[idx];
+    while (idx >= 0 && c && (isalpha(c) || isdigit(c) || '_' == c)) {
+        if (--idx >= 0)
+            c = str[idx];
+    }
+    *len = last_char - idx;
+    return str + idx + 1;
+}
+
+/* Expressions consisting only of arithmetic on signal values, literals and scalar functions are
+ * also compiled into a stream of instructions with pre-resolved operands. Each instruction calls
+ * a handler specialised for its data type and for scalar or vector operands, and common token
+ * sequences are fused into single instructions. Anything else is left to the interpreter. */
+
+typedef struct _mpr_eval_ctx {
+    mpr_expr_val stk;
+    mpr_expr_val k;
+    mpr_value *v_in;
+    mpr_value v_out;
+    mpr_time *time;
+    mpr_type *out_types;
+    int inst_idx;
+    const int *inst;        /* instance indices when evaluating a batch */
+    int n_inst;             /* number of instances in the batch */
+} mpr_eval_ctx_t, *mpr_eval_ctx;
+
+struct _mpr_instr;
+typedef void instr_fn(const struct _mpr_instr*, mpr_eval_ctx);
+
+typedef struct _mpr_instr {
+    instr_fn *fn;
+    instr_fn *batch;        /* handler operating on a batch of instances */
+    void *fp;               /* math function called by fn instructions */
+    uint16_t dst;           /* stack offset of the result */
+    uint16_t a;             /* stack offset of the first operand */
+    uint16_t b;             /* stack offset of the second operand */
+    uint16_t k;             /* offset of the first constant operand */
+    uint16_t k2;            /* offset of the second constant operand */
+    int16_t hist;           /* history index for loads */
+    int8_t sig;             /* input signal index for loads, or -1 for the output */
+    uint8_t vec_idx;        /* vector offset for loads */
+    uint8_t len;            /* vector length */
+} mpr_instr_t, *mpr_instr;
+
+typedef struct _mpr_expr_prog {
+    mpr_instr instrs;
+    mpr_expr_val k;         /* constant pool */
+    uint16_t n_instrs;
+    uint16_t n_k;
+    uint8_t start;          /* index of the first token covered by the program */
+    uint8_t status;         /* evaluation status returned by the program */
+    uint8_t can_batch;      /* all instructions have batch handlers */
+} mpr_expr_prog_t, *mpr_expr_prog;
+
+#define BINOP_INSTRS(NAME, OP, T)                                           \
+static void NAME##_##T(const mpr_instr_t *in, mpr_eval_ctx c)               \
+{                                                                           \
+    mpr_expr_val s = c->stk;                                                \
+    int i;                                                                  \
+    for (i = 0; i < in->len; i++)                                           \
+        s[in->dst + i].T = s[in->a + i].T OP s[in->b + i].T;                \
+}                                                                           \
+static void NAME##_##T##1(const mpr_instr_t *in, mpr_eval_ctx c)            \
+{                                                                           \
+    c->stk[in->dst].T = c->stk[in->a].T OP c->stk[in->b].T;                 \
+}                                                                           \
+static void NAME##k_##T(const mpr_instr_t *in, mpr_eval_ctx c)              \
+{                                                                           \
+    mpr_expr_val s = c->stk;                                                \
+    int i;                                                                  \
+    for (i = 0; i < in->len; i++)                                           \
+        s[in->dst + i].T = s[in->a + i].T OP c->k[in->k + i].T;             \
+}                                                                           \
+static void NAME##k_##T##1(const mpr_instr_t *in, mpr_eval_ctx c)           \
+{                                                                           \
+    c->stk[in->dst].T = c->stk[in->a].T OP c->k[in->k].T;                   \
+}                                                                           \
+static void NAME##rk_##T(const mpr_instr_t *in, mpr_eval_ctx c)             \
+{                                                                           \
+    mpr_expr_val s = c->stk;                                                \
+    int i;                                                                  \
+    for (i = 0; i < in->len; i++)                                           \
+        s[in->dst + i].T = c->k[in->k + i].T OP s[in->a + i].T;             \
+}                                                                           \
+static void NAME##rk_##T##1(const mpr_instr_t *in, mpr_eval_ctx c)          \
+{                                                                           \
+    c->stk[in->dst].T = c->k[in->k].T OP c->stk[in->a].T;                   \
+}
+
+#define TYPED_INSTRS(MTYPE, TYPE, T, FN)                                    \
+BINOP_INSTRS(add, +, T)                                                     \
+BINOP_INSTRS(sub, -, T)                                                     \
+BINOP_INSTRS(mul, *, T)                                                     \
+BINOP_INSTRS(div, /, T)                                                     \
+/* dst = a * k + k2 */                                                      \
+static void muladdk_##T(const mpr_instr_t *in, mpr_eval_ctx c)              \
+{                                                                           \
+    mpr_expr_val s = c->stk, k = c->k;                                      \
+    int i;                                                                  \
+    for (i = 0; i < in->len; i++)                                           \
+        s[in->dst + i].T = s[in->a + i].T * k[in->k + i].T + k[in->k2 + i].T;\
+}                                                                           \
+static void muladdk_##T##1(const mpr_instr_t *in, mpr_eval_ctx c)           \
+{                                                                           \
+    c->stk[in->dst].T = c->stk[in->a].T * c->k[in->k].T + c->k[in->k2].T;   \
+}                                                                           \
+/* dst = a + b * k */                                                       \
+static void addmulk_##T(const mpr_instr_t *in, mpr_eval_ctx c)              \
+{                                                                           \
+    mpr_expr_val s = c->stk;                                                \
+    int i;                                                                  \
+    for (i = 0; i < in->len; i++)                                           \
+        s[in->dst + i].T = s[in->a + i].T + s[in->b + i].T * c->k[in->k + i].T;\
+}                                                                           \
+static void addmulk_##T##1(const mpr_instr_t *in, mpr_eval_ctx c)           \
+{                                                                           \
+    c->stk[in->dst].T = c->stk[in->a].T + c->stk[in->b].T * c->k[in->k].T;  \
+}                                                                           \
+static void fn1_##T(const mpr_instr_t *in, mpr_eval_ctx c)                  \
+{                                                                           \
+    mpr_expr_val s = c->stk;                                                \
+    int i;                                                                  \
+    for (i = 0; i < in->len; i++)                                           \
+        s[in->dst + i].T = ((FN##_arity1*)in->fp)(s[in->a + i].T);          \
+}                                                                           \
+static void fn2_##T(const mpr_instr_t *in, mpr_eval_ctx c)                  \
+{                                                                           \
+    mpr_expr_val s = c->stk;                                                \
+    int i;                                                                  \
+    for (i = 0; i < in->len; i++)                                           \
+        s[in->dst + i].T = ((FN##_arity2*)in->fp)(s[in->a + i].T, s[in->b + i].T);\
+}                                                                           \
+static void load_##T(const mpr_instr_t *in, mpr_eval_ctx c)                 \
+{                                                                           \
+    mpr_value v = in->sig < 0 ? c->v_out : c->v_in[in->sig];                \
+    mpr_value_buffer b = &v->inst[c->inst_idx % v->num_inst];               \
+    int i = mpr_value_hist_pos(v, b->pos, in->hist);                        \
+    TYPE *src;                                                              \
+    src = (TYPE*)b->samps + i * v->vlen + in->vec_idx;                      \
+    for (i = 0; i < in->len; i++)                                           \
+        c->stk[in->dst + i].T = src[i];                                     \
+}                                                                           \
+static void store_##T(const mpr_instr_t *in, mpr_eval_ctx c)                \
+{                                                                           \
+    mpr_value v = c->v_out;                                                 \
+    mpr_value_buffer b = &v->inst[c->inst_idx % v->num_inst];               \
+    TYPE *dst = (TYPE*)b->samps + b->pos * v->vlen;                         \
+    int i;                                                                  \
+    if (c->time)                                                            \
+        memcpy(&b->times[b->pos], c->time, sizeof(mpr_time));               \
+    for (i = 0; i < in->len; i++) {                                         \
+        dst[i] = c->stk[in->a + i].T;                                       \
+        c->out_types[i] = MTYPE;                                            \
+    }                                                                       \
+}
+
+TYPED_INSTRS(MPR_INT32, int, i, fn_int)
+TYPED_INSTRS(MPR_FLT, float, f, fn_flt)
+TYPED_INSTRS(MPR_DBL, double, d, fn_dbl)
+
+#define CAST_INSTR(TYPE0, T0, TYPE1, T1)                                    \
+static void cast_##T0##T1(const mpr_instr_t *in, mpr_eval_ctx c)            \
+{                                                                           \
+    mpr_expr_val s = c->stk;                                                \
+    int i;                                                                  \
+    for (i = in->dst; i < in->dst + in->len; i++)                           \
+        s[i].T1 = (TYPE1)s[i].T0;                                           \
+}
+
+CAST_INSTR(int, i, float, f)
+CAST_INSTR(int, i, double, d)
+CAST_INSTR(float, f, int, i)
+CAST_INSTR(float, f, double, d)
+CAST_INSTR(double, d, int, i)
+CAST_INSTR(double, d, float, f)
+
+static void load_const(const mpr_instr_t *in, mpr_eval_ctx c)
+{
+    memcpy(c->stk + in->dst, c->k + in->k, in->len * sizeof(mpr_expr_val_t));
+}
+
+static void copy_vals(const mpr_instr_t *in, mpr_eval_ctx c)
+{
+    memcpy(c->stk + in->dst, c->stk + in->a, in->len * sizeof(mpr_expr_val_t));
+}
+
+static void vec_kernel(const mpr_instr_t *in, mpr_eval_ctx c)
+{
+    ((vec_binop_fn*)in->fp)(c->stk + in->dst, c->stk + in->a, c->stk + in->b, in->len);
+}
+
+/* Handlers for each data type, indexed by 0 for vectors and 1 for scalars. */
+#define INSTR_TBL(NAME) { { NAME##_i, NAME##_i1 }, { NAME##_f, NAME##_f1 }, { NAME##_d, NAME##_d1 } }
+
+static instr_fn *binop_instrs[4][3][2] = {
+    INSTR_TBL(add), INSTR_TBL(sub), INSTR_TBL(mul), INSTR_TBL(div)
+};
+static instr_fn *binopk_instrs[4][3][2] = {
+    INSTR_TBL(addk), INSTR_TBL(subk), INSTR_TBL(mulk), INSTR_TBL(divk)
+};
+static instr_fn *binoprk_instrs[4][3][2] = {
+    INSTR_TBL(addrk), INSTR_TBL(subrk), INSTR_TBL(mulrk), INSTR_TBL(divrk)
+};
+static instr_fn *muladdk_instrs[3][2] = INSTR_TBL(muladdk);
+static instr_fn *addmulk_instrs[3][2] = INSTR_TBL(addmulk);
+static instr_fn *fn1_instrs[3] = { fn1_i, fn1_f, fn1_d };
+static instr_fn *fn2_instrs[3] = { fn2_i, fn2_f, fn2_d };
+static instr_fn *load_instrs[3] = { load_i, load_f, load_d };
+static instr_fn *store_instrs[3] = { store_i, store_f, store_d };
+static instr_fn *cast_instrs[3][3] = {
+    { 0, cast_if, cast_id }, { cast_fi, 0, cast_fd }, { cast_di, cast_df, 0 }
+};
+
+/* Batch handlers evaluate one instruction for several instances at once. The stack is laid out
+ * as a structure of arrays: element e of the operand at offset o for the j-th instance of the
+ * batch is found at stk[(o + e) * n_inst + j], so that element-wise instructions operate on
+ * contiguous memory. */
+
+/* Floating point operands use the vector kernels instead. */
+#define BATCH_INT_BINOP_INSTR(NAME, OP)                                     \
+static void b_##NAME##_i(const mpr_instr_t *in, mpr_eval_ctx c)            \
+{                                                                           \
+    int i, n = c->n_inst, len = in->len * n;                                \
+    mpr_expr_val d = c->stk + in->dst * n, a = c->stk + in->a * n;          \
+    mpr_expr_val b = c->stk + in->b * n;                                    \
+    for (i = 0; i < len; i++)                                               \
+        d[i].i = a[i].i OP b[i].i;                                          \
+}
+
+BATCH_INT_BINOP_INSTR(add, +)
+BATCH_INT_BINOP_INSTR(sub, -)
+BATCH_INT_BINOP_INSTR(mul, *)
+BATCH_INT_BINOP_INSTR(div, /)
+
+#define BATCH_BINOP_INSTRS(NAME, OP, TYPE, T)                               \
+static void b_##NAME##k_##T(const mpr_instr_t *in, mpr_eval_ctx c)          \
+{                                                                           \
+    int i, j, n = c->n_inst;                                                \
+    for (i = 0; i < in->len; i++) {                                         \
+        mpr_expr_val d = c->stk + (in->dst + i) * n, a = c->stk + (in->a + i) * n;\
+        TYPE k = c->k[in->k + i].T;                                         \
+        for (j = 0; j < n; j++)                                             \
+            d[j].T = a[j].T OP k;                                           \
+    }                                                                       \
+}                                                                           \
+static void b_##NAME##rk_##T(const mpr_instr_t *in, mpr_eval_ctx c)         \
+{                                                                           \
+    int i, j, n = c->n_inst;                                                \
+    for (i = 0; i < in->len; i++) {                                         \
+        mpr_expr_val d = c->stk + (in->dst + i) * n, a = c->stk + (in->a + i) * n;\
+        TYPE k = c->k[in->k + i].T;                                         \
+        for (j = 0; j < n; j++)                                             \
+            d[j].T = k OP a[j].T;                                           \
+    }                                                                       \
+}
+
+#define BATCH_TYPED_INSTRS(MTYPE, TYPE, T, FN)                              \
+BATCH_BINOP_INSTRS(add, +, TYPE, T)                                         \
+BATCH_BINOP_INSTRS(sub, -, TYPE, T)                                         \
+BATCH_BINOP_INSTRS(mul, *, TYPE, T)                                         \
+BATCH_BINOP_INSTRS(div, /, TYPE, T)                                         \
+static void b_muladdk_##T(const mpr_instr_t *in, mpr_eval_ctx c)            \
+{                                                                           \
+    int i, j, n = c->n_inst;                                                \
+    for (i = 0; i < in->len; i++) {                                         \
+        mpr_expr_val d = c->stk + (in->dst + i) * n, a = c->stk + (in->a + i) * n;\
+        TYPE k = c->k[in->k + i].T, k2 = c->k[in->k2 + i].T;                \
+        for (j = 0; j < n; j++)                                             \
+            d[j].T = a[j].T * k + k2;                                       \
+    }                                                                       \
+}                                                                           \
+static void b_addmulk_##T(const mpr_instr_t *in, mpr_eval_ctx c)            \
+{                                                                           \
+    int i, j, n = c->n_inst;                                                \
+    for (i = 0; i < in->len; i++) {                                         \
+        mpr_expr_val d = c->stk + (in->dst + i) * n, a = c->stk + (in->a + i) * n;\
+        mpr_expr_val b = c->stk + (in->b + i) * n;                          \
+        TYPE k = c->k[in->k + i].T;                                         \
+        for (j = 0; j < n; j++)                                             \
+            d[j].T = a[j].T + b[j].T * k;                                   \
+    }                                                                       \
+}                                                                           \
+static void b_fn1_##T(const mpr_instr_t *in, mpr_eval_ctx c)                \
+{                                                                           \
+    int i, n = c->n_inst, len = in->len * n;                                \
+    mpr_expr_val d = c->stk + in->dst * n, a = c->stk + in->a * n;          \
+    for (i = 0; i < len; i++)                                               \
+        d[i].T = ((FN##_arity1*)in->fp)(a[i].T);                            \
+}                                                                           \
+static void b_fn2_##T(const mpr_instr_t *in, mpr_eval_ctx c)                \
+{                                                                           \
+    int i, n = c->n_inst, len = in->len * n;                                \
+    mpr_expr_val d = c->stk + in->dst * n, a = c->stk + in->a * n;          \
+    mpr_expr_val b = c->stk + in->b * n;                                    \
+    for (i = 0; i < len; i++)                                               \
+        d[i].T = ((FN##_arity2*)in->fp)(a[i].T, b[i].T);                    \
+}                                                                           \
+static void b_load_##T(const mpr_instr_t *in, mpr_eval_ctx c)               \
+{                                                                           \
+    mpr_value v = in->sig < 0 ? c->v_out : c->v_in[in->sig];                \
+    mpr_expr_val d = c->stk + in->dst * c->n_inst;                          \
+    int i, j;                                                               \
+    for (j = 0; j < c->n_inst; j++) {                                       \
+        mpr_value_buffer b = &v->inst[c->inst[j] % v->num_inst];            \
+        TYPE *src;                                                          \
+        i = mpr_value_hist_pos(v, b->pos, in->hist);                        \
+        src = (TYPE*)b->samps + i * v->vlen + in->vec_idx;                  \
+        for (i = 0; i < in->len; i++)                                       \
+            d[i * c->n_inst + j].T = src[i];                                \
+    }                                                                       \
+}                                                                           \
+static void b_store_##T(const mpr_instr_t *in, mpr_eval_ctx c)              \
+{                                                                           \
+    mpr_value v = c->v_out;                                                 \
+    mpr_expr_val a = c->stk + in->a * c->n_inst;                            \
+    int i, j;                                                               \
+    for (j = 0; j < c->n_inst; j++) {                                       \
+        mpr_value_buffer b = &v->inst[c->inst[j] % v->num_inst];            \
+        TYPE *dst = (TYPE*)b->samps + b->pos * v->vlen;                     \
+        mpr_type *types = c->out_types + c->inst[j] * v->vlen;              \
+        if (c->time)                                                        \
+            memcpy(&b->times[b->pos], c->time, sizeof(mpr_time));           \
+        for (i = 0; i < in->len; i++) {                                     \
+            dst[i] = a[i * c->n_inst + j].T;                                \
+            types[i] = MTYPE;                                               \
+        }                                                                   \
+    }                                                                       \
+}
+
+BATCH_TYPED_INSTRS(MPR_INT32, int, i, fn_int)
+BATCH_TYPED_INSTRS(MPR_FLT, float, f, fn_flt)
+BATCH_TYPED_INSTRS(MPR_DBL, double, d, fn_dbl)
+
+#define BATCH_CAST_INSTR(TYPE0, T0, TYPE1, T1)                              \
+static void b_cast_##T0##T1(const mpr_instr_t *in, mpr_eval_ctx c)          \
+{                                                                           \
+    mpr_expr_val s = c->stk;                                                \
+    int i;                                                                  \
+    for (i = in->dst * c->n_inst; i < (in->dst + in->len) * c->n_inst; i++) \
+        s[i].T1 = (TYPE1)s[i].T0;                                           \
+}
+
+BATCH_CAST_INSTR(int, i, float, f)
+BATCH_CAST_INSTR(int, i, double, d)
+BATCH_CAST_INSTR(float, f, int, i)
+BATCH_CAST_INSTR(float, f, double, d)
+BATCH_CAST_INSTR(double, d, int, i)
+BATCH_CAST_INSTR(double, d, float, f)
+
+static void b_load_const(const mpr_instr_t *in, mpr_eval_ctx c)
+{
+    int i, j, n = c->n_inst;
+    for (i = 0; i < in->len; i++) {
+        mpr_expr_val d = c->stk + (in->dst + i) * n;
+        for (j = 0; j < n; j++)
+            d[j] = c->k[in->k + i];
+    }
+}
+
+static void b_copy_vals(const mpr_instr_t *in, mpr_eval_ctx c)
+{
+    int n = c->n_inst;
+    memcpy(c->stk + in->dst * n, c->stk + in->a * n, in->len * n * sizeof(mpr_expr_val_t));
+}
+
+/* Element-wise instructions on floating point operands also use the vector kernels in a batch,
+ * since the operands of all instances are contiguous. */
+static void b_vec_kernel(const mpr_instr_t *in, mpr_eval_ctx c)
+{
+    int n = c->n_inst;
+    ((vec_binop_fn*)in->fp)(c->stk + in->dst * n, c->stk + in->a * n, c->stk + in->b * n,
+                            in->len * n);
+}
+
+typedef struct _batch_instr {
+    instr_fn *fn;
+    instr_fn *batch;
+    vec_binop_fn **kernel;
+} batch_instr_t;
+
+#define BATCH_BINOP_TBL(NAME, KERNEL)                                       \
+    { NAME##_i, b_##NAME##_i, 0 }, { NAME##_i1, b_##NAME##_i, 0 },          \
+    { NAME##_f, b_vec_kernel, &kernels.binopf[KERNEL] },                    \
+    { NAME##_f1, b_vec_kernel, &kernels.binopf[KERNEL] },                   \
+    { NAME##_d, b_vec_kernel, &kernels.binopd[KERNEL] },                    \
+    { NAME##_d1, b_vec_kernel, &kernels.binopd[KERNEL] },
+#define BATCH_TBL(NAME)                                                     \
+    { NAME##_i, b_##NAME##_i, 0 }, { NAME##_i1, b_##NAME##_i, 0 },          \
+    { NAME##_f, b_##NAME##_f, 0 }, { NAME##_f1, b_##NAME##_f, 0 },          \
+    { NAME##_d, b_##NAME##_d, 0 }, { NAME##_d1, b_##NAME##_d, 0 },
+#define BATCH_TYPED_TBL(NAME)                                               \
+    { NAME##_i, b_##NAME##_i, 0 }, { NAME##_f, b_##NAME##_f, 0 },           \
+    { NAME##_d, b_##NAME##_d, 0 },
+
+static const batch_instr_t batch_instrs[] = {
+    BATCH_BINOP_TBL(add, KERNEL_ADD)
+    BATCH_BINOP_TBL(sub, KERNEL_SUB)
+    BATCH_BINOP_TBL(mul, KERNEL_MUL)
+    BATCH_BINOP_TBL(div, KERNEL_DIV)
+    BATCH_TBL(addk) BATCH_TBL(subk) BATCH_TBL(mulk) BATCH_TBL(divk)
+    BATCH_TBL(addrk) BATCH_TBL(subrk) BATCH_TBL(mulrk) BATCH_TBL(divrk)
+    BATCH_TBL(muladdk) BATCH_TBL(addmulk)
+    BATCH_TYPED_TBL(fn1) BATCH_TYPED_TBL(fn2)
+    BATCH_TYPED_TBL(load) BATCH_TYPED_TBL(store)
+    { cast_if, b_cast_if, 0 }, { cast_id, b_cast_id, 0 }, { cast_fi, b_cast_fi, 0 },
+    { cast_fd, b_cast_fd, 0 }, { cast_di, b_cast_di, 0 }, { cast_df, b_cast_df, 0 },
+    { load_const, b_load_const, 0 },
+    { copy_vals, b_copy_vals, 0 },
+    { vec_kernel, b_vec_kernel, 0 }
+};
+
+#undef BATCH_BINOP_TBL
+#undef BATCH_TBL
+#undef BATCH_TYPED_TBL
+
+MPR_INLINE static int type_idx(mpr_type type)
+{
+    switch (type) {
+        case MPR_INT32: return 0;
+        case MPR_FLT:   return 1;
+        case MPR_DBL:   return 2;
+        default:        return -1;
+    }
+}
+
+MPR_INLINE static int binop_idx(expr_op_t op)
+{
+    switch (op) {
+        case OP_ADD:        return 0;
+        case OP_SUBTRACT:   return 1;
+        case OP_MULTIPLY:   return 2;
+        case OP_DIVIDE:     return 3;
+        default:            return -1;
+    }
+}
+
+static void expr_prog_free(mpr_expr_prog prog)
+{
+    FUNC_IF(free, prog->instrs);
+    FUNC_IF(free, prog->k);
+    free(prog);
+}
+
+static mpr_instr prog_add_instr(mpr_expr_prog prog, instr_fn *fn, int dst, int len)
+{
+    mpr_instr in;
+    prog->instrs = realloc(prog->instrs, (prog->n_instrs + 1) * sizeof(mpr_instr_t));
+    in = &prog->instrs[prog->n_instrs++];
+    memset(in, 0, sizeof(mpr_instr_t));
+    in->fn = fn;
+    in->dst = in->a = dst;
+    in->len = len;
+    return in;
+}
+
+static int prog_add_consts(mpr_expr_prog prog, int len)
+{
+    int k = prog->n_k;
+    prog->n_k += len;
+    prog->k = realloc(prog->k, prog->n_k * sizeof(mpr_expr_val_t));
+    return k;
+}
+
+MPR_INLINE static mpr_instr prog_last_instr(mpr_expr_prog prog)
+{
+    return prog->n_instrs ? &prog->instrs[prog->n_instrs - 1] : 0;
+}
+
+/* Operand on the compile-time stack; constants stay in the pool until they are needed. */
+typedef struct _prog_operand {
+    mpr_type type;
+    uint8_t len;
+    uint8_t is_const;
+    uint16_t k;
+} prog_operand_t;
+
+static void prog_load_const(mpr_expr_prog prog, prog_operand_t *o, int sp)
+{
+    if (o->is_const) {
+        prog_add_instr(prog, load_const, sp, o->len)->k = o->k;
+        o->is_const = 0;
+    }
+}
+
+static void prog_cast(mpr_expr_prog prog, prog_operand_t *o, mpr_type type, int sp)
+{
+    int i;
+    if (!type || type == o->type)
+        return;
+    if (o->is_const) {
+        mpr_expr_val k = prog->k + o->k;
+        for (i = 0; i < o->len; i++) {
+            switch (o->type) {
+#define TYPED_CASE(MTYPE, T)                                                        \
+                case MTYPE:                                                         \
+                    switch (type) {                                                 \
+                        case MPR_INT32: k[i].i = (int)k[i].T;      break;           \
+                        case MPR_FLT:   k[i].f = (float)k[i].T;    break;           \
+                        default:        k[i].d = (double)k[i].T;   break;           \
+                    }                                                               \
+                    break;
+                TYPED_CASE(MPR_INT32, i)
+                TYPED_CASE(MPR_FLT, f)
+                TYPED_CASE(MPR_DBL, d)
+#undef TYPED_CASE
+            }
+        }
+    }
+    else
+        prog_add_instr(prog, cast_instrs[type_idx(o->type)][type_idx(type)], sp, o->len);
+    o->type = type;
+}
+
+/* Look up the batch handler for each instruction of a compiled program. */
+static void prog_set_batch(mpr_expr_prog prog)
+{
+    int i, j, n = sizeof(batch_instrs) / sizeof(batch_instr_t);
+    prog->can_batch = 1;
+    for (i = 0; i < prog->n_instrs; i++) {
+        mpr_instr in = &prog->instrs[i];
+        for (j = 0; j < n; j++) {
+            if (batch_instrs[j].fn == in->fn)
+                break;
+        }
+        if (j == n) {
+            prog->can_batch = 0;
+            return;
+        }
+        in->batch = batch_instrs[j].batch;
+        if (batch_instrs[j].kernel)
+            in->fp = *batch_instrs[j].kernel;
+    }
+}
+
+#define BAIL_IF(condition) { if (condition) goto fail; }
+
+/* Compile the final statement of an expression, returning 0 if it cannot be compiled. */
+static mpr_expr_prog expr_compile(mpr_expr expr, const mpr_type *in_types, const int *in_vec_lens,
+                                  mpr_type out_type, int out_vec_len)
+{
+    prog_operand_t stk[STACK_SIZE];
+    mpr_token tok = expr->tokens, end = expr->tokens + expr->n_tokens - 1;
+    mpr_expr_prog prog;
+    mpr_instr in;
+    int i, dp = -1, vlen = expr->vec_len, t, status = 1 | EXPR_EVAL_DONE | EXPR_UPDATE;
+
+    RETURN_ARG_UNLESS(expr->n_tokens && expr->inst_ctl < 0 && expr->mute_ctl < 0, 0);
+
+    /* only the statement assigning to the output is compiled */
+    RETURN_ARG_UNLESS(TOK_ASSIGN == end->toktype && VAR_Y == end->var.idx, 0);
+    RETURN_ARG_UNLESS(!(end->gen.flags & VAR_IDXS) && !end->var.vec_idx && !end->var.offset, 0);
+    RETURN_ARG_UNLESS(end->gen.flags & CLEAR_STACK && end->gen.vec_len <= out_vec_len, 0);
+    for (i = expr->n_tokens - 2; i >= 0; i--) {
+        if (expr->tokens[i].toktype >= TOK_ASSIGN && expr->tokens[i].toktype < TOK_TT)
+            break;
+    }
+    tok += i + 1;
+
+    prog = calloc(1, sizeof(mpr_expr_prog_t));
+    prog->start = i + 1;
+
+    for (; tok < end; tok++) {
+        prog_operand_t *o;
+        switch (tok->toktype) {
+            case TOK_LITERAL:
+            case TOK_VLITERAL:
+                BAIL_IF(++dp >= STACK_SIZE);
+                o = &stk[dp];
+                o->type = tok->gen.datatype;
+                o->len = tok->gen.vec_len;
+                o->is_const = 1;
+                o->k = prog_add_consts(prog, o->len);
+                for (i = 0; i < o->len; i++) {
+                    mpr_expr_val k = prog->k + o->k + i;
+                    switch (o->type) {
+#define TYPED_CASE(MTYPE, T)                                                            \
+                        case MTYPE:                                                     \
+                            k->T = TOK_LITERAL == tok->toktype ? tok->lit.val.T         \
+                                                               : tok->lit.val.T##p[i];  \
+                            break;
+                        TYPED_CASE(MPR_INT32, i)
+                        TYPED_CASE(MPR_FLT, f)
+                        TYPED_CASE(MPR_DBL, d)
+#undef TYPED_CASE
+                        default:
+                            goto fail;
+                    }
+                }
+                break;
+            case TOK_VAR: {
+                int sig, hist = 0, len;
+                mpr_type type;
+                BAIL_IF(tok->gen.flags & (VAR_IDXS & ~VAR_HIST_IDX));
+                if (VAR_Y == tok->var.idx) {
+                    sig = -1;
+                    type = out_type;
+                    len = out_vec_len;
+                }
+                else if (tok->var.idx >= VAR_X && tok->var.idx - VAR_X < expr->n_ins) {
+                    sig = tok->var.idx - VAR_X;
+                    type = in_types[sig];
+                    len = in_vec_lens[sig];
+                    status &= ~EXPR_EVAL_DONE;
+                }
+                else
+                    goto fail;
+                BAIL_IF(tok->var.vec_idx + tok->gen.vec_len > len || type_idx(type) < 0);
+                if (tok->gen.flags & VAR_HIST_IDX) {
+                    /* fold a constant history index into the load */
+                    mpr_expr_val k;
+                    BAIL_IF(dp < 0 || !stk[dp].is_const);
+                    k = prog->k + stk[dp].k;
+                    switch (stk[dp].type) {
+                        case MPR_INT32: hist = k->i;                                break;
+                        case MPR_FLT:   hist = (int)k->f; BAIL_IF(hist != k->f);   break;
+                        case MPR_DBL:   hist = (int)k->d; BAIL_IF(hist != k->d);   break;
+                        default:        goto fail;
+                    }
+                    --dp;
+                }
+                BAIL_IF(++dp >= STACK_SIZE);
+                o = &stk[dp];
+                o->type = type;
+                o->len = tok->gen.vec_len;
+                o->is_const = 0;
+                in = prog_add_instr(prog, load_instrs[type_idx(type)], dp * vlen, o->len);
+                in->sig = sig;
+                in->hist = hist;
+                in->vec_idx = tok->var.vec_idx;
+                break;
+            }
+            case TOK_OP: {
+                prog_operand_t *l, *r;
+                int op = binop_idx(tok->op.idx);
+                t = type_idx(tok->gen.datatype);
+                BAIL_IF(op < 0 || t < 0 || dp < 1);
+                /* integer division needs to check for zero */
+                BAIL_IF(OP_DIVIDE == tok->op.idx && MPR_INT32 == tok->gen.datatype);
+                l = &stk[dp - 1];
+                r = &stk[dp];
+                BAIL_IF(l->len != tok->gen.vec_len || r->len != l->len);
+                BAIL_IF(l->type != tok->gen.datatype || r->type != l->type);
+                i = (1 == l->len);
+                in = prog_last_instr(prog);
+                if (l->is_const && !r->is_const && (OP_ADD == tok->op.idx
+                                                    || OP_MULTIPLY == tok->op.idx)) {
+                    /* commutative: apply the constant to the right operand */
+                    in = prog_add_instr(prog, binopk_instrs[op][t][i], (dp - 1) * vlen, l->len);
+                    in->a = dp * vlen;
+                    in->k = l->k;
+                }
+                else if (l->is_const && !r->is_const) {
+                    in = prog_add_instr(prog, binoprk_instrs[op][t][i], (dp - 1) * vlen, l->len);
+                    in->a = dp * vlen;
+                    in->k = l->k;
+                }
+                else if (r->is_const) {
+                    prog_load_const(prog, l, (dp - 1) * vlen);
+                    in = prog_last_instr(prog);
+                    if (in && (OP_ADD == tok->op.idx || OP_SUBTRACT == tok->op.idx)
+                        && in->fn == binopk_instrs[2][t][i] && in->dst == (dp - 1) * vlen) {
+                        /* fuse linear scaling: a * k + k2 */
+                        in->fn = muladdk_instrs[t][i];
+                        in->k2 = r->k;
+                        if (OP_SUBTRACT == tok->op.idx) {
+                            /* negate the constant in place */
+                            mpr_expr_val k = prog->k + r->k;
+                            for (i = 0; i < r->len; i++) {
+                                switch (r->type) {
+                                    case MPR_INT32: k[i].i = -k[i].i;   break;
+                                    case MPR_FLT:   k[i].f = -k[i].f;   break;
+                                    default:        k[i].d = -k[i].d;   break;
+                                }
+                            }
+                        }
+                    }
+                    else {
+                        in = prog_add_instr(prog, binopk_instrs[op][t][i], (dp - 1) * vlen, l->len);
+                        in->k = r->k;
+                    }
+                }
+                else if (in && OP_ADD == tok->op.idx && in->fn == binopk_instrs[2][t][i]
+                         && in->dst == dp * vlen) {
+                    /* fuse accumulation of a scaled value: a + b * k */
+                    in->fn = addmulk_instrs[t][i];
+                    in->b = in->a;
+                    in->dst = in->a = (dp - 1) * vlen;
+                }
+                else if (l->len >= MIN_KERNEL_LEN && MPR_INT32 != l->type) {
+                    in = prog_add_instr(prog, vec_kernel, (dp - 1) * vlen, l->len);
+                    in->b = dp * vlen;
+                    in->fp = MPR_FLT == l->type ? kernels.binopf[op] : kernels.binopd[op];
+                }
+                else {
+                    in = prog_add_instr(prog, binop_instrs[op][t][i], (dp - 1) * vlen, l->len);
+                    in->b = dp * vlen;
+                }
+                --dp;
+                l->is_const = 0;
+                break;
+            }
+            case TOK_FN: {
+                int arity = fn_tbl[tok->fn.idx].arity;
+                void *fp;
+                t = type_idx(tok->gen.datatype);
+                BAIL_IF(tok->fn.idx >= FN_DEL_IDX || t < 0 || arity < 1 || arity > 2);
+                BAIL_IF(dp < arity - 1);
+                switch (tok->gen.datatype) {
+                    case MPR_INT32: fp = fn_tbl[tok->fn.idx].fn_int;    break;
+                    case MPR_FLT:   fp = fn_tbl[tok->fn.idx].fn_flt;    break;
+                    default:        fp = fn_tbl[tok->fn.idx].fn_dbl;    break;
+                }
+                BAIL_IF(!fp);
+                dp -= arity - 1;
+                for (i = 0; i < arity; i++) {
+                    o = &stk[dp + i];
+                    BAIL_IF(o->len != tok->gen.vec_len || o->type != tok->gen.datatype);
+                    prog_load_const(prog, o, (dp + i) * vlen);
+                }
+                in = prog_add_instr(prog, 1 == arity ? fn1_instrs[t] : fn2_instrs[t], dp * vlen,
+                                    tok->gen.vec_len);
+                in->b = (dp + 1) * vlen;
+                in->fp = fp;
+                break;
+            }
+            case TOK_COPY_FROM:
+                i = dp - tok->con.cache_offset;
+                BAIL_IF(i < 0 || dp + 1 >= STACK_SIZE);
+                BAIL_IF(tok->gen.vec_len != stk[i].len || tok->gen.datatype != stk[i].type);
+                stk[++dp] = stk[i];
+                if (stk[dp].is_const) {
+                    /* constants may be modified in place, so they are not shared */
+                    stk[dp].k = prog_add_consts(prog, stk[dp].len);
+                    memcpy(prog->k + stk[dp].k, prog->k + stk[i].k,
+                           stk[dp].len * sizeof(mpr_expr_val_t));
+                }
+                else {
+                    in = prog_add_instr(prog, copy_vals, dp * vlen, stk[dp].len);
+                    in->a = i * vlen;
+                }
+                break;
+            case TOK_MOVE:
+                i = dp - tok->con.cache_offset;
+                BAIL_IF(i < 0);
+                if (i == dp)
+                    break;
+                stk[i] = stk[dp];
+                if (!stk[i].is_const) {
+                    in = prog_add_instr(prog, copy_vals, i * vlen, stk[i].len);
+                    in->a = dp * vlen;
                 }
+                dp = i;
                 break;
+            default:
+                goto fail;
         }
-        if (tmp && tmp != b->lit.val.ip) {
-            free(b->lit.val.ip);
-            b->lit.val.ip = tmp;
+        if (tok->gen.casttype) {
+            BAIL_IF(type_idx(tok->gen.casttype) < 0);
+            prog_cast(prog, &stk[dp], tok->gen.casttype, dp * vlen);
         }
-        b->lit.datatype = type;
-        return 1;
     }
+
+    /* assignment to the output */
+    BAIL_IF(dp || stk[0].type != out_type || stk[0].len != end->gen.vec_len);
+    prog_load_const(prog, &stk[0], 0);
+    prog_add_instr(prog, store_instrs[type_idx(out_type)], 0, stk[0].len);
+    prog->status = status;
+    prog_set_batch(prog);
+    return prog;
+
+  fail:
+    expr_prog_free(prog);
     return 0;
 }
 
-MPR_INLINE static int _reduce_type_from_fn_idx(int fn)
+#undef BAIL_IF
+
+/* Run a compiled expression, equivalent to evaluating its final statement in mpr_expr_eval(). */
+static int expr_run_prog(mpr_expr_prog prog, mpr_expr_stack expr_stk, mpr_value *v_in,
+                         mpr_value v_out, mpr_time *time, mpr_type *out_types, int inst_idx)
 {
-    switch (fn) {
-        case RFN_HISTORY:   return RT_HISTORY;
-        case RFN_INSTANCE:  return RT_INSTANCE;
-        case RFN_SIGNAL:    return RT_SIGNAL;
-        case RFN_VECTOR:    return RT_VECTOR;
-        default:            return RT_UNKNOWN;
-    }
+    mpr_eval_ctx_t ctx;
+    mpr_instr in = prog->instrs, end = prog->instrs + prog->n_instrs;
+    mpr_value_buffer b_out = &v_out->inst[inst_idx % v_out->num_inst];
+
+    ctx.stk = expr_stk->stk;
+    ctx.k = prog->k;
+    ctx.v_in = v_in;
+    ctx.v_out = v_out;
+    ctx.time = time;
+    ctx.out_types = out_types;
+    ctx.inst_idx = inst_idx;
+
+    memset(out_types, MPR_NULL, v_out->vlen);
+    b_out->pos = (b_out->pos + 1) & (v_out->mlen - 1);
+
+    for (; in < end; in++)
+        in->fn(in, &ctx);
+    return prog->status;
 }
 
-static const char* _get_var_str_and_len(const char* str, int last_char, int *len)
+/* Run a compiled expression for a batch of instances. */
+static void expr_run_batch(mpr_expr_prog prog, mpr_expr_stack expr_stk, mpr_value *v_in,
+                           mpr_value v_out, mpr_time *time, mpr_type *out_types, int *status,
+                           const int *inst, int n_inst)
 {
-    int idx = last_char;
-    char c = str[idx];
-    while (idx >= 0 && c && (isalpha(c) || isdigit(c) || '_' == c)) {
-        if (--idx >= 0)
-            c = str[idx];
+    mpr_eval_ctx_t ctx;
+    mpr_instr in = prog->instrs, end = prog->instrs + prog->n_instrs;
+    int i;
+
+    ctx.stk = expr_stk->stk;
+    ctx.k = prog->k;
+    ctx.v_in = v_in;
+    ctx.v_out = v_out;
+    ctx.time = time;
+    ctx.out_types = out_types;
+    ctx.inst = inst;
+    ctx.n_inst = n_inst;
+
+    for (i = 0; i < n_inst; i++) {
+        mpr_value_buffer b_out = &v_out->inst[inst[i] % v_out->num_inst];
+        memset(out_types + inst[i] * v_out->vlen, MPR_NULL, v_out->vlen);
+        b_out->pos = (b_out->pos + 1) & (v_out->mlen - 1);
+        status[inst[i]] = prog->status;
     }
-    *len = last_char - idx;
-    return str + idx + 1;
+
+    for (; in < end; in++)
+        in->batch(in, &ctx);
 }
 
 typedef struct _temp_var_cache {
@@ -2314,14 +3947,17 @@ typedef struct _temp_var_cache {
                        | TOK_OPEN_PAREN | TOK_OPEN_SQUARE | TOK_OP | TOK_TT)
 
 /*! Use Dijkstra's shunting-yard algorithm to parse expression into RPN stack. */
-mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_ins,
-                               const mpr_type *in_types, const int *in_vec_lens, mpr_type out_type,
-                               int out_vec_len)
+static mpr_expr expr_parse(mpr_expr_stack eval_stk, const char *str, int n_ins,
+                           const mpr_type *in_types, const int *in_vec_lens, mpr_type out_type,
+                           int out_vec_len)
 {
     mpr_token_t out[STACK_SIZE];
     mpr_token_t op[STACK_SIZE];
     int i, lex_idx = 0, out_idx = -1, op_idx = -1;
-    int oldest_in[MAX_NUM_MAP_SRC], oldest_out = 0, max_vector = 1;
+    int oldest_in[MAX_NUM_MAP_SRC], oldest_out = 0, max_vector = 1, n_parsed_tokens;
+    uint8_t n_states = 0;
+    double coefs[MAX_FIR_COEFS];
+    int n_coefs = 0;
 
     /* TODO: use bitflags instead? */
     uint8_t assigning = 0, is_const = 1, out_assigned = 0, muted = 0, vectorizing = 0;
@@ -2582,6 +4218,12 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                 mpr_token_t newtok;
                 tok.gen.datatype = fn_tbl[tok.fn.idx].fn_int ? MPR_INT32 : MPR_FLT;
                 tok.fn.arity = fn_tbl[tok.fn.idx].arity;
+                if (tok.fn.idx >= FN_LOWPASS) {
+                    /* filters keep running state that cannot be shared between reduce iterations */
+                    {FAIL_IF(reduce_types, "Filters cannot be used inside reduce functions.");}
+                    {FAIL_IF(UINT8_MAX == n_states, "Maximum number of filters exceeded.");}
+                    tok.fn.state = n_states++;
+                }
                 if (fn_tbl[tok.fn.idx].memory) {
                     /* add assignment token */
                     char varname[6];
@@ -2681,6 +4323,10 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                     allow_toktype = TOK_RFN | TOK_VFN_DOT;
                     /* get compound arity of last token */
                     sslen = substack_len(out, out_idx);
+                    for (i = out_idx - sslen + 1; i <= out_idx; i++) {
+                        FAIL_IF(TOK_FN == out[i].toktype && out[i].fn.idx >= FN_LOWPASS,
+                                "Filters cannot be used inside reduce functions.");
+                    }
                     switch (rt) {
                         case RT_HISTORY: {
                             int y_ref = 0, x_ref = 0, lit_val, len = sslen;
@@ -2693,6 +4339,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                             {FAIL_IF(tok.toktype != TOK_LITERAL || tok.lit.datatype != MPR_INT32,
                                      "'history' must be followed by integer argument.");}
                             lit_val = abs(tok.lit.val.i);
+                            {FAIL_IF(lit_val > MAX_HIST_SIZE, "'history' argument is too large.");}
 
                             for (i = 0; i < len; i++) {
                                 int idx = out_idx - i;
@@ -2764,6 +4411,8 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                                 }
                             }
                             {FAIL_IF(!v_ref, "instance reduce requires reference to 'x' or 'y'.");}
+                            op[op_idx].con.reduce_start = 0;
+                            op[op_idx].con.reduce_stop = 0;
                             break;
                         }
                         case RT_SIGNAL: {
@@ -3391,6 +5040,37 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                         allow_toktype |= (var_flags & ~VAR_IDXS);
                         break;
                     }
+                    else if (FN_FIR == op[op_idx].fn.idx) {
+                        mpr_token t = &out[out_idx];
+                        {FAIL_IF(arity != 2, "fir() requires an input and a coefficient vector.");}
+                        /* coefficients should be at the top of the output stack */
+                        {FAIL_IF(   (TOK_LITERAL != t->toktype && TOK_VLITERAL != t->toktype)
+                                 || t->gen.flags & CONST_SPECIAL, "fir() coefficients must be constant.");}
+                        {FAIL_IF(n_coefs + t->gen.vec_len > MAX_FIR_COEFS,
+                                 "Maximum number of fir() coefficients exceeded.");}
+                        for (i = 0; i < t->gen.vec_len; i++) {
+                            switch (t->lit.datatype) {
+#define TYPED_CASE(MTYPE, T)                                                                \
+                                case MTYPE:                                                 \
+                                    coefs[n_coefs + i] = TOK_LITERAL == t->toktype          \
+                                                         ? t->lit.val.T : t->lit.val.T##p[i];\
+                                    break;
+                                TYPED_CASE(MPR_INT32, i)
+                                TYPED_CASE(MPR_FLT, f)
+                                TYPED_CASE(MPR_DBL, d)
+#undef TYPED_CASE
+                                default:
+                                    {FAIL("Unknown coefficient type for fir().");}
+                            }
+                        }
+                        op[op_idx].fn.coef_idx = n_coefs;
+                        op[op_idx].fn.n_taps = t->gen.vec_len;
+                        n_coefs += t->gen.vec_len;
+                        if (TOK_VLITERAL == t->toktype)
+                            free(t->lit.val.ip);
+                        POP_OUTPUT();
+                        POP_OPERATOR_TO_OUTPUT();
+                    }
                     else {
                         if (arity != fn_tbl[op[op_idx].fn.idx].arity) {
                             /* check for overloaded functions */
@@ -3842,6 +5522,15 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
     printstack("OPERATOR STACK", op, op_idx, vars, 0);
 #endif
 
+    n_parsed_tokens = out_idx + 1;
+    out_idx = optimize_stack(out, out_idx + 1) - 1;
+    out_idx = lower_windows(out, out_idx + 1, oldest_in, &n_states) - 1;
+    out_idx = lower_pools(out, out_idx + 1, n_ins, oldest_in) - 1;
+
+#if TRACE_PARSE
+    printstack("OPTIMIZED STACK", out, out_idx, vars, 0);
+#endif
+
     /* Check for maximum vector length used in stack */
     for (i = 0; i < out_idx; i++) {
         if (out[i].gen.vec_len > max_vector)
@@ -3854,6 +5543,17 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
     expr->offset = 0;
     expr->inst_ctl = inst_ctl;
     expr->mute_ctl = mute_ctl;
+    expr->n_parsed_tokens = n_parsed_tokens;
+    expr->cached = 0;
+    expr->n_states = n_states;
+    expr->inst_state = 0;
+    expr->n_inst_state = 0;
+    if (n_coefs) {
+        expr->coefs = malloc(sizeof(double) * n_coefs);
+        memcpy(expr->coefs, coefs, sizeof(double) * n_coefs);
+    }
+    else
+        expr->coefs = 0;
 
     /* copy tokens */
     expr->tokens = malloc(sizeof(union _token) * (size_t)expr->n_tokens);
@@ -3883,6 +5583,8 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
 
     expr_stack_realloc(eval_stk, expr->stack_size * expr->vec_len);
 
+    expr->prog = expr_compile(expr, in_types, in_vec_lens, out_type, out_vec_len);
+
 #if TRACE_PARSE
     printf("expression allocated and initialized\n");
 #endif
@@ -3904,6 +5606,126 @@ error:
 
 }
 
+/* Maps often share the same expression string and signal types, so parsed expressions are kept in
+ * a process-wide cache. The tokens, variable names and compiled program of a cached expression
+ * are shared and never modified; each map receives a copy of the struct and of the variable table,
+ * which hold the evaluation offset and flags that change while evaluating. History sizes are
+ * derived from the expression string so they do not need to be part of the key. */
+
+#define EXPR_CACHE_SIZE 256
+
+typedef struct _expr_cache_entry {
+    struct _expr_cache_entry *next;
+    mpr_expr expr;                  /* shared expression, never evaluated directly */
+    char *str;
+    unsigned int hash;
+    int refs;
+    int n_ins;
+    int out_vec_len;
+    int in_vec_lens[MAX_NUM_MAP_SRC];
+    mpr_type in_types[MAX_NUM_MAP_SRC];
+    mpr_type out_type;
+} expr_cache_entry_t, *expr_cache_entry;
+
+static expr_cache_entry expr_cache[EXPR_CACHE_SIZE];
+static volatile unsigned int expr_cache_lock = 0;
+
+
+static unsigned int expr_cache_hash(const char *str, int n_ins, const mpr_type *in_types,
+                                    const int *in_vec_lens, mpr_type out_type, int out_vec_len)
+{
+    /* FNV-1a */
+    unsigned int i, h = 2166136261u;
+    while (*str)
+        h = (h ^ (unsigned char)*str++) * 16777619u;
+    for (i = 0; i < n_ins; i++)
+        h = ((h ^ in_types[i]) * 16777619u ^ in_vec_lens[i]) * 16777619u;
+    return ((h ^ out_type) * 16777619u ^ out_vec_len) * 16777619u;
+}
+
+static void expr_cache_release(expr_cache_entry entry)
+{
+    expr_cache_entry *e;
+    mpr_spin_lock(&expr_cache_lock);
+    if (--entry->refs) {
+        mpr_spin_unlock(&expr_cache_lock);
+        return;
+    }
+    e = &expr_cache[entry->hash % EXPR_CACHE_SIZE];
+    while (*e != entry)
+        e = &(*e)->next;
+    *e = entry->next;
+    mpr_spin_unlock(&expr_cache_lock);
+    mpr_expr_free(entry->expr);
+    free(entry->str);
+    free(entry);
+}
+
+/* Return a copy of a cached expression with its own evaluation state. */
+static mpr_expr expr_cache_copy(expr_cache_entry entry)
+{
+    mpr_expr expr = malloc(sizeof(struct _mpr_expr));
+    memcpy(expr, entry->expr, sizeof(struct _mpr_expr));
+    if (expr->n_vars) {
+        expr->vars = malloc(sizeof(mpr_var_t) * expr->n_vars);
+        memcpy(expr->vars, entry->expr->vars, sizeof(mpr_var_t) * expr->n_vars);
+    }
+    expr->cached = entry;
+    expr->inst_state = 0;
+    expr->n_inst_state = 0;
+    return expr;
+}
+
+mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_ins,
+                               const mpr_type *in_types, const int *in_vec_lens, mpr_type out_type,
+                               int out_vec_len)
+{
+    unsigned int hash;
+    expr_cache_entry entry;
+    mpr_expr expr;
+    RETURN_ARG_UNLESS(str, 0);
+    if (n_ins < 1 || n_ins > MAX_NUM_MAP_SRC)
+        return expr_parse(eval_stk, str, n_ins, in_types, in_vec_lens, out_type, out_vec_len);
+
+    hash = expr_cache_hash(str, n_ins, in_types, in_vec_lens, out_type, out_vec_len);
+    mpr_spin_lock(&expr_cache_lock);
+    for (entry = expr_cache[hash % EXPR_CACHE_SIZE]; entry; entry = entry->next) {
+        if (   entry->hash == hash && entry->n_ins == n_ins && entry->out_type == out_type
+            && entry->out_vec_len == out_vec_len && !strcmp(entry->str, str)
+            && !memcmp(entry->in_types, in_types, sizeof(mpr_type) * n_ins)
+            && !memcmp(entry->in_vec_lens, in_vec_lens, sizeof(int) * n_ins))
+            break;
+    }
+    if (entry) {
+        ++entry->refs;
+        mpr_spin_unlock(&expr_cache_lock);
+        expr = expr_cache_copy(entry);
+        expr_stack_realloc(eval_stk, expr->stack_size * expr->vec_len);
+        return expr;
+    }
+    mpr_spin_unlock(&expr_cache_lock);
+
+    /* parse outside the lock; a concurrent parse of the same string only costs a duplicate */
+    expr = expr_parse(eval_stk, str, n_ins, in_types, in_vec_lens, out_type, out_vec_len);
+    RETURN_ARG_UNLESS(expr, 0);
+    entry = calloc(1, sizeof(expr_cache_entry_t));
+    entry->expr = expr;
+    entry->str = strdup(str);
+    entry->hash = hash;
+    entry->refs = 1;
+    entry->n_ins = n_ins;
+    memcpy(entry->in_types, in_types, sizeof(mpr_type) * n_ins);
+    memcpy(entry->in_vec_lens, in_vec_lens, sizeof(int) * n_ins);
+    entry->out_type = out_type;
+    entry->out_vec_len = out_vec_len;
+
+    mpr_spin_lock(&expr_cache_lock);
+    entry->next = expr_cache[hash % EXPR_CACHE_SIZE];
+    expr_cache[hash % EXPR_CACHE_SIZE] = entry;
+    mpr_spin_unlock(&expr_cache_lock);
+    return expr_cache_copy(entry);
+}
+
 int mpr_expr_get_in_hist_size(mpr_expr expr, int idx)
 {
     return expr->in_hist_size[idx];
@@ -3952,6 +5774,12 @@ int mpr_expr_get_src_is_muted(mpr_expr expr, int idx)
     return found && muted;
 }
 
+int mpr_expr_get_num_tokens(mpr_expr expr, int optimized)
+{
+    RETURN_ARG_UNLESS(expr, 0);
+    return optimized ? expr->n_tokens : expr->n_parsed_tokens;
+}
+
 int mpr_expr_get_num_input_slots(mpr_expr expr)
 {
     return expr ? expr->n_ins : 0;
@@ -4047,6 +5875,418 @@ MPR_INLINE static int _max(int a, int b)
     return a > b ? a : b;
 }
 
+/* Running state of a windowed reduction or filter for one instance. The header records the buffer
+ * the state belongs to so that it can be rebuilt when the buffer is reset. Windows follow it with
+ * an accumulator for each vector element for sums and means, or with a deque of sample numbers
+ * for each element for maxima and minima. */
+typedef struct _expr_state {
+    mpr_value v;                /* value the state was computed from */
+    void *samps;                /* history buffer the state was computed from */
+    unsigned int count;         /* sample count of the buffer when last updated */
+    int pos;                    /* updates since a window was rebuilt, or fir() input position */
+} expr_state_t, *expr_state;
+
+typedef union {
+    unsigned int u;             /* integer sums wrap like the loops they replace */
+    float f;                    /* float sums keep the precision of the loops they replace */
+    double d;
+} win_acc_t;
+
+typedef struct {
+    int head;
+    int size;
+} win_deque_t;
+
+/* Return running state 'state' of an instance, allocating 'size' bytes after the header if
+ * necessary. New state is zeroed so that it will be initialized on first use. */
+static expr_state get_inst_state(mpr_expr expr, int state, int idx, int num_inst, size_t size)
+{
+    expr_state *s;
+    if (idx >= expr->n_inst_state) {
+        int n = expr->n_states;
+        s = realloc(expr->inst_state, sizeof(expr_state) * num_inst * n);
+        RETURN_ARG_UNLESS(s, 0);
+        memset(s + expr->n_inst_state * n, 0, sizeof(expr_state) * (num_inst - expr->n_inst_state) * n);
+        expr->inst_state = s;
+        expr->n_inst_state = num_inst;
+    }
+    s = &expr->inst_state[idx * expr->n_states + state];
+    if (!*s)
+        *s = calloc(1, sizeof(expr_state_t) + size);
+    return *s;
+}
+
+/* Return vector element 'el' of the sample 'hist' steps back, converted to the window type. */
+MPR_INLINE static double win_samp(mpr_value v, mpr_value_buffer b, int hist, int el, mpr_type type)
+{
+    int i = mpr_value_hist_pos(v, b->pos, hist) * v->vlen + el;
+    double d;
+    switch (v->type) {
+        case MPR_INT32: d = ((int*)b->samps)[i];    break;
+        case MPR_FLT:   d = ((float*)b->samps)[i];  break;
+        default:        d = ((double*)b->samps)[i]; break;
+    }
+    switch (type) {
+        case MPR_INT32: return (int)d;
+        case MPR_FLT:   return (float)d;
+        default:        return d;
+    }
+}
+
+/* Push sample number 's' onto the deque of vector element 'i', first dropping samples that have
+ * left the window and samples that can no longer be the extremum. */
+static void win_push(expr_state w, mpr_token tok, mpr_value v, mpr_value_buffer b, int i, int el,
+                     unsigned int s)
+{
+    int n = tok->win.len;
+    win_deque_t *q = (win_deque_t*)(w + 1) + i;
+    unsigned int *e = (unsigned int*)((win_deque_t*)(w + 1) + tok->gen.vec_len) + i * n;
+    double val = win_samp(v, b, -(int)(b->count - s), el, tok->gen.datatype), back;
+    while (q->size && s - e[q->head] >= n) {
+        q->head = (q->head + 1) % n;
+        --q->size;
+    }
+    while (q->size) {
+        back = win_samp(v, b, -(int)(b->count - e[(q->head + q->size - 1) % n]), el,
+                        tok->gen.datatype);
+        if (WIN_MAX == tok->win.op ? back > val : back < val)
+            break;
+        --q->size;
+    }
+    e[(q->head + q->size++) % n] = s;
+}
+
+/* Evaluate a windowed history reduction into 'out'. When state is kept the running sums or
+ * deques are updated with the samples received since the last evaluation, and are rebuilt from
+ * the history if the buffer was changed in any other way. Floating point sums are also rebuilt
+ * once per window length to stop rounding errors from accumulating. */
+static void win_eval(mpr_expr expr, mpr_token tok, mpr_value v, int inst_idx, int keep_state,
+                     mpr_expr_val out)
+{
+    int i, k, el, n = tok->win.len, op = tok->win.op, idx = inst_idx % v->num_inst, full = 1;
+    mpr_type type = tok->gen.datatype;
+    mpr_value_buffer b = &v->inst[idx];
+    unsigned int delta = 0;
+    win_acc_t tmp[UINT8_MAX], *acc = tmp;
+    expr_state w = 0;
+    double ext, val, x;
+
+    if (keep_state && v->mlen > n) {
+        size_t size = op <= WIN_MEAN ? sizeof(win_acc_t) : sizeof(win_deque_t) + sizeof(int) * n;
+        w = get_inst_state(expr, tok->win.state, idx, v->num_inst, size * tok->gen.vec_len);
+    }
+    if (w) {
+        delta = b->count - w->count;
+        full = (   w->v != v || w->samps != b->samps || delta >= n || delta > v->mlen - n
+                || (op <= WIN_MEAN && MPR_INT32 != type && w->pos + delta >= n));
+        w->v = v;
+        w->samps = b->samps;
+        w->count = b->count;
+        w->pos = full ? 0 : w->pos + delta;
+    }
+
+    if (op <= WIN_MEAN) {
+        if (w)
+            acc = (win_acc_t*)(w + 1);
+        for (i = 0; i < tok->gen.vec_len; i++) {
+            el = (tok->win.vec_idx + i) % v->vlen;
+            if (MPR_INT32 == type) {
+                if (full) {
+                    acc[i].u = 0;
+                    for (k = n - 1; k >= 0; k--)
+                        acc[i].u += (unsigned int)(int)win_samp(v, b, -k, el, type);
+                }
+                else {
+                    for (k = delta - 1; k >= 0; k--)
+                        acc[i].u += (  (unsigned int)(int)win_samp(v, b, -k, el, type)
+                                     - (unsigned int)(int)win_samp(v, b, -(n + k), el, type));
+                }
+                out[i].i = WIN_MEAN == op ? (int)acc[i].u / n : (int)acc[i].u;
+                continue;
+            }
+            if (MPR_FLT == type) {
+                if (full) {
+                    acc[i].f = 0;
+                    for (k = n - 1; k >= 0; k--)
+                        acc[i].f += (float)win_samp(v, b, -k, el, type);
+                }
+                else {
+                    for (k = delta - 1; k >= 0; k--)
+                        acc[i].f += (  (float)win_samp(v, b, -k, el, type)
+                                     - (float)win_samp(v, b, -(n + k), el, type));
+                }
+                out[i].f = WIN_MEAN == op ? acc[i].f / (float)n : acc[i].f;
+                continue;
+            }
+            if (full) {
+                acc[i].d = 0;
+                for (k = n - 1; k >= 0; k--)
+                    acc[i].d += win_samp(v, b, -k, el, type);
+            }
+            else {
+                for (k = delta - 1; k >= 0; k--)
+                    acc[i].d += win_samp(v, b, -k, el, type) - win_samp(v, b, -(n + k), el, type);
+            }
+            out[i].d = WIN_MEAN == op ? acc[i].d / n : acc[i].d;
+        }
+        return;
+    }
+
+    /* the loops being replaced start from the extreme value of the type */
+    switch (type) {
+        case MPR_INT32: ext = WIN_MAX == op ? INT_MIN : INT_MAX;    break;
+        case MPR_FLT:   ext = WIN_MAX == op ? -FLT_MAX : FLT_MAX;   break;
+        default:        ext = WIN_MAX == op ? -DBL_MAX : DBL_MAX;   break;
+    }
+    for (i = 0; i < tok->gen.vec_len; i++) {
+        el = (tok->win.vec_idx + i) % v->vlen;
+        if (w) {
+            win_deque_t *q = (win_deque_t*)(w + 1) + i;
+            unsigned int *e = (unsigned int*)((win_deque_t*)(w + 1) + tok->gen.vec_len) + i * n;
+            if (full)
+                q->head = q->size = 0;
+            for (k = (full ? n : delta) - 1; k >= 0; k--)
+                win_push(w, tok, v, b, i, el, b->count - k);
+            val = win_samp(v, b, -(int)(b->count - e[q->head]), el, type);
+        }
+        else {
+            val = ext;
+            for (k = n - 1; k >= 0; k--) {
+                x = win_samp(v, b, -k, el, type);
+                if (WIN_MAX == op ? !(val > x) : !(val < x))
+                    val = x;
+            }
+        }
+        if (WIN_MAX == op ? ext > val : ext < val)
+            val = ext;
+        switch (type) {
+            case MPR_INT32: out[i].i = (int)val;    break;
+            case MPR_FLT:   out[i].f = (float)val;  break;
+            default:        out[i].d = val;         break;
+        }
+    }
+}
+
+/* Evaluate an instance reduction into 'out' from the running aggregates kept by the input value,
+ * returning 0 if they could not be allocated. */
+static int pool_eval(mpr_token tok, mpr_value v, mpr_expr_val out)
+{
+    mpr_value_agg agg = mpr_value_get_agg(v);
+    int i, el, n = v->num_active_inst, op = tok->win.op;
+    double d;
+    RETURN_ARG_UNLESS(agg, 0);
+    for (i = 0; i < tok->gen.vec_len; i++) {
+        el = (tok->win.vec_idx + i) % v->vlen;
+        switch (op) {
+            case WIN_MAX:   d = agg->max[el];   break;
+            case WIN_MIN:   d = agg->min[el];   break;
+            default:        d = agg->sum[el];   break;
+        }
+        switch (tok->gen.datatype) {
+            case MPR_INT32:
+                /* integer sums are exact and wrap like the loops they replace */
+                out[i].i = op >= WIN_MAX ? (int)d : (int)(unsigned int)(long long)d;
+                if (WIN_MEAN == op)
+                    out[i].i /= n;
+                break;
+            case MPR_FLT:
+                out[i].f = WIN_MEAN == op ? (float)d / (float)n : (float)d;
+                break;
+            default:
+                out[i].d = WIN_MEAN == op ? d / n : d;
+                break;
+        }
+    }
+    return 1;
+}
+
+/* Return vector element 'el' of filter argument 'arg', repeating shorter arguments. */
+MPR_INLINE static double filt_arg(mpr_expr_val stk, uint8_t *dims, mpr_type type, int vlen, int arg,
+                                  int el)
+{
+    mpr_expr_val val = &stk[arg * vlen + el % dims[arg]];
+    return MPR_FLT == type ? val->f : val->d;
+}
+
+/* Advance the one-pole or biquad filters of 'len' vector elements at once using the vector
+ * kernels. Filter state is stored one field at a time for all elements, so that each step of the
+ * scalar update in filt_eval() maps onto one kernel call with the same operation order. */
+static void filt_eval_vec(int fn, mpr_expr_val z, int stride, mpr_expr_val x, mpr_expr_val y,
+                          int len)
+{
+    mpr_expr_val_t t[UINT8_MAX];
+    vec_binop_fn **op = kernels.binopd;
+#define FIELD(F) (z + (F) * stride)
+    if (FN_ONEPOLE == fn) {
+        /* y = z0 = z0 + c * (x - z0) */
+        op[KERNEL_SUB](t, x, FIELD(0), len);
+        op[KERNEL_MUL](t, FIELD(2), t, len);
+        op[KERNEL_ADD](FIELD(0), FIELD(0), t, len);
+        memcpy(y, FIELD(0), sizeof(mpr_expr_val_t) * len);
+        return;
+    }
+    /* y = b0 * x + z1; z1 = b1 * x - a1 * y + z2; z2 = b2 * x - a2 * y */
+    op[KERNEL_MUL](y, FIELD(4), x, len);
+    op[KERNEL_ADD](y, y, FIELD(0), len);
+    op[KERNEL_MUL](FIELD(0), FIELD(5), x, len);
+    op[KERNEL_MUL](t, FIELD(7), y, len);
+    op[KERNEL_SUB](FIELD(0), FIELD(0), t, len);
+    op[KERNEL_ADD](FIELD(0), FIELD(0), FIELD(1), len);
+    op[KERNEL_MUL](FIELD(1), FIELD(6), x, len);
+    op[KERNEL_MUL](t, FIELD(8), y, len);
+    op[KERNEL_SUB](FIELD(1), FIELD(1), t, len);
+#undef FIELD
+}
+
+/* Evaluate a filter in place on the stack. Running state is kept for each instance of the output
+ * and is reinitialized whenever the output buffer is reset, so that filters start from the steady
+ * state for their current input. Without an output the steady state response is returned. Long
+ * vectors are updated with the vector kernels: one-pole and biquad filters across elements, and
+ * fir() across taps, keeping each element's past inputs contiguous in a doubled ring buffer. */
+static void filt_eval(mpr_expr expr, mpr_token tok, mpr_value v, int inst_idx, mpr_expr_val stk,
+                      uint8_t *dims, int vlen)
+{
+    int i, k, init = 1, fn = tok->fn.idx, n_taps = tok->fn.n_taps, size, stride = 1, vec;
+    int len = dims[0] < tok->gen.vec_len ? dims[0] : tok->gen.vec_len;
+    mpr_type type = tok->gen.datatype;
+    mpr_expr_val_t xs[UINT8_MAX], ys[UINT8_MAX];
+    expr_state s = 0;
+    double tmp[9], *z = tmp, *c, x, y, f, q, w, alpha, cw, g;
+
+    switch (fn) {
+        case FN_ONEPOLE:    size = 3;           break;
+        case FN_FIR:        size = n_taps * 2;  break;
+        default:            size = 9;           break;
+    }
+    if (v) {
+        int idx = inst_idx % v->num_inst;
+        mpr_value_buffer b = &v->inst[idx];
+        s = get_inst_state(expr, tok->fn.state, idx, v->num_inst,
+                           sizeof(double) * size * tok->gen.vec_len);
+        if (s) {
+            init = s->v != v || s->samps != b->samps || s->count != b->count;
+            s->v = v;
+            s->samps = b->samps;
+            s->count = b->count;
+            /* fir() stores the newest input at s->pos, moving back one place per update */
+            if (init)
+                s->pos = 0;
+            else if (FN_FIR == fn)
+                s->pos = (s->pos ? s->pos : n_taps) - 1;
+        }
+    }
+    /* one-pole and biquad state is stored field by field across the vector elements */
+    if (s && FN_FIR != fn)
+        stride = tok->gen.vec_len;
+    vec = s && !init && FN_FIR != fn && len >= MIN_KERNEL_LEN;
+
+#define Z(F) z[(F) * stride]
+    for (i = 0; i < len; i++) {
+        x = filt_arg(stk, dims, type, vlen, 0, i);
+        if (s)
+            z = (double*)(s + 1) + (FN_FIR == fn ? i * size : i);
+        switch (fn) {
+            case FN_ONEPOLE:
+                /* state: output, frequency, coefficient */
+                f = filt_arg(stk, dims, type, vlen, 1, i);
+                if (init || f != Z(1)) {
+                    Z(1) = f;
+                    Z(2) = 1 - exp(-2 * M_PI * (f < 0 ? 0 : f > 0.5 ? 0.5 : f));
+                }
+                if (vec) {
+                    xs[i].d = x;
+                    continue;
+                }
+                y = Z(0) = init ? x : Z(0) + Z(2) * (x - Z(0));
+                break;
+            case FN_FIR:
+                /* state: past inputs, newest first from s->pos and repeated n_taps later */
+                c = expr->coefs + tok->fn.coef_idx;
+                if (!s) {
+                    for (k = 0, y = 0; k < n_taps; k++)
+                        y += c[k];
+                    y *= x;
+                    break;
+                }
+                if (init) {
+                    for (k = 0; k < size; k++)
+                        z[k] = x;
+                }
+                z[s->pos] = z[s->pos + n_taps] = x;
+                z += s->pos;
+                if (n_taps >= MIN_KERNEL_LEN)
+                    y = kernels.dotd((mpr_expr_val)c, (mpr_expr_val)z, n_taps);
+                else {
+                    for (k = 0, y = 0; k < n_taps; k++)
+                        y += c[k] * z[k];
+                }
+                break;
+            default:
+                /* state: z1, z2, frequency, q, b0, b1, b2, a1, a2 (transposed direct form II) */
+                f = filt_arg(stk, dims, type, vlen, 1, i);
+                q = filt_arg(stk, dims, type, vlen, 2, i);
+                if (init || f != Z(2) || q != Z(3)) {
+                    Z(2) = f;
+                    Z(3) = q;
+                    w = 2 * M_PI * (f < 0 ? 0 : f > 0.5 ? 0.5 : f);
+                    alpha = sin(w) / (2 * (q < 1e-6 ? 1e-6 : q));
+                    cw = cos(w);
+                    switch (fn) {
+                        case FN_LOWPASS:
+                            Z(4) = Z(6) = (1 - cw) / 2;
+                            Z(5) = 1 - cw;
+                            break;
+                        case FN_HIGHPASS:
+                            Z(4) = Z(6) = (1 + cw) / 2;
+                            Z(5) = -(1 + cw);
+                            break;
+                        default:
+                            Z(4) = alpha;
+                            Z(5) = 0;
+                            Z(6) = -alpha;
+                            break;
+                    }
+                    Z(7) = -2 * cw;
+                    Z(8) = 1 - alpha;
+                    for (k = 4; k < 9; k++)
+                        Z(k) /= 1 + alpha;
+                }
+                if (vec) {
+                    xs[i].d = x;
+                    continue;
+                }
+                if (init) {
+                    g = 1 + Z(7) + Z(8);
+                    g = g ? (Z(4) + Z(5) + Z(6)) / g : 0;
+                    y = g * x;
+                    Z(0) = y - Z(4) * x;
+                    Z(1) = Z(6) * x - Z(8) * y;
+                }
+                else {
+                    y = Z(4) * x + Z(0);
+                    Z(0) = Z(5) * x - Z(7) * y + Z(1);
+                    Z(1) = Z(6) * x - Z(8) * y;
+                }
+                break;
+        }
+        if (MPR_FLT == type)
+            stk[i].f = y;
+        else
+            stk[i].d = y;
+    }
+#undef Z
+
+    if (vec) {
+        filt_eval_vec(fn, (mpr_expr_val)(s + 1), stride, xs, ys, len);
+        for (i = 0; i < len; i++) {
+            if (MPR_FLT == type)
+                stk[i].f = ys[i].d;
+            else
+                stk[i].d = ys[i].d;
+        }
+    }
+}
+
 int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_value *v_vars,
                   mpr_value v_out, mpr_time *time, mpr_type *out_types, int inst_idx)
 {
@@ -4056,8 +6296,9 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
     mpr_token_t *tok, *end;
     int status = 1 | EXPR_EVAL_DONE, cache = 0, vlen;
     int i, j, sp, dp = -1;
-    /* Note: signal, history, and vector reduce are currently limited to 256 items here */
-    uint8_t alive = 1, muted = 0, can_advance = 1, hist_offset = 0, sig_offset = 0, vec_offset = 0;
+    /* Note: signal and vector reduce are currently limited to 256 items here */
+    uint8_t alive = 1, muted = 0, can_advance = 1, sig_offset = 0, vec_offset = 0;
+    int hist_offset = 0, last_pos = -1;
     uint8_t inst_count = 0;
     mpr_value_buffer b_out;
     mpr_value x = NULL;
@@ -4082,6 +6323,13 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
         tok += expr->offset;
     }
 
+#if !TRACE_EVAL
+    /* use the compiled program once any initialisation statements have been evaluated */
+    if (expr->prog && v_out && tok == expr->start + expr->prog->start && out_types
+        && (v_in || expr->prog->status & EXPR_EVAL_DONE))
+        return expr_run_prog(expr->prog, expr_stk, v_in, v_out, time, out_types, inst_idx);
+#endif
+
     if (v_vars) {
         if (expr->inst_ctl >= 0) {
             /* recover instance state */
@@ -4102,7 +6350,8 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
         if (out_types)
             memset(out_types, MPR_NULL, v_out->vlen);
         /* Increment index position of output data structure. */
-        b_out->pos = (b_out->pos + 1) % v_out->mlen;
+        last_pos = b_out->pos;
+        b_out->pos = (b_out->pos + 1) & (v_out->mlen - 1);
     }
 
     /* choose one input to represent active instances
@@ -4176,7 +6425,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 can_advance = 0;
             }
             else if (tok->var.idx >= VAR_X) {
-                RETURN_ARG_UNLESS(v_in, status);
+                DONE_UNLESS(v_in);
                 if (!(tok->gen.flags & VAR_SIG_IDX)) {
                     v = v_in[tok->var.idx - VAR_X + sig_offset];
 #if TRACE_EVAL
@@ -4262,9 +6511,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             dims[dp] = tok->gen.vec_len;
             types[dp] = v->type;
 
-            i = (b->pos + v->mlen + hidx) % v->mlen;
-            if (i < 0)
-                i += v->mlen;
+            i = mpr_value_hist_pos(v, b->pos, hidx);
             switch (v->type) {
 #define COPY_TYPED(MTYPE, TYPE, T)                                          \
                 case MTYPE: {                                               \
@@ -4321,7 +6568,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 stk[sp].i = v_out->num_active_inst;
             }
             else if (tok->var.idx >= VAR_X) {
-                RETURN_ARG_UNLESS(v_in, status);
+                DONE_UNLESS(v_in);
                 stk[sp].i = v_in[tok->var.idx - VAR_X]->num_active_inst;
             }
             else if (v_vars)
@@ -4386,21 +6633,21 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 mpr_value_buffer b;
                 RETURN_ARG_UNLESS(v_out, status);
                 b = b_out;
-                idx = (b->pos + v_out->mlen + hidx) % v_out->mlen;
+                idx = mpr_value_hist_pos(v_out, b->pos, hidx);
                 t_d = mpr_time_as_dbl(b->times[idx]);
                 if (weight)
-                    t_d = t_d * weight + ((b->pos + v_out->mlen + hidx - 1) % v_out->mlen) * (1 - weight);
+                    t_d = t_d * weight + mpr_value_hist_pos(v_out, b->pos, hidx - 1) * (1 - weight);
             }
             else if (tok->var.idx >= VAR_X) {
                 mpr_value v;
                 mpr_value_buffer b;
-                RETURN_ARG_UNLESS(v_in, status);
+                DONE_UNLESS(v_in);
                 v = v_in[tok->var.idx - VAR_X];
                 b = &v->inst[inst_idx % v->num_inst];
                 /* TODO: ensure buffer overrun is not possible here amd similar */
-                t_d = mpr_time_as_dbl(b->times[(b->pos + v->mlen + hidx) % v->mlen]);
+                t_d = mpr_time_as_dbl(b->times[mpr_value_hist_pos(v, b->pos, hidx)]);
                 if (weight)
-                    t_d = t_d * weight + ((b->pos + v->mlen + hidx - 1) % v->mlen) * (1 - weight);
+                    t_d = t_d * weight + mpr_value_hist_pos(v, b->pos, hidx - 1) * (1 - weight);
             }
             else if (v_vars) {
                 mpr_value v = *v_vars + tok->var.idx;
@@ -4435,6 +6682,17 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 diff -= mindiff;
             }
             rdim = dims[dp + 1];
+            if (rdim == dims[dp] && rdim >= MIN_KERNEL_LEN && binop_idx(tok->op.idx) >= 0) {
+                /* long operands of equal length */
+                if (MPR_FLT == types[dp]) {
+                    kernels.binopf[binop_idx(tok->op.idx)](stk + sp, stk + sp, stk + sp + vlen, rdim);
+                    goto op_done;
+                }
+                if (MPR_DBL == types[dp]) {
+                    kernels.binopd[binop_idx(tok->op.idx)](stk + sp, stk + sp, stk + sp + vlen, rdim);
+                    goto op_done;
+                }
+            }
             switch (types[dp]) {
                 case MPR_INT32: {
                     switch (tok->op.idx) {
@@ -4501,6 +6759,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 default:
                     goto error;
             }
+          op_done:
             types[dp] = tok->gen.datatype;
 #if TRACE_EVAL
             print_stack_vec(stk + sp, types[dp], dims[dp], dp);
@@ -4528,6 +6787,15 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             ldim = dims[dp];
             rdim = dims[dp + 1];
             types[dp] = tok->gen.datatype;
+            if (tok->fn.idx >= FN_LOWPASS) {
+                /* running state is only kept for real updates, not for dry runs without output */
+                filt_eval(expr, tok, v_out, inst_idx, stk + sp, dims + dp, vlen);
+                can_advance = 0;
+#if TRACE_EVAL
+                print_stack_vec(stk + sp, types[dp], dims[dp], dp);
+#endif
+                break;
+            }
             switch (types[dp]) {
 #define TYPED_CASE(MTYPE, FN, T)                                                        \
             case MTYPE:                                                                 \
@@ -4679,6 +6947,51 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                     break;
             }
             break;
+        case TOK_WINDOW: {
+            mpr_value v;
+            DONE_UNLESS(v_in);
+            v = v_in[tok->win.idx - VAR_X];
+#if TRACE_EVAL
+            printf("\n\t\tvar.x$%d.history(%d)\r\t\t\t\t\t", tok->win.idx - VAR_X, tok->win.len);
+#endif
+            can_advance = 0;
+            if (!cache)
+                status &= ~EXPR_EVAL_DONE;
+            sp += vlen;
+            ++dp;
+            assert(dp < expr_stk->size);
+            dims[dp] = tok->gen.vec_len;
+            types[dp] = tok->gen.datatype;
+            /* running state is only kept for real updates, not for dry runs without output */
+            win_eval(expr, tok, v, inst_idx, v_out != 0, stk + sp);
+#if TRACE_EVAL
+            print_stack_vec(stk + sp, types[dp], dims[dp], dp);
+#endif
+            break;
+        }
+        case TOK_POOL: {
+            mpr_value v;
+            DONE_UNLESS(v_in);
+            v = v_in[tok->win.idx - VAR_X];
+#if TRACE_EVAL
+            printf("\n\t\tvar.x$%d.instance\r\t\t\t\t\t", tok->win.idx - VAR_X);
+#endif
+            /* the instance loops being replaced end evaluation if no instance is active */
+            RETURN_ARG_UNLESS(v->num_active_inst, status);
+            /* the result does not depend on the instance being evaluated */
+            can_advance = 0;
+            sp += vlen;
+            ++dp;
+            assert(dp < expr_stk->size);
+            dims[dp] = tok->gen.vec_len;
+            types[dp] = tok->gen.datatype;
+            if (!pool_eval(tok, v, stk + sp))
+                goto error;
+#if TRACE_EVAL
+            print_stack_vec(stk + sp, types[dp], dims[dp], dp);
+#endif
+            break;
+        }
         case TOK_SP_ADD:
             dp += tok->lit.val.i;
             assert(dp < expr_stk->size);
@@ -4715,7 +7028,9 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                         if (tok->con.reduce_stop)
                             ++inst_count;
                     }
-                    if (x && i < x->num_inst && inst_count < tok->con.reduce_stop) {
+                    /* a zero reduce_stop visits every active instance */
+                    if (   x && i < x->num_inst
+                        && (!tok->con.reduce_stop || inst_count < tok->con.reduce_stop)) {
 #if TRACE_EVAL
                         printf("Instance idx = %d\n", i);
 #endif
@@ -4765,7 +7080,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                     }
                     break;
                 case RT_VECTOR:
-                    RETURN_ARG_UNLESS(v_in, status);
+                    DONE_UNLESS(v_in);
                     ++vec_offset;
                     if (USE_VAR_LEN & tok->con.flags) {
                         if (vec_offset < v_in[sig_offset]->vlen) {
@@ -4924,9 +7239,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             printf("[%s%d]", tok->gen.flags & VAR_VEC_IDX ? "N=" : "", vidx);
             printf(" (%c x %u)\n", types[dp], tok->gen.vec_len);
 #endif
-            i = (b->pos + v->mlen + hidx) % v->mlen;
-            if (i < 0)
-                i += v->mlen;
+            i = mpr_value_hist_pos(v, b->pos, hidx);
 
             /* Copy time from input */
             if (time) {
@@ -5008,9 +7321,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             if (!v_out)
                 return status;
             hist = tok->gen.flags & VAR_HIST_IDX;
-            idx = (b_out->pos + v_out->mlen + (hist ? stk[sp - vlen].i : 0)) % v_out->mlen;
-            if (idx < 0)
-                idx = v_out->mlen + idx;
+            idx = mpr_value_hist_pos(v_out, b_out->pos, hist ? stk[sp - vlen].i : 0);
             mpr_time_set_dbl(&b_out->times[idx], stk[sp].d);
             /* If assignment was constant or history initialization, move expr
              * start token pointer so we don't evaluate this section again. */
@@ -5076,7 +7387,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
          * so we need to copy to output here. */
 
         /* Increment index position of output data structure. */
-        b_out->pos = (b_out->pos + 1) % v_out->mlen;
+        b_out->pos = (b_out->pos + 1) & (v_out->mlen - 1);
         v = mpr_value_get_samp(v_out, inst_idx);
         switch (v_out->type) {
 #define TYPED_CASE(MTYPE, TYPE, T)                              \
@@ -5104,9 +7415,61 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
 
     return status;
 
+  done:
+    /* Inputs are missing when the expression is evaluated to initialise literals; leave the
+     * output position for the first update. */
+    if (v_out)
+        b_out->pos = last_pos;
+    return status;
+
   error:
 #if TRACE_EVAL
     trace("Unexpected token in expression.");
 #endif
     return 0;
 }
+
+/* Instances are evaluated together in batches of at most this size, bounding the stack size. */
+#define MAX_BATCH_INST 64
+
+int mpr_expr_eval_batch(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in,
+                        mpr_value *v_vars, mpr_value v_out, mpr_time *time, mpr_type *out_types,
+                        int *status, const int *inst_idx, int num_inst)
+{
+    int i, n = 0, ret = 0, batch[MAX_BATCH_INST];
+    mpr_expr_prog prog;
+
+    RETURN_ARG_UNLESS(expr && v_out && out_types && num_inst > 0, 0);
+    prog = expr->prog;
+
+#if !TRACE_EVAL
+    if (prog && prog->can_batch && num_inst > 1 && (v_in || prog->status & EXPR_EVAL_DONE))
+        expr_stack_realloc(expr_stk, expr->stack_size * expr->vec_len * MAX_BATCH_INST);
+    else
+#endif
+        prog = 0;
+
+    for (i = 0; i < num_inst; i++) {
+        int idx = inst_idx[i];
+        if (prog && idx < v_out->num_inst
+            && (v_out->inst[idx].pos >= 0 ? expr->offset : 0) == prog->start) {
+            /* only instances that have already run any initialisation statements are batched */
+            batch[n++] = idx;
+            if (n == MAX_BATCH_INST) {
+                expr_run_batch(prog, expr_stk, v_in, v_out, time, out_types, status, batch, n);
+                ret |= prog->status;
+                n = 0;
+            }
+        }
+        else {
+            status[idx] = mpr_expr_eval(expr_stk, expr, v_in, v_vars, v_out, time,
+                                        out_types + idx * v_out->vlen, idx);
+            ret |= status[idx];
+        }
+    }
+    if (n) {
+        expr_run_batch(prog, expr_stk, v_in, v_out, time, out_types, status, batch, n);
+        ret |= prog->status;
+    }
+    return ret;
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <math.h>
 #include <zlib.h>
 #ifndef _MSC_VER
 #include <sys/time.h>
@@ -198,6 +199,7 @@ mpr_graph mpr_graph_new(int subscribe_flags)
     g->net.graph = g->obj.graph = g;
     g->obj.id = 0;
     g->own = 1;
+    mpr_mutex_init(&g->net.admin_lock);
     mpr_net_init(&g->net, 0, 0, 0);
     if (subscribe_flags)
         _autosubscribe(g, subscribe_flags);
@@ -279,6 +281,7 @@ void mpr_graph_free(mpr_graph g)
     }
 
     mpr_net_free(&g->net);
+    mpr_mutex_free(&g->net.admin_lock);
     FUNC_IF(mpr_tbl_free, g->obj.props.synced);
     free(g);
 }
@@ -786,6 +789,16 @@ void mpr_graph_print(mpr_graph g)
 }
 
 /* TODO: consider throttling */
+static int _has_local_link(mpr_dev dev)
+{
+    int i;
+    for (i = 0; i < dev->num_linked; i++) {
+        if (dev->linked[i] && dev->linked[i]->is_local)
+            return 1;
+    }
+    return 0;
+}
+
 void mpr_graph_housekeeping(mpr_graph g)
 {
     mpr_list devs = mpr_list_from_data(g->devs);
@@ -801,14 +814,7 @@ void mpr_graph_housekeeping(mpr_graph g)
         /* check if device has "checked in" recently – could be /sync ping or any sent metadata */
         if (!dev->is_local && dev->synced.sec && (dev->synced.sec < t.sec)) {
             /* do nothing if device is linked to local device; will be handled in network.c */
-            int i, local_link = 0;
-            for (i = 0; i < dev->num_linked; i++) {
-                if (dev->linked[i] && dev->linked[i]->is_local) {
-                    local_link = 1;
-                    break;
-                }
-            }
-            if (!local_link) {
+            if (!_has_local_link(dev)) {
                 /* remove subscription */
                 mpr_graph_subscribe(g, dev, 0, 0);
                 mpr_graph_remove_dev(g, dev, MPR_OBJ_EXP, 0);
@@ -830,20 +836,48 @@ void mpr_graph_housekeeping(mpr_graph g)
     }
 }
 
-int mpr_graph_poll(mpr_graph g, int block_ms)
+/* Receive messages on the bus and mesh servers. If local devices are polled by worker threads,
+ * wait without holding their locks and lock them only while the messages are handled. */
+static int _recv_admin(mpr_net n, int block_ms)
+{
+    int count = 0, status[2], locked = 0;
+    if (n->num_workers) {
+        RETURN_ARG_UNLESS(lo_servers_wait(n->servers, status, 2, block_ms), 0);
+        block_ms = 0;
+        locked = mpr_net_lock_devs(n);
+    }
+    if (lo_servers_recv_noblock(n->servers, status, 2, block_ms))
+        count = (status[0] > 0) + (status[1] > 0);
+    if (locked) {
+        /* send replies before releasing the devices */
+        mpr_net_send(n);
+        mpr_net_unlock_devs(n);
+    }
+    return count;
+}
+
+/* Caller must hold net->admin_lock. */
+static void _process_timers(mpr_graph g)
+{
+    int locked = mpr_net_lock_devs(&g->net);
+    mpr_net_poll(&g->net);
+    mpr_graph_housekeeping(g);
+    if (locked)
+        mpr_net_unlock_devs(&g->net);
+}
+
+/* Caller must hold net->admin_lock. */
+int mpr_graph_poll_admin(mpr_graph g, int block_ms)
 {
     mpr_net n = &g->net;
-    int count = 0, status[2], left_ms, elapsed, checked_admin = 0;
+    int count = 0, left_ms, elapsed, checked_admin = 0;
     double then;
 
-    mpr_net_poll(n);
-    mpr_graph_housekeeping(g);
+    _process_timers(g);
 
     if (!block_ms) {
-        if (lo_servers_recv_noblock(n->servers, status, 2, 0)) {
-            count = (status[0] > 0) + (status[1] > 0);
-            n->msgs_recvd |= count;
-        }
+        count = _recv_admin(n, 0);
+        n->msgs_recvd |= count;
         return count;
     }
 
@@ -853,13 +887,11 @@ int mpr_graph_poll(mpr_graph g, int block_ms)
         if (left_ms > 100)
             left_ms = 100;
 
-        if (lo_servers_recv_noblock(n->servers, status, 2, left_ms))
-            count += (status[0] > 0) + (status[1] > 0);
+        count += _recv_admin(n, left_ms);
 
         elapsed = (mpr_get_current_time() - then) * 1000;
         if ((elapsed - checked_admin) > 100) {
-            mpr_net_poll(n);
-            mpr_graph_housekeeping(g);
+            _process_timers(g);
             checked_admin = elapsed;
         }
 
@@ -870,6 +902,102 @@ int mpr_graph_poll(mpr_graph g, int block_ms)
     return count;
 }
 
+int mpr_graph_poll(mpr_graph g, int block_ms)
+{
+    int count;
+    mpr_mutex_lock(&g->net.admin_lock);
+    count = mpr_graph_poll_admin(g, block_ms);
+    mpr_mutex_unlock(&g->net.admin_lock);
+    return count;
+}
+
+int mpr_graph_get_fds(mpr_graph g, int *fds, int num)
+{
+    int i;
+    RETURN_ARG_UNLESS(g, 0);
+    for (i = 0; i < 2 && i < num; i++)
+        fds[i] = lo_server_get_socket_fd(g->net.servers[i]);
+    return 2;
+}
+
+/*! Return the number of seconds until mpr_graph_housekeeping() next has work to do. */
+static double _get_housekeeping_timeout(mpr_graph g)
+{
+    mpr_list devs = mpr_list_from_data(g->devs);
+    mpr_subscription s;
+    double now, timeout = AUTOSUB_INTERVAL;
+    mpr_time t;
+    mpr_time_set(&t, MPR_NOW);
+    now = mpr_time_as_dbl(t);
+
+    /* known devices expire TIMEOUT_SEC after their last check in */
+    while (devs) {
+        mpr_dev dev = (mpr_dev)*devs;
+        devs = mpr_list_get_next(devs);
+        if (!dev->is_local && dev->synced.sec && !_has_local_link(dev)) {
+            double wait = (double)(dev->synced.sec + TIMEOUT_SEC + 1) - now;
+            if (wait < timeout)
+                timeout = wait;
+        }
+    }
+
+    /* subscriptions are renewed once their lease expiration has passed */
+    for (s = g->subscriptions; s; s = s->next) {
+        double wait = (double)(s->lease_expiration_sec + TIMEOUT_SEC) - now;
+        if (wait < timeout)
+            timeout = wait;
+    }
+    return timeout;
+}
+
+int mpr_graph_get_timeout(mpr_graph g)
+{
+    double timeout;
+    RETURN_ARG_UNLESS(g, 0);
+    timeout = mpr_net_get_timeout(&g->net);
+    if (timeout > 0) {
+        double housekeeping = _get_housekeeping_timeout(g);
+        if (housekeeping < timeout)
+            timeout = housekeeping;
+    }
+    /* round up so the deadline has passed when the caller wakes */
+    return timeout > 0 ? (int)ceil(timeout * 1000) : 0;
+}
+
+int mpr_graph_process_fd(mpr_graph g, int fd)
+{
+    int i, count = 0, locked;
+    mpr_net n;
+    RETURN_ARG_UNLESS(g, 0);
+    n = &g->net;
+    mpr_mutex_lock(&n->admin_lock);
+    locked = mpr_net_lock_devs(n);
+    for (i = 0; i < 2; i++) {
+        if (lo_server_get_socket_fd(n->servers[i]) != fd)
+            continue;
+        while (lo_server_recv_noblock(n->servers[i], 0))
+            ++count;
+        break;
+    }
+    if (count) {
+        n->msgs_recvd |= 1;
+        /* send any replies immediately rather than waiting for the next timer */
+        mpr_net_send(n);
+    }
+    if (locked)
+        mpr_net_unlock_devs(n);
+    mpr_mutex_unlock(&n->admin_lock);
+    return count;
+}
+
+void mpr_graph_process_timers(mpr_graph g)
+{
+    RETURN_UNLESS(g);
+    mpr_mutex_lock(&g->net.admin_lock);
+    _process_timers(g);
+    mpr_mutex_unlock(&g->net.admin_lock);
+}
+
 #ifdef HAVE_LIBPTHREAD
 static void *graph_thread_func(void *data)
 {
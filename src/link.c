@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for sendmmsg() */
+#endif
 #include <string.h>
 #include <math.h>
 #include <stdlib.h>
@@ -9,6 +12,21 @@
 #include "types_internal.h"
 #include <mapper/mapper.h>
 
+#ifdef HAVE_ARPA_INET_H
+ #include <sys/socket.h>
+ #include <netdb.h>
+#else
+ #ifdef HAVE_WINSOCK2_H
+  #include <ws2tcpip.h>
+ #endif
+#endif
+
+/* maximum payload of a UDP datagram */
+#define MAX_UDP_BUNDLE_SIZE 65507
+
+/* maximum number of datagrams passed to a single sendmmsg() call */
+#define MAX_SEND_BATCH 64
+
 mpr_link mpr_link_new(mpr_local_dev local_dev, mpr_dev remote_dev)
 {
     return mpr_graph_add_link(local_dev->obj.graph, (mpr_dev)local_dev, remote_dev);
@@ -58,6 +76,38 @@ void mpr_link_init(mpr_link link)
     mpr_net_send(net);
 }
 
+/* Resolve the data address of the remote device so that serialized bundles can be sent from the
+ * socket of the local device's UDP server. */
+static void _resolve_udp_addr(mpr_link link, const char *host, const char *port)
+{
+    struct addrinfo hints, *res = 0;
+    struct sockaddr_storage local;
+    socklen_t local_len = sizeof(local);
+    mpr_local_dev ldev = (mpr_local_dev)link->devs[LOCAL_DEV];
+
+    FUNC_IF(free, link->addr.udp_sa);
+    link->addr.udp_sa = 0;
+    RETURN_UNLESS(ldev->servers[SERVER_UDP]);
+    if (getsockname(lo_server_get_socket_fd(ldev->servers[SERVER_UDP]),
+                    (struct sockaddr*)&local, &local_len))
+        return;
+
+    /* match the address family of the server socket */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = local.ss_family;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (AF_INET6 == local.ss_family)
+        hints.ai_flags = AI_V4MAPPED;
+    if (getaddrinfo(host, port, &hints, &res) || !res) {
+        trace_dev(ldev, "could not resolve %s:%s, using liblo to send updates\n", host, port);
+        return;
+    }
+    link->addr.udp_sa = malloc(res->ai_addrlen);
+    memcpy(link->addr.udp_sa, res->ai_addr, res->ai_addrlen);
+    link->addr.udp_sa_len = res->ai_addrlen;
+    freeaddrinfo(res);
+}
+
 void mpr_link_connect(mpr_link link, const char *host, int admin_port, int data_port)
 {
     if (!link->is_local_only) {
@@ -69,6 +119,7 @@ void mpr_link_connect(mpr_link link, const char *host, int admin_port, int data_
         sprintf(str, "%d", data_port);
         link->addr.udp = lo_address_new(host, str);
         link->addr.tcp = lo_address_new_with_proto(LO_TCP, host, str);
+        _resolve_udp_addr(link, host, str);
         sprintf(str, "%d", admin_port);
         link->addr.admin = lo_address_new(host, str);
         trace_dev(link->devs[LOCAL_DEV], "activated link to device '%s' at %s:%d\n",
@@ -92,9 +143,13 @@ void mpr_link_free(mpr_link link)
     FUNC_IF(lo_address_free, link->addr.admin);
     FUNC_IF(lo_address_free, link->addr.udp);
     FUNC_IF(lo_address_free, link->addr.tcp);
+    FUNC_IF(free, link->addr.udp_sa);
     for (i = 0; i < NUM_BUNDLES; i++) {
         FUNC_IF(lo_bundle_free_recursive, link->bundles[i].udp);
         FUNC_IF(lo_bundle_free_recursive, link->bundles[i].tcp);
+        FUNC_IF(free, link->bundles[i].buf.data);
+        FUNC_IF(free, link->bundles[i].local.msgs);
+        FUNC_IF(free, link->bundles[i].local.data);
     }
     mpr_dev_remove_link(link->devs[LOCAL_DEV], link->devs[REMOTE_DEV]);
 }
@@ -116,12 +171,162 @@ void mpr_link_add_msg(mpr_link link, mpr_sig dst, lo_message msg, mpr_time t,
     lo_bundle_add_message(*b, dst->path, msg);
 }
 
+static void _send_buf(mpr_link link, mpr_send_buf_t *buf)
+{
+    mpr_local_dev ldev = (mpr_local_dev)link->devs[LOCAL_DEV];
+    sendto(lo_server_get_socket_fd(ldev->servers[SERVER_UDP]), buf->data, buf->len, 0,
+           (struct sockaddr*)link->addr.udp_sa, link->addr.udp_sa_len);
+    buf->len = 0;
+    buf->num_msgs = 0;
+}
+
+MPR_INLINE static int _get_udp_fd(mpr_link link)
+{
+    return lo_server_get_socket_fd(((mpr_local_dev)link->devs[LOCAL_DEV])->servers[SERVER_UDP]);
+}
+
+int mpr_link_send_bufs(mpr_link *links, int num, int idx)
+{
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[MAX_SEND_BATCH];
+    struct iovec iov[MAX_SEND_BATCH];
+    int i = 0, j, n, fd, sent, saved = 0;
+    while (i < num) {
+        /* batch consecutive links that send from the same socket */
+        fd = _get_udp_fd(links[i]);
+        memset(msgs, 0, sizeof(msgs));
+        for (n = 0; n < MAX_SEND_BATCH && i + n < num && _get_udp_fd(links[i + n]) == fd; n++) {
+            mpr_link link = links[i + n];
+            iov[n].iov_base = link->bundles[idx].buf.data;
+            iov[n].iov_len = link->bundles[idx].buf.len;
+            msgs[n].msg_hdr.msg_name = link->addr.udp_sa;
+            msgs[n].msg_hdr.msg_namelen = link->addr.udp_sa_len;
+            msgs[n].msg_hdr.msg_iov = &iov[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+        }
+        sent = sendmmsg(fd, msgs, n, 0);
+        if (sent > 1)
+            saved += sent - 1;
+        for (j = 0; j < n; j++) {
+            mpr_send_buf_t *buf = &links[i + j]->bundles[idx].buf;
+            if (j < sent) {
+                buf->len = 0;
+                buf->num_msgs = 0;
+            }
+            else {
+                /* the batch was interrupted, send the remaining bundles individually */
+                _send_buf(links[i + j], buf);
+            }
+        }
+        i += n;
+    }
+    return saved;
+#else
+    int i;
+    for (i = 0; i < num; i++)
+        _send_buf(links[i], &links[i]->bundles[idx].buf);
+    return 0;
+#endif
+}
+
+char *mpr_link_reserve_msg(mpr_link link, int size, mpr_time t, int idx)
+{
+    char *ptr;
+    size_t needed;
+    mpr_send_buf_t *buf = &link->bundles[idx].buf;
+    RETURN_ARG_UNLESS(link->addr.udp_sa, 0);
+
+    /* send the current bundle first if the message would not fit in the same datagram */
+    if (buf->num_msgs && buf->len + 4 + size > MAX_UDP_BUNDLE_SIZE)
+        _send_buf(link, buf);
+
+    needed = (buf->num_msgs ? buf->len : 16) + 4 + size;
+    if (needed > buf->size) {
+        buf->size = buf->size ? buf->size : 1024;
+        while (buf->size < needed)
+            buf->size *= 2;
+        buf->data = realloc(buf->data, buf->size);
+    }
+    if (!buf->num_msgs) {
+        /* bundle header and timetag */
+        memcpy(buf->data, "#bundle", 8);
+        mpr_osc_set_int32(buf->data + 8, t.sec);
+        mpr_osc_set_int32(buf->data + 12, t.frac);
+        buf->len = 16;
+    }
+    mpr_osc_set_int32(buf->data + buf->len, size);
+    ptr = buf->data + buf->len + 4;
+    buf->len = needed;
+    ++buf->num_msgs;
+    return ptr;
+}
+
+void mpr_link_add_local_msg(mpr_link link, mpr_local_sig dst, const mpr_type *types, int len,
+                            const void *val, mpr_id GID, int slot_idx, mpr_time t, int idx)
+{
+    int i, size = 0;
+    size_t needed;
+    mpr_local_msg msg;
+    mpr_local_msg_queue_t *q = &link->bundles[idx].local;
+
+    if (q->num_msgs >= q->size_msgs) {
+        q->size_msgs = q->size_msgs ? q->size_msgs * 2 : 8;
+        q->msgs = realloc(q->msgs, q->size_msgs * sizeof(mpr_local_msg_t));
+    }
+    if (val && types) {
+        for (i = 0; i < len && !size; i++)
+            size = types[i] == MPR_NULL ? 0 : mpr_type_get_size(types[i]);
+    }
+
+    /* store the type vector followed by the aligned value vector */
+    needed = ((q->data_len + len + 7) & ~(size_t)7) + len * size;
+    if (needed > q->data_size) {
+        q->data_size = q->data_size ? q->data_size : 256;
+        while (q->data_size < needed)
+            q->data_size *= 2;
+        q->data = realloc(q->data, q->data_size);
+    }
+
+    msg = &q->msgs[q->num_msgs++];
+    msg->sig = dst;
+    msg->GID = GID;
+    msg->slot = slot_idx;
+    msg->len = len;
+    msg->types = q->data_len;
+    if (types && size)
+        memcpy(q->data + q->data_len, types, len);
+    else
+        memset(q->data + q->data_len, MPR_NULL, len);
+    q->data_len = (q->data_len + len + 7) & ~(size_t)7;
+    if (size) {
+        msg->vals = q->data_len;
+        memcpy(q->data + q->data_len, val, len * size);
+        q->data_len += len * size;
+    }
+    else
+        msg->vals = 0;
+    if (1 == q->num_msgs)
+        q->time = t;
+}
+
+void mpr_link_remove_local_msgs(mpr_link link, mpr_local_sig sig)
+{
+    int i, j;
+    for (i = 0; i < NUM_BUNDLES; i++) {
+        mpr_local_msg_queue_t *q = &link->bundles[i].local;
+        for (j = 0; j < q->num_msgs; j++) {
+            if (q->msgs[j].sig == sig)
+                q->msgs[j].sig = 0;
+        }
+    }
+}
+
 /* TODO: pass in bundle index as argument */
 /* TODO: interrupt driven signal updates may not be followed by mpr_dev_process_outputs(); in the
  * case where the interrupt has interrupted mpr_dev_poll() these messages will not be dispatched. */
 int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx)
 {
-    int i = 0, num = 0, tmp;
+    int i, num = 0, tmp;
     mpr_bundle b;
     lo_bundle lb;
     RETURN_ARG_UNLESS(link, 0);
@@ -130,9 +335,11 @@ int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx)
 
     if (!link->is_local_only) {
         mpr_local_dev ldev = (mpr_local_dev)link->devs[LOCAL_DEV];
+        num = b->buf.num_msgs;
         if ((lb = b->udp)) {
             b->udp = 0;
-            if ((num = lo_bundle_count(lb))) {
+            if ((tmp = lo_bundle_count(lb))) {
+                num += tmp;
                 lo_send_bundle_from(link->addr.udp, ldev->servers[SERVER_UDP], lb);
             }
             lo_bundle_free_recursive(lb);
@@ -146,28 +353,51 @@ int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx)
             lo_bundle_free_recursive(lb);
         }
     }
-    else if ((lb = b->udp)) {
-        const char *path;
-        b->udp = 0;
+    else if ((num = b->local.num_msgs)) {
+        mpr_local_msg_queue_t q;
+        mpr_local_dev src = (mpr_local_dev)link->devs[LOCAL_DEV];
+        mpr_local_dev dst = (mpr_local_dev)link->devs[REMOTE_DEV];
+        int locked = 0;
+
+        /* When called from a worker thread the destination device must also be locked. The
+         * control thread may hold it while waiting for ours, so defer delivery rather than block. */
+        if (src->data_locked && dst != src) {
+            if (!mpr_mutex_trylock(&dst->lock)) {
+                src->sending = 1;
+                return 0;
+            }
+            locked = 1;
+        }
+
+        /* Detach the queue since handlers may queue further updates on this link. */
+        q = b->local;
+        memset(&b->local, 0, sizeof(mpr_local_msg_queue_t));
+
         /* set out-of-band timestamp */
-        mpr_dev_bundle_start(lo_bundle_get_timestamp(lb), NULL);
+        mpr_dev_bundle_start(q.time, link->devs[REMOTE_DEV]);
         /* call handler directly instead of sending over the network */
-        num = lo_bundle_count(lb);
-        while (i < num) {
-            lo_message m = lo_bundle_get_message(lb, i, &path);
-            /* need to look up signal by path */
-            mpr_rtr_sig rs = link->obj.graph->net.rtr->sigs;
-            while (rs) {
-                if (0 == strcmp(path, rs->sig->path)) {
-                    mpr_dev_handler(NULL, lo_message_get_types(m), lo_message_get_argv(m),
-                                    lo_message_get_argc(m), m, (void*)rs->sig);
-                    break;
-                }
-                rs = rs->next;
-            }
-            ++i;
+        for (i = 0; i < q.num_msgs; i++) {
+            mpr_local_msg m = &q.msgs[i];
+            if (m->sig)
+                mpr_dev_handle_update(m->sig, q.data + m->types, m->len,
+                                      m->vals ? q.data + m->vals : 0, m->GID, m->slot);
+        }
+
+        /* keep the buffers for the next update unless new ones were allocated meanwhile */
+        if (!b->local.msgs) {
+            q.num_msgs = 0;
+            q.data_len = 0;
+            b->local = q;
+        }
+        else {
+            free(q.msgs);
+            free(q.data);
+        }
+        if (locked) {
+            mpr_mutex_unlock(&dst->lock);
+            /* the destination processes its incoming maps on its own thread */
+            mpr_dev_wake(dst);
         }
-        lo_bundle_free_recursive(lb);
     }
     return num;
 }
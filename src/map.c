@@ -232,6 +232,12 @@ void mpr_map_refresh(mpr_map m)
 void mpr_map_free(mpr_map m)
 {
     int i;
+    if (m->is_local) {
+        FUNC_IF(free, ((mpr_local_map)m)->tmpl.data);
+        FUNC_IF(free, ((mpr_local_map)m)->tmpl.types);
+        FUNC_IF(free, ((mpr_local_map)m)->eval.status);
+        FUNC_IF(free, ((mpr_local_map)m)->eval.types);
+    }
     if (m->src) {
         for (i = 0; i < m->num_src; i++)
             mpr_slot_free(m->src[i]);
@@ -246,6 +252,18 @@ void mpr_map_free(mpr_map m)
     FUNC_IF(free, m->expr_str);
 }
 
+mpr_local_dev mpr_map_get_local_dev(mpr_local_map m)
+{
+    int i;
+    if (!m->dst->sig->is_local || m->is_local_only) {
+        for (i = 0; i < m->num_src; i++) {
+            if (m->src[i]->sig->is_local)
+                return (mpr_local_dev)m->src[i]->sig->dev;
+        }
+    }
+    return (mpr_local_dev)m->dst->sig->dev;
+}
+
 static int _cmp_qry_sigs(const void *ctx, mpr_sig s)
 {
     mpr_map m = *(mpr_map*)ctx;
@@ -444,11 +462,64 @@ static int _update_scope(mpr_map m, mpr_msg_atom a)
  * 4) when it comes to "to release" idmap, send release and decref LID
  */
 
+/* Evaluate the expression for all updated instances, storing the results in map->eval. */
+static void _eval_updated_inst(mpr_local_map m, mpr_expr_stack stk, mpr_value *src_vals,
+                               mpr_value dst_val, mpr_time *time)
+{
+    int i, n = 0, *inst_idx, len = dst_val->vlen;
+
+    if (m->num_inst > m->eval.num_inst || len != m->eval.len) {
+        m->eval.num_inst = m->num_inst;
+        m->eval.len = len;
+        m->eval.status = realloc(m->eval.status, m->num_inst * sizeof(int));
+        m->eval.types = realloc(m->eval.types, m->num_inst * len * sizeof(mpr_type));
+    }
+
+    if (m->use_inst) {
+        /* evaluate all updated instances together */
+        inst_idx = alloca(m->num_inst * sizeof(int));
+        for (i = 0; i < m->num_inst; i++) {
+            if (get_bitflag(m->updated_inst, i))
+                inst_idx[n++] = i;
+        }
+        mpr_expr_eval_batch(stk, m->expr, src_vals, &m->vars, dst_val, time, m->eval.types,
+                            m->eval.status, inst_idx, n);
+    }
+    else {
+        for (i = 0; i < m->num_inst; i++) {
+            if (!get_bitflag(m->updated_inst, i))
+                continue;
+            m->eval.status[i] = mpr_expr_eval(stk, m->expr, src_vals, &m->vars, dst_val, time,
+                                              m->eval.types + i * len, i);
+            if ((m->eval.status[i] & EXPR_EVAL_DONE))
+                break;
+        }
+    }
+    m->eval.ready = 1;
+}
+
+/* only called for outgoing maps */
+void mpr_map_eval(mpr_local_map m, mpr_expr_stack stk, mpr_time time)
+{
+    int i;
+    mpr_value *src_vals;
+
+    RETURN_UNLESS(m->updated && m->expr && MPR_DIR_OUT == m->src[0]->dir && !m->muted);
+
+    src_vals = alloca(m->num_src * sizeof(mpr_value));
+    for (i = 0; i < m->num_src; i++)
+        src_vals[i] = &m->src[i]->val;
+
+    /* the stack may be shared by maps compiled on another device */
+    mpr_expr_stack_reserve(stk, m->expr);
+
+    _eval_updated_inst(m, stk, src_vals, &m->dst->val, &time);
+}
+
 /* only called for outgoing maps */
 void mpr_map_send(mpr_local_map m, mpr_time time)
 {
     int i, j, status, map_manages_inst = 0;
-    lo_message msg;
     mpr_local_dev dev;
     uint8_t bundle_idx;
     mpr_local_slot src_slot, dst_slot;
@@ -460,7 +531,7 @@ void mpr_map_send(mpr_local_map m, mpr_time time)
 
     RETURN_UNLESS(m->updated && m->expr && MPR_DIR_OUT == m->src[0]->dir && !m->muted);
 
-    dev = m->rtr->dev;
+    dev = mpr_map_get_local_dev(m);
     bundle_idx = dev->bundle_idx % NUM_BUNDLES;
 
     /* temporary solution: use most multitudinous source signal for idmap
@@ -483,37 +554,30 @@ void mpr_map_send(mpr_local_map m, mpr_time time)
         idmap = m->idmap;
     }
 
-    types = alloca(dst_slot->sig->len * sizeof(char));
+    /* TODO: Check if each instance has enough history to process the expression */
+    if (!m->eval.ready)
+        _eval_updated_inst(m, dev->expr_stack, src_vals, &dst_slot->val, &time);
 
     for (i = 0; i < m->num_inst; i++) {
         /* Check if this instance has been updated */
         if (!get_bitflag(m->updated_inst, i))
             continue;
-        /* TODO: Check if this instance has enough history to process the expression */
-        status = mpr_expr_eval(dev->expr_stack, m->expr, src_vals, &m->vars,
-                               &dst_slot->val, &time, types, i);
+        status = m->eval.status[i];
+        types = m->eval.types + i * m->eval.len;
         if (!status)
             continue;
 
         if (src_sig->use_inst && !map_manages_inst) {
-            /* finding idmaps here will be a bit inefficient for now */
-            /* TODO: optimize storage and lookup */
-            for (j = 0; j < src_sig->idmap_len; j++) {
-                if (idmaps[j].inst && idmaps[j].inst->idx == i) {
-                    idmap = idmaps[j].map;
-                    break;
-                }
-            }
-            if (j == src_sig->idmap_len) {
+            if ((j = mpr_sig_get_idmap_with_inst_idx(src_sig, i)) < 0) {
                 trace("error: couldn't find idmap for signal instance idx %d\n", i);
                 continue;
             }
+            idmap = idmaps[j].map;
         }
 
         /* send instance release if dst is instanced and either src or map is also instanced. */
         if (idmap && status & EXPR_RELEASE_BEFORE_UPDATE && m->use_inst) {
-            msg = mpr_map_build_msg(m, 0, 0, 0, idmap);
-            mpr_link_add_msg(dst_slot->link, dst_slot->sig, msg, time, m->protocol, bundle_idx);
+            mpr_map_add_msg(m, dst_slot->link, dst_slot->sig, 0, 0, 0, idmap, time, bundle_idx);
             if (map_manages_inst) {
                 mpr_dev_LID_decref(dev, 0, idmap);
                 idmap = m->idmap = 0;
@@ -526,15 +590,12 @@ void mpr_map_send(mpr_local_map m, mpr_time time)
                 /* create an id_map and store it in the map */
                 idmap = m->idmap = mpr_dev_add_idmap(dev, 0, 0, 0);
             }
-            msg = mpr_map_build_msg(m, src_slot, result, types, idmap);
-            mpr_link_add_msg(dst_slot->link, dst_slot->sig, msg,
-                             *(mpr_time*)mpr_value_get_time(&dst_slot->val, i),
-                             m->protocol, bundle_idx);
+            mpr_map_add_msg(m, dst_slot->link, dst_slot->sig, src_slot, result, types, idmap,
+                            *(mpr_time*)mpr_value_get_time(&dst_slot->val, i), bundle_idx);
         }
         /* send instance release if dst is instanced and either src or map is also instanced. */
         if (idmap && status & EXPR_RELEASE_AFTER_UPDATE && m->use_inst) {
-            msg = mpr_map_build_msg(m, 0, 0, 0, idmap);
-            mpr_link_add_msg(dst_slot->link, dst_slot->sig, msg, time, m->protocol, bundle_idx);
+            mpr_map_add_msg(m, dst_slot->link, dst_slot->sig, 0, 0, 0, idmap, time, bundle_idx);
             if (map_manages_inst) {
                 mpr_dev_LID_decref(dev, 0, idmap);
                 idmap = m->idmap = 0;
@@ -545,6 +606,7 @@ void mpr_map_send(mpr_local_map m, mpr_time time)
     }
     clear_bitflags(m->updated_inst, m->num_inst);
     m->updated = 0;
+    m->eval.ready = 0;
 }
 
 /* only called for incoming maps */
@@ -558,7 +620,6 @@ void mpr_map_receive(mpr_local_map m, mpr_time time)
     mpr_value src_vals[MAX_NUM_MAP_SRC];
     struct _mpr_sig_idmap *idmaps;
     mpr_id_map idmap = 0;
-    char *types;
 
     /* temporary solution: use most multitudinous source signal for idmap
      * permanent solution: move idmaps to map */
@@ -584,7 +645,8 @@ void mpr_map_receive(mpr_local_map m, mpr_time time)
         else
             idmap = 0;
     }
-    types = alloca(dst_sig->len * sizeof(char));
+    _eval_updated_inst(m, ((mpr_local_dev)dst_sig->dev)->expr_stack, src_vals, &dst_slot->val,
+                       &time);
 
     for (i = 0; i < m->num_inst; i++) {
         mpr_sig_inst si;
@@ -592,28 +654,17 @@ void mpr_map_receive(mpr_local_map m, mpr_time time)
 
         if (!get_bitflag(m->updated_inst, i))
             continue;
-        status = mpr_expr_eval(m->rtr->dev->expr_stack, m->expr, src_vals,
-                               &m->vars, &dst_slot->val, &time, types, i);
+        status = m->eval.status[i];
         if (!status)
             continue;
 
         j = 0;
         if (dst_sig->use_inst && !map_manages_inst) {
-            /* finding idmaps here will be a bit inefficient for now */
-            /* TODO: optimize storage and lookup */
-            for (j = 0; j < dst_sig->idmap_len; j++) {
-                if (idmaps[j].inst && idmaps[j].inst->idx == i) {
-                    idmap = idmaps[j].map;
-                    break;
-                }
-            }
-            if (j == dst_sig->idmap_len) {
+            if ((j = mpr_sig_get_idmap_with_inst_idx(dst_sig, i)) < 0) {
                 trace("error: couldn't find idmap for signal instance idx %d\n", i);
                 continue;
             }
-        }
-        else {
-            
+            idmap = idmaps[j].map;
         }
         si = idmaps[j].inst;
         diff = mpr_time_get_diff(time, si->time);
@@ -668,18 +719,22 @@ void mpr_map_receive(mpr_local_map m, mpr_time time)
     }
     clear_bitflags(m->updated_inst, m->num_inst);
     m->updated = 0;
+    m->eval.ready = 0;
+}
+
+MPR_INLINE static int _get_msg_len(mpr_local_map m, mpr_local_slot slot)
+{
+    if (MPR_LOC_SRC == m->process_loc)
+        return m->dst->sig->len;
+    return slot ? slot->sig->len : 0;
 }
 
 /*! Build a value update message for a given map. */
 lo_message mpr_map_build_msg(mpr_local_map m, mpr_local_slot slot, const void *val,
                              mpr_type *types, mpr_id_map idmap)
 {
-    int i, len = 0;
+    int i, len = _get_msg_len(m, slot);
     NEW_LO_MSG(msg, return 0);
-    if (MPR_LOC_SRC == m->process_loc)
-        len = m->dst->sig->len;
-    else if (slot)
-        len = slot->sig->len;
 
     if (val && types) {
         /* value of vector elements can be <type> or NULL */
@@ -709,6 +764,166 @@ lo_message mpr_map_build_msg(mpr_local_map m, mpr_local_slot slot, const void *v
     return msg;
 }
 
+MPR_INLINE static int _get_osc_size(mpr_type type)
+{
+    switch (type) {
+        case MPR_INT32:
+        case MPR_FLT:   return 4;
+        case MPR_DBL:   return 8;
+        default:        return 0;
+    }
+}
+
+/* Check whether a message template matches the layout of an update. */
+static int _tmpl_matches(mpr_msg_tmpl tmpl, const char *path, int len, const mpr_type *types,
+                         int has_GID, int slot_id)
+{
+    int i;
+    /* compare the path by content, since a new path string may reuse the address of a freed one */
+    RETURN_ARG_UNLESS(tmpl->data && tmpl->num_types == len && !tmpl->GID == !has_GID
+                      && tmpl->slot == slot_id && !strcmp(tmpl->data, path), 0);
+    for (i = 0; i < len; i++) {
+        if (tmpl->types[i] != (types ? types[i] : MPR_NULL))
+            return 0;
+    }
+    return 1;
+}
+
+/* Lay out the path, typetag, "@in" and "@sl" arguments of an update message once so that
+ * subsequent updates only need to write their values and instance id. */
+static void _build_tmpl(mpr_msg_tmpl tmpl, const char *path, int len, const mpr_type *types,
+                        int has_GID, int slot_id)
+{
+    int i, path_size, tag_size, num_tags = 0, size = 0;
+    char *tags;
+
+    for (i = 0; i < len; i++) {
+        if (!types || MPR_NULL == types[i])
+            ++num_tags;
+        else if (_get_osc_size(types[i])) {
+            size += _get_osc_size(types[i]);
+            ++num_tags;
+        }
+    }
+    path_size = (strlen(path) + 4) & ~3;
+    /* comma, value types, "@in" and "@sl" properties, and terminating null */
+    tag_size = (num_tags + (has_GID ? 2 : 0) + (slot_id >= 0 ? 2 : 0) + 5) & ~3;
+    size += path_size + tag_size + (has_GID ? 12 : 0) + (slot_id >= 0 ? 8 : 0);
+
+    if (size > tmpl->size) {
+        tmpl->data = realloc(tmpl->data, size);
+        tmpl->size = size;
+    }
+    if (len > tmpl->types_size) {
+        tmpl->types = realloc(tmpl->types, len * sizeof(mpr_type));
+        tmpl->types_size = len;
+    }
+    memset(tmpl->data, 0, size);
+    tmpl->len = size;
+    tmpl->num_types = len;
+    tmpl->slot = slot_id;
+
+    strcpy(tmpl->data, path);
+    tags = tmpl->data + path_size;
+    *tags++ = ',';
+    for (i = 0; i < len; i++) {
+        tmpl->types[i] = types ? types[i] : MPR_NULL;
+        if (MPR_NULL == tmpl->types[i] || _get_osc_size(tmpl->types[i]))
+            *tags++ = tmpl->types[i];
+    }
+    if (has_GID) {
+        *tags++ = MPR_STR;
+        *tags++ = MPR_INT64;
+    }
+    if (slot_id >= 0) {
+        *tags++ = MPR_STR;
+        *tags++ = MPR_INT32;
+    }
+
+    tmpl->vals = path_size + tag_size;
+    size = tmpl->len - (has_GID ? 12 : 0) - (slot_id >= 0 ? 8 : 0);
+    if (has_GID) {
+        memcpy(tmpl->data + size, "@in", 4);
+        tmpl->GID = size + 4;
+        size += 12;
+    }
+    else
+        tmpl->GID = 0;
+    if (slot_id >= 0) {
+        memcpy(tmpl->data + size, "@sl", 4);
+        mpr_osc_set_int32(tmpl->data + size + 4, slot_id);
+    }
+}
+
+/* Serialize an update into the link's send buffer using a message template. Returns zero if the
+ * link cannot send serialized messages. */
+static int _add_serialized_msg(mpr_local_map m, mpr_link link, mpr_sig dst, mpr_local_slot slot,
+                               const void *val, mpr_type *types, mpr_id_map idmap, mpr_time t,
+                               int idx)
+{
+    int i, len = _get_msg_len(m, slot), has_GID = m->use_inst && idmap, slot_id;
+    mpr_msg_tmpl tmpl = slot ? &slot->tmpl : &m->tmpl;
+    char *buf, *pos;
+    uint32_t u32;
+    uint64_t u64;
+
+    if (!(val && types)) {
+        val = 0;
+        types = 0;
+        if (!m->use_inst)
+            len = 0;
+    }
+    slot_id = slot ? slot->id : -1;
+    if (!_tmpl_matches(tmpl, dst->path, len, types, has_GID, slot_id))
+        _build_tmpl(tmpl, dst->path, len, types, has_GID, slot_id);
+    RETURN_ARG_UNLESS((buf = mpr_link_reserve_msg(link, tmpl->len, t, idx)), 0);
+
+    /* patch the values and instance id into the template */
+    pos = tmpl->data + tmpl->vals;
+    for (i = 0; val && i < len; i++) {
+        switch (types[i]) {
+            case MPR_INT32:
+            case MPR_FLT:
+                memcpy(&u32, (int*)val + i, 4);
+                mpr_osc_set_int32(pos, u32);
+                pos += 4;
+                break;
+            case MPR_DBL:
+                memcpy(&u64, (double*)val + i, 8);
+                mpr_osc_set_int64(pos, u64);
+                pos += 8;
+                break;
+            default:
+                break;
+        }
+    }
+    if (has_GID)
+        mpr_osc_set_int64(tmpl->data + tmpl->GID, idmap->GID);
+    memcpy(buf, tmpl->data, tmpl->len);
+    return 1;
+}
+
+void mpr_map_add_msg(mpr_local_map m, mpr_link link, mpr_sig dst, mpr_local_slot slot,
+                     const void *val, mpr_type *types, mpr_id_map idmap, mpr_time t, int idx)
+{
+    if (!link->is_local_only) {
+        lo_message msg;
+        int proto = (link->devs[0] == link->devs[1]) ? MPR_PROTO_UDP : m->protocol;
+        if (MPR_PROTO_UDP == proto && _add_serialized_msg(m, link, dst, slot, val, types, idmap,
+                                                          t, idx))
+            return;
+        msg = mpr_map_build_msg(m, slot, val, types, idmap);
+        mpr_link_add_msg(link, dst, msg, t, m->protocol, idx);
+        return;
+    }
+    /* a message without values or instance id would be ignored by the destination */
+    RETURN_UNLESS((val && types) || m->use_inst);
+    if (!(val && types))
+        val = 0;
+    mpr_link_add_local_msg(link, (mpr_local_sig)dst, val ? types : 0, _get_msg_len(m, slot), val,
+                           (m->use_inst && idmap) ? idmap->GID : 0, slot ? slot->id : -1, t, idx);
+}
+
 void mpr_map_alloc_values(mpr_local_map m)
 {
     /* TODO: check if this filters non-local processing.
@@ -802,7 +1017,7 @@ static int _replace_expr_str(mpr_local_map m, const char *expr_str)
         src_types[i] = m->src[i]->sig->type;
         src_lens[i] = m->src[i]->sig->len;
     }
-    expr = mpr_expr_new_from_str(m->rtr->dev->expr_stack, expr_str, m->num_src, src_types,
+    expr = mpr_expr_new_from_str(mpr_map_get_local_dev(m)->expr_stack, expr_str, m->num_src, src_types,
                                  src_lens, m->dst->sig->type, m->dst->sig->len);
     RETURN_ARG_UNLESS(expr, 1);
 
@@ -1111,7 +1326,7 @@ static int _set_expr(mpr_local_map m, const char *expr)
     RETURN_ARG_UNLESS(m->num_src > 0, 0);
 
     if (m->idmap)
-        mpr_dev_LID_decref(m->rtr->dev, 0, m->idmap);
+        mpr_dev_LID_decref(mpr_map_get_local_dev(m), 0, m->idmap);
 
     if (m->is_local_only)
         should_compile = 1;
@@ -1143,7 +1358,7 @@ static int _set_expr(mpr_local_map m, const char *expr)
         /* evaluate expression to intialise literals */
         mpr_time_set(&now, MPR_NOW);
         for (i = 0; i < m->num_inst; i++)
-            mpr_expr_eval(m->rtr->dev->expr_stack, m->expr, 0, &m->vars,
+            mpr_expr_eval(mpr_map_get_local_dev(m)->expr_stack, m->expr, 0, &m->vars,
                           &m->dst->val, &now, types, i);
     }
     else {
@@ -92,6 +92,14 @@ void mpr_net_remove_dev(mpr_net n, mpr_local_dev d);
 
 void mpr_net_poll(mpr_net n);
 
+double mpr_net_get_timeout(mpr_net n);
+
+/*! Lock all local devices while the graph is mutated, if any device uses a worker thread.
+ *  \return            1 if the devices were locked and must be unlocked afterwards. */
+int mpr_net_lock_devs(mpr_net n);
+
+void mpr_net_unlock_devs(mpr_net n);
+
 void mpr_net_init(mpr_net n, const char *iface, const char *group, int port);
 
 void mpr_net_use_bus(mpr_net n);
@@ -146,8 +154,43 @@ void mpr_dev_remove_link(mpr_dev dev, mpr_dev rem);
 int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc,
                     lo_message msg, void *data);
 
+/*! Apply a value update to a local signal or one of its mapping slots.
+ *  \param sig          The destination signal.
+ *  \param types        The type of each vector element, MPR_NULL for missing elements.
+ *  \param len          Length of the type vector.
+ *  \param val          Contiguous vector of values, or 0 for an instance release.
+ *  \param GID          Global id of the updated instance, or 0 if not instanced.
+ *  \param slot_idx     Id of the destination mapping slot, or -1 if none.
+ *  \return             Zero. */
+int mpr_dev_handle_update(mpr_local_sig sig, const mpr_type *types, int len, const void *val,
+                          mpr_id GID, int slot_idx);
+
 int mpr_dev_bundle_start(lo_timetag t, void *data);
 
+/*! Mark a map as updated and queue it for processing during the next device poll.
+ *  \param dev          The local device that will process the map.
+ *  \param map          The updated map.
+ *  \param dir          MPR_DIR_OUT for maps processed before sending, MPR_DIR_IN for maps
+ *                      processed at the destination. */
+void mpr_dev_queue_map(mpr_local_dev dev, mpr_local_map map, mpr_dir dir);
+
+/*! Add a signal to the device's stack of signals with updates from other threads. This function
+ *  is lock-free and may be called from any thread. */
+void mpr_dev_push_async_sig(mpr_local_dev dev, mpr_local_sig sig);
+
+/*! Remove a signal from the device's stack of signals with updates from other threads. Must be
+ *  called from the polling thread. */
+void mpr_dev_remove_async_sig(mpr_local_dev dev, mpr_local_sig sig);
+
+/*! Remove a map from the device worklist it is queued on, if any. */
+void mpr_dev_dequeue_map(mpr_local_map map);
+
+/*! Interrupt a blocking poll of a device. This function may be called from any thread. */
+void mpr_dev_wake(mpr_local_dev dev);
+
+/*! Inform device subscribers of changed device properties. */
+void mpr_dev_send_changed_state(mpr_local_dev dev);
+
 MPR_INLINE static void mpr_dev_LID_incref(mpr_local_dev dev, mpr_id_map map)
 {
     ++map->LID_refcount;
@@ -214,6 +257,9 @@ void mpr_graph_cleanup(mpr_graph g);
 
 void mpr_graph_housekeeping(mpr_graph g);
 
+/*! Poll the graph for administrative messages; the caller must hold net->admin_lock. */
+int mpr_graph_poll_admin(mpr_graph g, int block_ms);
+
 /***** Router *****/
 
 void mpr_rtr_remove_sig(mpr_rtr r, mpr_rtr_sig rs);
@@ -269,6 +315,12 @@ void mpr_sig_send_state(mpr_sig sig, net_msg_t cmd);
 
 void mpr_sig_send_removed(mpr_local_sig sig);
 
+/*! Route the updates that were pushed to a signal from other threads. Must be called from the
+ *  polling thread.
+ *  \param sig      The signal to process.
+ *  \return         The number of updates processed. */
+int mpr_sig_process_async(mpr_local_sig sig);
+
 /**** Instances ****/
 
 /*! Fetch a reserved (preallocated) signal instance using an instance id,
@@ -298,6 +350,16 @@ int mpr_sig_get_idmap_with_LID(mpr_local_sig sig, mpr_id LID, int flags, mpr_tim
  *                  strategy. */
 int mpr_sig_get_idmap_with_GID(mpr_local_sig sig, mpr_id GID, int flags, mpr_time t, int activate);
 
+/*! Find the instance id map currently associated with a signal instance.
+ *  \param sig      The signal owning the instance.
+ *  \param inst_idx The index of the instance.
+ *  \return         The index of the instance id map, or -1 if none. */
+int mpr_sig_get_idmap_with_inst_idx(mpr_local_sig sig, int inst_idx);
+
+/*! Rebuild the LID and GID lookup tables for a signal's instance id maps, e.g. after the
+ *  GIDs of its id maps have changed. */
+void mpr_sig_rehash_idmaps(mpr_local_sig sig);
+
 /*! Release a specific signal instance. */
 void mpr_sig_release_inst_internal(mpr_local_sig sig, int inst_idx);
 
@@ -318,9 +380,37 @@ void mpr_link_init(mpr_link link);
 void mpr_link_connect(mpr_link link, const char *host, int admin_port,
                       int data_port);
 void mpr_link_free(mpr_link link);
+/*! Send or dispatch the bundles queued on a link. Serialized UDP bundles are left in place to be
+ *  sent together with those of other links by mpr_link_send_bufs(). */
 int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx);
 void mpr_link_add_msg(mpr_link link, mpr_sig dst, lo_message msg, mpr_time t, mpr_proto proto, int idx);
 
+/*! Reserve space for a serialized message in the UDP send buffer of a link, starting a new bundle
+ *  if necessary. The buffer is reused between polls so steady-state sending does not allocate.
+ *  \param link         The link to send on.
+ *  \param size         The size of the serialized message in bytes.
+ *  \param t            The bundle timestamp.
+ *  \param idx          The bundle index.
+ *  \return             A pointer to the reserved space, or 0 if the link address could not be
+ *                      resolved and messages must be sent using liblo instead. */
+char *mpr_link_reserve_msg(mpr_link link, int size, mpr_time t, int idx);
+
+/*! Send the serialized UDP bundles of a set of links. Bundles sent from the same socket are
+ *  batched into a single sendmmsg() call where available.
+ *  \param links        The links with serialized bundles to send.
+ *  \param num          The number of links.
+ *  \param idx          The bundle index.
+ *  \return             The number of send calls saved by batching. */
+int mpr_link_send_bufs(mpr_link *links, int num, int idx);
+
+/*! Queue a typed update on a local-only link without building an OSC message.
+ *  Arguments correspond to those of mpr_dev_handle_update(). */
+void mpr_link_add_local_msg(mpr_link link, mpr_local_sig dst, const mpr_type *types, int len,
+                            const void *val, mpr_id GID, int slot_idx, mpr_time t, int idx);
+
+/*! Drop any updates for a signal that are queued on a local-only link. */
+void mpr_link_remove_local_msgs(mpr_link link, mpr_local_sig sig);
+
 mpr_link mpr_graph_add_link(mpr_graph g, mpr_dev dev1, mpr_dev dev2);
 
 int mpr_link_get_is_local(mpr_link link);
@@ -340,6 +430,11 @@ void mpr_map_receive(mpr_local_map map, mpr_time time);
 lo_message mpr_map_build_msg(mpr_local_map map, mpr_local_slot slot, const void *val,
                              mpr_type *types, mpr_id_map idmap);
 
+/*! Queue a value update for a map on a link. Updates on local-only links are passed to the
+ *  destination signal directly instead of being serialized as OSC messages. */
+void mpr_map_add_msg(mpr_local_map map, mpr_link link, mpr_sig dst, mpr_local_slot slot,
+                     const void *val, mpr_type *types, mpr_id_map idmap, mpr_time t, int idx);
+
 /*! Set a mapping's properties based on message parameters. */
 int mpr_map_set_from_msg(mpr_map map, mpr_msg msg, int override);
 
@@ -357,6 +452,14 @@ void mpr_map_init(mpr_map map);
 
 void mpr_map_free(mpr_map map);
 
+/*! Return the local device that evaluates a map: the source device for outgoing and local-only
+ *  maps, otherwise the destination device. */
+mpr_local_dev mpr_map_get_local_dev(mpr_local_map map);
+
+/*! Evaluate the updated instances of an outgoing map and keep the results for the next call to
+ *  mpr_map_send(). Maps with distinct expression stacks may be evaluated concurrently. */
+void mpr_map_eval(mpr_local_map map, mpr_expr_stack stk, mpr_time time);
+
 /**** Slot ****/
 
 mpr_slot mpr_slot_new(mpr_map map, mpr_sig sig, unsigned char is_local, unsigned char is_src);
@@ -502,13 +605,39 @@ void printexpr(const char*, mpr_expr);
 int mpr_expr_eval(mpr_expr_stack stk, mpr_expr expr, mpr_value *srcs, mpr_value *expr_vars,
                   mpr_value result, mpr_time *t, mpr_type *types, int inst_idx);
 
+/*! Evaluate the given inputs for several instances at once. Instances that can use the
+ *  compiled form of the expression are evaluated together, one instruction at a time across
+ *  all of them; the others are evaluated individually using mpr_expr_eval().
+ *  \param stk          A preallocated expression eval stack.
+ *  \param expr         The expression to use.
+ *  \param srcs         An array of mpr_value structures for sources.
+ *  \param expr_vars    An array of mpr_value structures for user variables.
+ *  \param result       A mpr_value structure for the destination.
+ *  \param t            A pointer to a timetag structure for storing the time
+ *                      associated with the result.
+ *  \param types        An array of mpr_type for storing the output type per vector element,
+ *                      with room for the full output vector of each instance index.
+ *  \param status       An array for storing the evaluation status of each instance index.
+ *  \param inst_idx     Indices of the instances being updated.
+ *  \param num_inst     The number of instances being updated.
+ *  \result             The bitwise OR of the evaluation status of all instances. */
+int mpr_expr_eval_batch(mpr_expr_stack stk, mpr_expr expr, mpr_value *srcs, mpr_value *expr_vars,
+                        mpr_value result, mpr_time *t, mpr_type *types, int *status,
+                        const int *inst_idx, int num_inst);
+
 int mpr_expr_get_num_input_slots(mpr_expr expr);
 
+/*! Return the number of tokens in an expression, either after optimization or as parsed. */
+int mpr_expr_get_num_tokens(mpr_expr expr, int optimized);
+
 void mpr_expr_free(mpr_expr expr);
 
 mpr_expr_stack mpr_expr_stack_new();
 void mpr_expr_stack_free(mpr_expr_stack stk);
 
+/*! Grow an evaluation stack if necessary so that it can be used to evaluate an expression. */
+void mpr_expr_stack_reserve(mpr_expr_stack stk, mpr_expr expr);
+
 /**** String tables ****/
 
 /*! Create a new string table. */
@@ -600,6 +729,10 @@ mpr_list mpr_list_start(mpr_list list);
 /*! Get the current time. */
 double mpr_get_current_time(void);
 
+/*! Get the time in seconds from a clock that is not affected by changes to the system clock, for
+ *  measuring intervals. Falls back to mpr_get_current_time() where no such clock is available. */
+double mpr_get_monotonic_time(void);
+
 /*! Return the difference in seconds between two mpr_times.
  *  \param minuend      The minuend.
  *  \param subtrahend   The subtrahend.
@@ -653,6 +786,12 @@ int mpr_value_remove_inst(mpr_value v, int idx);
 
 void mpr_value_set_samp(mpr_value v, int idx, void *s, mpr_time t);
 
+/*! Return the running aggregates of the current values of the active instances, starting to
+ *  keep them if necessary. Floating point sums are recomputed once per instance count updates
+ *  to stop rounding errors from accumulating, and the extremes are recomputed after the
+ *  instance holding one of them moves away from it. */
+mpr_value_agg mpr_value_get_agg(mpr_value v);
+
 /*! Helper to find the pointer to the current value in a mpr_value_t. */
 MPR_INLINE static void* mpr_value_get_samp(mpr_value v, int idx)
 {
@@ -660,12 +799,17 @@ MPR_INLINE static void* mpr_value_get_samp(mpr_value v, int idx)
     return (char*)b->samps + b->pos * v->vlen * mpr_type_get_size(v->type);
 }
 
+/*! Helper to find the position of a history sample relative to 'pos'. History sizes are powers
+ *  of two so negative offsets wrap with a mask. */
+MPR_INLINE static int mpr_value_hist_pos(mpr_value v, int pos, int hist_idx)
+{
+    return (pos + hist_idx) & (v->mlen - 1);
+}
+
 MPR_INLINE static void* mpr_value_get_samp_hist(mpr_value v, int inst_idx, int hist_idx)
 {
     mpr_value_buffer b = &v->inst[inst_idx % v->num_inst];
-    int idx = (b->pos + v->mlen + hist_idx) % v->mlen;
-    if (idx < 0)
-        idx += v->mlen;
+    int idx = mpr_value_hist_pos(v, b->pos, hist_idx);
     return (char*)b->samps + idx * v->vlen * mpr_type_get_size(v->type);
 }
 
@@ -679,10 +823,7 @@ MPR_INLINE static mpr_time* mpr_value_get_time(mpr_value v, int idx)
 MPR_INLINE static mpr_time* mpr_value_get_time_hist(mpr_value v, int inst_idx, int hist_idx)
 {
     mpr_value_buffer b = &v->inst[inst_idx % v->num_inst];
-    int idx = (b->pos + v->mlen + hist_idx) % v->mlen;
-    if (idx < 0)
-        idx += v->mlen;
-    return &b->times[idx];
+    return &b->times[mpr_value_hist_pos(v, b->pos, hist_idx)];
 }
 
 void mpr_value_free(mpr_value v);
@@ -704,6 +845,184 @@ MPR_INLINE static int check_sig_length(int length)
     return (length < 1 || length > MPR_MAX_VECTOR_LEN);
 }
 
+/*! Helper to hash 64-bit ids for hash table lookups. */
+MPR_INLINE static unsigned int mpr_id_hash(mpr_id id)
+{
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    return (unsigned int)id;
+}
+
+/*! Helpers to write big-endian OSC arguments into a serialized message. */
+MPR_INLINE static void mpr_osc_set_int32(char *dst, uint32_t val)
+{
+    val = htonl(val);
+    memcpy(dst, &val, 4);
+}
+
+MPR_INLINE static void mpr_osc_set_int64(char *dst, uint64_t val)
+{
+    mpr_osc_set_int32(dst, (uint32_t)(val >> 32));
+    mpr_osc_set_int32(dst + 4, (uint32_t)val);
+}
+
+/* Atomic helpers for the lock-free queues used by updates from other threads. Loads acquire and
+ * stores release so that data written before publishing an index or pointer is visible. */
+#ifdef _MSC_VER
+#include <intrin.h>
+MPR_INLINE static unsigned int mpr_atomic_load(volatile unsigned int *p)
+{
+    unsigned int v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+MPR_INLINE static void mpr_atomic_store(volatile unsigned int *p, unsigned int v)
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+MPR_INLINE static int mpr_atomic_cas(volatile unsigned int *p, unsigned int exp, unsigned int des)
+{
+    return (unsigned int)_InterlockedCompareExchange((volatile long*)p, des, exp) == exp;
+}
+
+MPR_INLINE static int mpr_atomic_xchg_int(volatile int *p, int v)
+{
+    return _InterlockedExchange((volatile long*)p, v);
+}
+
+MPR_INLINE static unsigned int mpr_atomic_fetch_add(volatile unsigned int *p, unsigned int v)
+{
+    return _InterlockedExchangeAdd((volatile long*)p, v);
+}
+
+MPR_INLINE static void *mpr_atomic_load_ptr(void * volatile *p)
+{
+    void *v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+MPR_INLINE static int mpr_atomic_cas_ptr(void * volatile *p, void *exp, void *des)
+{
+    return _InterlockedCompareExchangePointer(p, des, exp) == exp;
+}
+
+MPR_INLINE static void *mpr_atomic_xchg_ptr(void * volatile *p, void *v)
+{
+    return _InterlockedExchangePointer(p, v);
+}
+#else
+MPR_INLINE static unsigned int mpr_atomic_load(volatile unsigned int *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+MPR_INLINE static void mpr_atomic_store(volatile unsigned int *p, unsigned int v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+MPR_INLINE static int mpr_atomic_cas(volatile unsigned int *p, unsigned int exp, unsigned int des)
+{
+    return __atomic_compare_exchange_n(p, &exp, des, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+MPR_INLINE static int mpr_atomic_xchg_int(volatile int *p, int v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+
+MPR_INLINE static unsigned int mpr_atomic_fetch_add(volatile unsigned int *p, unsigned int v)
+{
+    return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+}
+
+MPR_INLINE static void *mpr_atomic_load_ptr(void * volatile *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+MPR_INLINE static int mpr_atomic_cas_ptr(void * volatile *p, void *exp, void *des)
+{
+    return __atomic_compare_exchange_n(p, &exp, des, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+MPR_INLINE static void *mpr_atomic_xchg_ptr(void * volatile *p, void *v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+#endif
+
+/* Mutex helpers; trylock returns 1 if the lock was acquired. */
+#ifdef HAVE_LIBPTHREAD
+#define mpr_mutex_init(m)       pthread_mutex_init(m, NULL)
+#define mpr_mutex_free(m)       pthread_mutex_destroy(m)
+#define mpr_mutex_lock(m)       pthread_mutex_lock(m)
+#define mpr_mutex_trylock(m)    (0 == pthread_mutex_trylock(m))
+#define mpr_mutex_unlock(m)     pthread_mutex_unlock(m)
+#else
+#ifdef HAVE_WIN32_THREADS
+#define mpr_mutex_init(m)       InitializeCriticalSection(m)
+#define mpr_mutex_free(m)       DeleteCriticalSection(m)
+#define mpr_mutex_lock(m)       EnterCriticalSection(m)
+#define mpr_mutex_trylock(m)    (0 != TryEnterCriticalSection(m))
+#define mpr_mutex_unlock(m)     LeaveCriticalSection(m)
+#else
+#define mpr_mutex_init(m)
+#define mpr_mutex_free(m)
+#define mpr_mutex_lock(m)
+#define mpr_mutex_trylock(m)    1
+#define mpr_mutex_unlock(m)
+#endif
+#endif
+
+/* Hint to the processor that the caller is spinning, and give up the rest of the time slice. */
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#define mpr_cpu_pause()         _mm_pause()
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define mpr_cpu_pause()         __asm__ __volatile__("yield")
+#else
+#define mpr_cpu_pause()
+#endif
+
+#ifdef HAVE_LIBPTHREAD
+#include <sched.h>
+#define mpr_thread_yield()      sched_yield()
+#elif defined(HAVE_WIN32_THREADS)
+#define mpr_thread_yield()      SwitchToThread()
+#else
+#define mpr_thread_yield()
+#endif
+
+#define MPR_SPIN_LIMIT 100
+
+/* Spin lock for short critical sections. Waiters only read the lock while it is held, pausing
+ * between reads, and yield after MPR_SPIN_LIMIT reads so that a preempted holder can run. */
+MPR_INLINE static void mpr_spin_lock(volatile unsigned int *lock)
+{
+    int spins = 0;
+    while (!mpr_atomic_cas(lock, 0, 1)) {
+        while (mpr_atomic_load(lock)) {
+            if (++spins < MPR_SPIN_LIMIT)
+                mpr_cpu_pause();
+            else {
+                mpr_thread_yield();
+                spins = 0;
+            }
+        }
+    }
+}
+
+MPR_INLINE static void mpr_spin_unlock(volatile unsigned int *lock)
+{
+    mpr_atomic_store(lock, 0);
+}
+
 /*! Helper to check if bitfields match completely. */
 MPR_INLINE static int bitmatch(unsigned int a, unsigned int b)
 {
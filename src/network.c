@@ -573,6 +573,7 @@ void mpr_net_free(mpr_net net)
     FUNC_IF(lo_address_free, net->addr.bus);
     FUNC_IF(free, net->addr.url);
     FUNC_IF(free, net->rtr);
+    FUNC_IF(free, net->recv_buf);
 }
 
 /*! Probe the network to see if a device's proposed name.ordinal is available. */
@@ -785,8 +786,12 @@ void mpr_net_poll(mpr_net net)
                 mpr_net_send(&dev->obj.graph->net);
             }
         }
-        else
+        else {
             ++registered;
+            /* worker threads leave bus messages to the control thread */
+            if (dev->is_worker)
+                mpr_dev_send_changed_state(dev);
+        }
     }
     if (registered) {
         /* Send out clock sync messages occasionally */
@@ -795,6 +800,66 @@ void mpr_net_poll(mpr_net net)
     return;
 }
 
+int mpr_net_lock_devs(mpr_net net)
+{
+    int i;
+    RETURN_ARG_UNLESS(net->num_workers, 0);
+    /* always lock in the same order; worker threads only ever try to lock a second device */
+    for (i = 0; i < net->num_devs; i++)
+        mpr_mutex_lock(&net->devs[i]->lock);
+    return 1;
+}
+
+void mpr_net_unlock_devs(mpr_net net)
+{
+    int i;
+    for (i = net->num_devs - 1; i >= 0; i--)
+        mpr_mutex_unlock(&net->devs[i]->lock);
+}
+
+/*! Return the number of seconds until mpr_net_poll() next has timed work to do. */
+double mpr_net_get_timeout(mpr_net net)
+{
+    int i, registered = 0;
+    double now, current_time, timeout;
+    mpr_time t;
+
+    /* cached messages are sent at the start of mpr_net_poll() */
+    RETURN_ARG_UNLESS(!net->bundle, 0);
+
+    mpr_time_set(&t, MPR_NOW);
+    now = mpr_time_as_dbl(t);
+
+    /* staged map cleanup and subscriber sync */
+    timeout = (double)(net->next_sub_ping + 1) - now;
+    RETURN_ARG_UNLESS(net->num_devs, timeout);
+
+    /* collision timing uses the system clock rather than NTP time */
+    current_time = mpr_get_current_time();
+    for (i = 0; i < net->num_devs; i++) {
+        mpr_allocated resource = &net->devs[i]->ordinal_allocator;
+        double wait;
+        if (net->devs[i]->registered) {
+            ++registered;
+            continue;
+        }
+        if (resource->locked)
+            return 0;
+        if (!resource->online)
+            wait = 5.0;
+        else if (resource->collision_count < 2)
+            wait = 2.0;
+        else
+            wait = 0.5;
+        wait += resource->count_time - current_time;
+        if (wait < timeout)
+            timeout = wait;
+    }
+    if (registered && (double)net->next_bus_ping - now < timeout)
+        timeout = (double)net->next_bus_ping - now;
+    return timeout > 0 ? timeout : 0;
+}
+
 /*! Algorithm for checking collisions and allocating resources. */
 static int check_collisions(mpr_net net, mpr_allocated resource)
 {
@@ -23,12 +23,10 @@ static int _is_map_in_scope(mpr_local_map map, mpr_id id)
     return 0;
 }
 
-static mpr_rtr_sig _find_rtr_sig(mpr_rtr rtr, mpr_local_sig sig)
+MPR_INLINE static mpr_rtr_sig _find_rtr_sig(mpr_rtr rtr, mpr_local_sig sig)
 {
-    mpr_rtr_sig rs = rtr->sigs;
-    while (rs && rs->sig != sig)
-        rs = rs->next;
-    return rs;
+    /* signals keep a pointer to their own router entry */
+    return sig->rsig;
 }
 
 void mpr_rtr_remove_inst(mpr_rtr rtr, mpr_local_sig sig, int inst_idx) {
@@ -104,15 +102,15 @@ static void _update_map_count(mpr_rtr rtr)
 void mpr_rtr_process_sig(mpr_rtr rtr, mpr_local_sig sig, int idmap_idx, const void *val, mpr_time t)
 {
     mpr_id_map idmap;
-    lo_message msg;
     mpr_rtr_sig rs;
     mpr_local_map map;
+    mpr_local_dev dev = sig->dev;
     int i, j, inst_idx;
     uint8_t bundle_idx, *lock;
 
     /* abort if signal is already being processed - might be a local loop */
     if (sig->locked) {
-        trace_dev(rtr->dev, "Mapping loop detected on signal %s! (1)\n", sig->name);
+        trace_dev(dev, "Mapping loop detected on signal %s! (1)\n", sig->name);
         return;
     }
     idmap = sig->idmaps[idmap_idx].map;
@@ -122,9 +120,9 @@ void mpr_rtr_process_sig(mpr_rtr rtr, mpr_local_sig sig, int idmap_idx, const vo
     RETURN_UNLESS(rs);
 
     inst_idx = sig->idmaps[idmap_idx].inst->idx;
-    bundle_idx = rtr->dev->bundle_idx % NUM_BUNDLES;
+    bundle_idx = dev->bundle_idx % NUM_BUNDLES;
     /* TODO: remove duplicate flag set */
-    rtr->dev->sending = 1; /* mark as updated */
+    dev->sending = 1; /* mark as updated */
     lock = &sig->locked;
     *lock = 1;
 
@@ -160,10 +158,8 @@ void mpr_rtr_process_sig(mpr_rtr rtr, mpr_local_sig sig, int idmap_idx, const vo
                 if (sig->idmaps[idmap_idx].status & RELEASED_REMOTELY)
                     continue;
 
-                if (slot->dir == MPR_DIR_IN) {
-                    msg = mpr_map_build_msg(map, slot, 0, 0, idmap);
-                    mpr_link_add_msg(slot->link, slot->sig, msg, t, map->protocol, bundle_idx);
-                }
+                if (slot->dir == MPR_DIR_IN)
+                    mpr_map_add_msg(map, slot->link, slot->sig, slot, 0, 0, idmap, t, bundle_idx);
             }
 
             if (!map->use_inst)
@@ -173,14 +169,9 @@ void mpr_rtr_process_sig(mpr_rtr rtr, mpr_local_sig sig, int idmap_idx, const vo
             mpr_value_reset_inst(&dst_slot->val, inst_idx);
 
             /* send release to downstream */
-            if (slot->dir == MPR_DIR_OUT) {
-                msg = 0;
-                if (in_scope) {
-                    msg = mpr_map_build_msg(map, slot, 0, 0, idmap);
-                    mpr_link_add_msg(dst_slot->link, dst_slot->sig, msg, t, map->protocol,
-                                     bundle_idx);
-                }
-            }
+            if (slot->dir == MPR_DIR_OUT && in_scope)
+                mpr_map_add_msg(map, dst_slot->link, dst_slot->sig, slot, 0, 0, idmap, t,
+                                bundle_idx);
         }
         *lock = 0;
         return;
@@ -213,8 +204,8 @@ void mpr_rtr_process_sig(mpr_rtr rtr, mpr_local_sig sig, int idmap_idx, const vo
             /* bypass map processing and bundle value without type coercion */
             char *types = alloca(sig->len * sizeof(char));
             memset(types, sig->type, sig->len);
-            msg = mpr_map_build_msg(map, slot, val, types, sig->use_inst ? idmap : 0);
-            mpr_link_add_msg(map->dst->link, map->dst->sig, msg, t, map->protocol, bundle_idx);
+            mpr_map_add_msg(map, map->dst->link, map->dst->sig, slot, val, types,
+                            sig->use_inst ? idmap : 0, t, bundle_idx);
             continue;
         }
 
@@ -244,7 +235,7 @@ void mpr_rtr_process_sig(mpr_rtr rtr, mpr_local_sig sig, int idmap_idx, const vo
                 continue;
             inst_idx = idmaps[idmap_idx].inst->idx;
             set_bitflag(map->updated_inst, inst_idx);
-            map->updated = 1;
+            mpr_dev_queue_map(dev, map, MPR_DIR_OUT);
             if (!all)
                 break;
         }
@@ -265,7 +256,10 @@ static mpr_rtr_sig _add_rtr_sig(mpr_rtr rtr, mpr_local_sig sig)
         rs->slots = malloc(sizeof(mpr_local_slot));
         rs->slots[0] = 0;
         rs->next = rtr->sigs;
+        if (rs->next)
+            rs->next->prev = rs;
         rtr->sigs = rs;
+        sig->rsig = rs;
     }
     return rs;
 }
@@ -456,16 +450,16 @@ void mpr_rtr_remove_sig(mpr_rtr rtr, mpr_rtr_sig rs)
 {
     if (rtr && rs) {
         /* No maps remaining – we can remove the rtr_sig also */
-        mpr_rtr_sig *rstemp = &rtr->sigs;
-        while (*rstemp) {
-            if (*rstemp == rs) {
-                *rstemp = rs->next;
-                free(rs->slots);
-                free(rs);
-                break;
-            }
-            rstemp = &(*rstemp)->next;
-        }
+        if (rs->prev)
+            rs->prev->next = rs->next;
+        else
+            rtr->sigs = rs->next;
+        if (rs->next)
+            rs->next->prev = rs->prev;
+        if (rs->sig)
+            rs->sig->rsig = 0;
+        free(rs->slots);
+        free(rs);
     }
 }
 
@@ -478,17 +472,20 @@ int mpr_rtr_remove_map(mpr_rtr rtr, mpr_local_map map)
     RETURN_ARG_UNLESS(map, 1);
     mpr_time_set(&t, MPR_NOW);
 
+    mpr_dev_dequeue_map(map);
+
     if (map->idmap) {
         /* release map-generated instances */
-        if (map->dst->rsig) {
-            lo_message msg = mpr_map_build_msg(map, 0, 0, 0, map->idmap);
-            mpr_dev_bundle_start(t, NULL);
-            mpr_dev_handler(NULL, lo_message_get_types(msg), lo_message_get_argv(msg),
-                            lo_message_get_argc(msg), msg, (void*)map->dst->sig);
-            lo_message_free(msg);
+        if (map->dst->rsig && map->use_inst) {
+            int len = MPR_LOC_SRC == map->process_loc ? map->dst->sig->len : 0;
+            mpr_type *types = alloca(len * sizeof(mpr_type));
+            memset(types, MPR_NULL, len);
+            mpr_dev_bundle_start(t, map->dst->sig->dev);
+            mpr_dev_handle_update((mpr_local_sig)map->dst->sig, types, len, 0,
+                                  map->idmap->GID, -1);
         }
         if (map->dst->dir == MPR_DIR_OUT || map->is_local_only)
-            mpr_dev_LID_decref(rtr->dev, 0, map->idmap);
+            mpr_dev_LID_decref(mpr_map_get_local_dev(map), 0, map->idmap);
     }
 
     /* remove map and slots from rtr_sig lists if necessary */
@@ -503,17 +500,17 @@ int mpr_rtr_remove_map(mpr_rtr rtr, mpr_local_map map)
             if (!maps[i].map)
                 continue;
             if (maps[i].status & RELEASED_LOCALLY) {
-                mpr_dev_GID_decref(rtr->dev, sig->group, maps[i].map);
+                mpr_dev_GID_decref(sig->dev, sig->group, maps[i].map);
                 maps[i].map = 0;
             }
             else {
                 maps[i].status |= RELEASED_REMOTELY;
-                mpr_dev_GID_decref(rtr->dev, sig->group, maps[i].map);
+                mpr_dev_GID_decref(sig->dev, sig->group, maps[i].map);
                 if (sig->use_inst) {
                     mpr_sig_call_handler(sig, MPR_SIG_REL_UPSTRM, maps[i].map->LID, 0, 0, &t, 0);
                 }
                 else {
-                    mpr_dev_LID_decref(rtr->dev, sig->group, maps[i].map);
+                    mpr_dev_LID_decref(sig->dev, sig->group, maps[i].map);
                     maps[i].map = 0;
                 }
             }
@@ -591,7 +588,6 @@ int mpr_rtr_loop_check(mpr_rtr rtr, mpr_local_sig sig, int num_remotes, const ch
     return 0;
 }
 
-/* TODO: speed this up with sorted slots and binary search */
 mpr_local_slot mpr_rtr_get_slot(mpr_rtr rtr, mpr_local_sig sig, int slot_id)
 {
     int i, j;
@@ -11,6 +11,7 @@
 
 #define MAX_INST 128
 #define BUFFSIZE 512
+#define ASYNC_QUEUE_SIZE 64 /* must be a power of two */
 
 /* TODO: MPR_DEFAULT_INST is actually a valid id - we should use
  * another method for distinguishing non-instanced updates. */
@@ -18,6 +19,9 @@
 
 /* Function prototypes */
 static int _init_and_add_idmap(mpr_local_sig lsig, mpr_sig_inst si, mpr_id_map map);
+static void _unlink_inst_idmap(mpr_local_sig lsig, int idmap_idx);
+static int _find_idmap_with_LID(mpr_local_sig lsig, mpr_id LID);
+static int _find_idmap_with_GID(mpr_local_sig lsig, mpr_id GID);
 
 static int _compare_inst_ids(const void *l, const void *r)
 {
@@ -121,6 +125,9 @@ void mpr_sig_init(mpr_sig sig, mpr_dir dir, const char *name, int len, mpr_type
         /* Reserve one instance id map */
         lsig->idmap_len = 1;
         lsig->idmaps = calloc(1, sizeof(struct _mpr_sig_idmap));
+
+        /* the queue for updates from other threads is allocated when first used */
+        lsig->async.mask = ASYNC_QUEUE_SIZE - 1;
     }
     else {
         sig->num_inst = 1;
@@ -193,6 +200,7 @@ void mpr_sig_free(mpr_sig sig)
     mpr_local_sig lsig = (mpr_local_sig)sig;
     mpr_rtr rtr;
     mpr_rtr_sig rs;
+    mpr_list links;
     RETURN_UNLESS(sig && sig->is_local);
     ldev = (mpr_local_dev)sig->dev;
 
@@ -204,14 +212,14 @@ void mpr_sig_free(mpr_sig sig)
         }
     }
 
+    /* discard any updates from other threads */
+    mpr_dev_remove_async_sig(ldev, lsig);
+
     /* release associated OSC methods */
     mpr_dev_remove_sig_methods(ldev, lsig);
     net = &sig->obj.graph->net;
     rtr = net->rtr;
-    rs = rtr->sigs;
-    while (rs && rs->sig != lsig)
-        rs = rs->next;
-    if (rs) {
+    if ((rs = lsig->rsig)) {
         mpr_local_map map;
         /* need to unmap */
         for (i = 0; i < rs->num_slots; i++) {
@@ -223,6 +231,16 @@ void mpr_sig_free(mpr_sig sig)
         }
         mpr_rtr_remove_sig(rtr, rs);
     }
+
+    /* drop any updates for this signal that are still queued on local-only links */
+    links = mpr_dev_get_links((mpr_dev)ldev, MPR_DIR_ANY);
+    while (links) {
+        mpr_link link = (mpr_link)*links;
+        links = mpr_list_get_next(links);
+        if (link->is_local_only)
+            mpr_link_remove_local_msgs(link, lsig);
+    }
+
     if (ldev->registered) {
         /* Notify subscribers */
         int dir = (sig->dir == MPR_DIR_IN) ? MPR_SIG_IN : MPR_SIG_OUT;
@@ -245,6 +263,10 @@ void mpr_sig_free_internal(mpr_sig sig)
                 mpr_sig_release_inst_internal(lsig, i);
         }
         free(lsig->idmaps);
+        FUNC_IF(free, lsig->inst_idmap);
+        FUNC_IF(free, lsig->idmap_tbl.LID);
+        FUNC_IF(free, lsig->idmap_tbl.GID);
+        FUNC_IF(free, lsig->async.cells);
         for (i = 0; i < lsig->num_inst; i++) {
             FUNC_IF(free, lsig->inst[i]->val);
             FUNC_IF(free, lsig->inst[i]->has_val_flags);
@@ -323,28 +345,43 @@ done:
     return si;
 }
 
+/* Active instances are kept in a list ordered by activation time, so the oldest and newest
+ * instances can be found without comparing timestamps. */
+static void _link_active_inst(mpr_local_sig lsig, mpr_sig_inst si)
+{
+    si->prev = lsig->newest;
+    si->next = 0;
+    if (lsig->newest)
+        lsig->newest->next = si;
+    else
+        lsig->oldest = si;
+    lsig->newest = si;
+}
+
+static void _unlink_active_inst(mpr_local_sig lsig, mpr_sig_inst si)
+{
+    if (si->prev)
+        si->prev->next = si->next;
+    else if (lsig->oldest == si)
+        lsig->oldest = si->next;
+    else
+        return;
+    if (si->next)
+        si->next->prev = si->prev;
+    else
+        lsig->newest = si->prev;
+    si->prev = si->next = 0;
+}
+
 int _oldest_inst(mpr_local_sig lsig)
 {
-    int i, oldest;
     mpr_sig_inst si;
-    for (i = 0; i < lsig->idmap_len; i++) {
-        if (lsig->idmaps[i].inst)
-            break;
+    for (si = lsig->oldest; si; si = si->next) {
+        if (lsig->inst_idmap[si->idx] >= 0)
+            return lsig->inst_idmap[si->idx];
     }
-    if (i == lsig->idmap_len) {
-        /* no active instances to steal! */
-        return -1;
-    }
-    oldest = i;
-    for (i = oldest+1; i < lsig->idmap_len; i++) {
-        if (!(si = lsig->idmaps[i].inst))
-            continue;
-        if ((si->created.sec < lsig->idmaps[oldest].inst->created.sec) ||
-            (si->created.sec == lsig->idmaps[oldest].inst->created.sec &&
-             si->created.frac < lsig->idmaps[oldest].inst->created.frac))
-            oldest = i;
-    }
-    return oldest;
+    /* no active instances to steal! */
+    return -1;
 }
 
 mpr_id mpr_sig_get_oldest_inst_id(mpr_sig sig)
@@ -359,26 +396,13 @@ mpr_id mpr_sig_get_oldest_inst_id(mpr_sig sig)
 
 int _newest_inst(mpr_local_sig lsig)
 {
-    int i, newest;
     mpr_sig_inst si;
-    for (i = 0; i < lsig->idmap_len; i++) {
-        if (lsig->idmaps[i].inst)
-            break;
+    for (si = lsig->newest; si; si = si->prev) {
+        if (lsig->inst_idmap[si->idx] >= 0)
+            return lsig->inst_idmap[si->idx];
     }
-    if (i == lsig->idmap_len) {
-        /* no active instances to steal! */
-        return -1;
-    }
-    newest = i;
-    for (i = newest + 1; i < lsig->idmap_len; i++) {
-        if (!(si = lsig->idmaps[i].inst))
-            continue;
-        if ((si->created.sec > lsig->idmaps[newest].inst->created.sec) ||
-            (si->created.sec == lsig->idmaps[newest].inst->created.sec &&
-             si->created.frac > lsig->idmaps[newest].inst->created.frac))
-            newest = i;
-    }
-    return newest;
+    /* no active instances to steal! */
+    return -1;
 }
 
 mpr_id mpr_sig_get_newest_inst_id(mpr_sig sig)
@@ -402,10 +426,8 @@ int mpr_sig_get_idmap_with_LID(mpr_local_sig lsig, mpr_id LID, int flags, mpr_ti
         LID = MPR_DEFAULT_INST;
     maps = lsig->idmaps;
     h = (mpr_sig_handler*)lsig->handler;
-    for (i = 0; i < lsig->idmap_len; i++) {
-        if (maps[i].inst && maps[i].map && maps[i].map->LID == LID)
-            return (maps[i].status & ~flags) ? -1 : i;
-    }
+    if ((i = _find_idmap_with_LID(lsig, LID)) >= 0)
+        return (maps[i].status & ~flags) ? -1 : i;
     RETURN_ARG_UNLESS(activate, -1);
 
     /* check if device has record of id map */
@@ -475,10 +497,8 @@ int mpr_sig_get_idmap_with_GID(mpr_local_sig lsig, mpr_id GID, int flags, mpr_ti
     int i;
     maps = lsig->idmaps;
     h = (mpr_sig_handler*)lsig->handler;
-    for (i = 0; i < lsig->idmap_len; i++) {
-        if (maps[i].map && maps[i].map->GID == GID)
-            return (maps[i].status & ~flags) ? -1 : i;
-    }
+    if ((i = _find_idmap_with_GID(lsig, GID)) >= 0)
+        return (maps[i].status & ~flags) ? -1 : i;
     RETURN_ARG_UNLESS(activate, -1);
 
     /* check if the device already has a map for this global id */
@@ -577,6 +597,8 @@ static int _reserve_inst(mpr_local_sig lsig, mpr_id *id, void *data)
 
     /* reallocate array of instances */
     lsig->inst = realloc(lsig->inst, sizeof(mpr_sig_inst) * (lsig->num_inst + 1));
+    lsig->inst_idmap = realloc(lsig->inst_idmap, sizeof(int) * (lsig->num_inst + 1));
+    lsig->inst_idmap[lsig->num_inst] = -1;
     lsig->inst[lsig->num_inst] = (mpr_sig_inst) calloc(1, sizeof(struct _mpr_sig_inst));
     si = lsig->inst[lsig->num_inst];
     si->val = calloc(1, mpr_sig_get_vector_bytes((mpr_sig)lsig));
@@ -725,47 +747,40 @@ done:
     FUNC_IF(lo_address_free, addr);
 }
 
-void mpr_sig_set_value(mpr_sig sig, mpr_id id, int len, mpr_type type, const void *val)
+/* Check that a value can be used to update a local signal. */
+static int _check_value(mpr_local_sig lsig, int len, mpr_type type, const void *val)
 {
-    mpr_time time;
-    int idmap_idx;
-    mpr_local_sig lsig = (mpr_local_sig)sig;
-    mpr_sig_inst si;
-    RETURN_UNLESS(sig);
-    if (!sig->is_local) {
-        _mpr_remote_sig_set_value(sig, len, type, val);
-        return;
-    }
-    if (!len || !val) {
-        mpr_sig_release_inst(sig, id);
-        return;
-    }
+    int i;
     if (!mpr_type_get_is_num(type)) {
 #ifdef DEBUG
         trace("called update on signal '%s' with non-number type '%c'\n", lsig->name, type);
 #endif
-        return;
+        return 0;
     }
     if (len && (len != lsig->len)) {
 #ifdef DEBUG
         trace("called update on signal '%s' with value length %d (should be %d)\n",
               lsig->name, len, lsig->len);
 #endif
-        return;
+        return 0;
     }
-    if (type != MPR_INT32) {
-        /* check for NaN */
-        int i;
-        if (type == MPR_FLT) {
-            for (i = 0; i < len; i++)
-                RETURN_UNLESS(((float*)val)[i] == ((float*)val)[i]);
-        }
-        else if (type == MPR_DBL) {
-            for (i = 0; i < len; i++)
-                RETURN_UNLESS(((double*)val)[i] == ((double*)val)[i]);
-        }
+    /* check for NaN */
+    if (type == MPR_FLT) {
+        for (i = 0; i < len; i++)
+            RETURN_ARG_UNLESS(((float*)val)[i] == ((float*)val)[i], 0);
     }
-    time = mpr_dev_get_time(sig->dev);
+    else if (type == MPR_DBL) {
+        for (i = 0; i < len; i++)
+            RETURN_ARG_UNLESS(((double*)val)[i] == ((double*)val)[i], 0);
+    }
+    return 1;
+}
+
+static void _set_value(mpr_local_sig lsig, mpr_id id, mpr_type type, const void *val,
+                       mpr_time time)
+{
+    int idmap_idx;
+    mpr_sig_inst si;
     idmap_idx = mpr_sig_get_idmap_with_LID(lsig, id, 0, time, 1);
     RETURN_UNLESS(idmap_idx >= 0);
     si = lsig->idmaps[idmap_idx].inst;
@@ -778,7 +793,7 @@ void mpr_sig_set_value(mpr_sig sig, mpr_id id, int len, mpr_type type, const voi
     if (type != lsig->type)
         set_coerced_val(lsig->len, type, val, lsig->len, lsig->type, si->val);
     else
-        memcpy(si->val, (void*)val, mpr_sig_get_vector_bytes(sig));
+        memcpy(si->val, (void*)val, mpr_sig_get_vector_bytes((mpr_sig)lsig));
     si->has_val = 1;
 
     /* mark instance as updated */
@@ -788,6 +803,119 @@ void mpr_sig_set_value(mpr_sig sig, mpr_id id, int len, mpr_type type, const voi
     mpr_rtr_process_sig(lsig->obj.graph->net.rtr, lsig, idmap_idx, si->has_val ? si->val : 0, si->time);
 }
 
+void mpr_sig_set_value(mpr_sig sig, mpr_id id, int len, mpr_type type, const void *val)
+{
+    RETURN_UNLESS(sig);
+    if (!sig->is_local) {
+        _mpr_remote_sig_set_value(sig, len, type, val);
+        return;
+    }
+    if (!len || !val) {
+        mpr_sig_release_inst(sig, id);
+        return;
+    }
+    RETURN_UNLESS(_check_value((mpr_local_sig)sig, len, type, val));
+    _set_value((mpr_local_sig)sig, id, type, val, mpr_dev_get_time(sig->dev));
+}
+
+#define ASYNC_VALS(CELLS) ((char*)((CELLS) + ASYNC_QUEUE_SIZE))
+
+/* Return the cells of a signal's queue for updates from other threads, allocating them on first
+ * use. If several threads race to allocate the queue, only the first block is installed. */
+static mpr_sig_async_cell_t *_get_async_cells(mpr_local_sig lsig)
+{
+    mpr_sig_async_cell_t *cells;
+    int i;
+    cells = mpr_atomic_load_ptr((void * volatile*)&lsig->async.cells);
+    RETURN_ARG_UNLESS(!cells, cells);
+
+    /* the values follow the cells, which keep them aligned for doubles */
+    cells = malloc((sizeof(mpr_sig_async_cell_t) + mpr_sig_get_vector_bytes((mpr_sig)lsig))
+                   * ASYNC_QUEUE_SIZE);
+    RETURN_ARG_UNLESS(cells, 0);
+    for (i = 0; i < ASYNC_QUEUE_SIZE; i++)
+        cells[i].seq = i;
+    if (!mpr_atomic_cas_ptr((void * volatile*)&lsig->async.cells, 0, cells)) {
+        free(cells);
+        cells = mpr_atomic_load_ptr((void * volatile*)&lsig->async.cells);
+    }
+    return cells;
+}
+
+int mpr_sig_set_value_async(mpr_sig sig, mpr_id id, int len, mpr_type type, const void *val)
+{
+    mpr_local_sig lsig = (mpr_local_sig)sig;
+    mpr_sig_async_queue_t *q;
+    mpr_sig_async_cell_t *cells, *cell;
+    unsigned int pos, seq;
+    int release = !len || !val;
+    RETURN_ARG_UNLESS(sig && sig->is_local, 0);
+    RETURN_ARG_UNLESS(release || _check_value(lsig, len, type, val), 0);
+    RETURN_ARG_UNLESS(cells = _get_async_cells(lsig), 0);
+
+    /* claim a cell; the sequence number of a free cell matches the claiming position */
+    q = &lsig->async;
+    pos = mpr_atomic_load(&q->head);
+    while (1) {
+        cell = &cells[pos & q->mask];
+        seq = mpr_atomic_load(&cell->seq);
+        if (seq == pos) {
+            if (mpr_atomic_cas(&q->head, pos, pos + 1))
+                break;
+        }
+        else if ((int)(seq - pos) < 0) {
+            /* queue is full */
+            return 0;
+        }
+        pos = mpr_atomic_load(&q->head);
+    }
+
+    cell->id = id;
+    cell->release = release;
+    mpr_time_set(&cell->time, MPR_NOW);
+    if (!release) {
+        void *dst = ASYNC_VALS(cells) + (pos & q->mask) * mpr_sig_get_vector_bytes(sig);
+        if (type != lsig->type)
+            set_coerced_val(len, type, val, lsig->len, lsig->type, dst);
+        else
+            memcpy(dst, val, mpr_sig_get_vector_bytes(sig));
+    }
+    /* publish the cell to the polling thread */
+    mpr_atomic_store(&cell->seq, pos + 1);
+
+    if (!mpr_atomic_xchg_int(&q->pending, 1))
+        mpr_dev_push_async_sig(lsig->dev, lsig);
+    return 1;
+}
+
+int mpr_sig_process_async(mpr_local_sig lsig)
+{
+    mpr_sig_async_queue_t *q = &lsig->async;
+    mpr_sig_async_cell_t *cells, *cell;
+    int count = 0, size = mpr_sig_get_vector_bytes((mpr_sig)lsig);
+
+    /* clear the pending flag first so that later updates will push the signal again */
+    mpr_atomic_xchg_int(&q->pending, 0);
+    /* the signal is only pushed after its queue has been installed */
+    cells = mpr_atomic_load_ptr((void * volatile*)&q->cells);
+    RETURN_ARG_UNLESS(cells, 0);
+    while (1) {
+        cell = &cells[q->tail & q->mask];
+        if (mpr_atomic_load(&cell->seq) != q->tail + 1)
+            break;
+        if (cell->release)
+            mpr_sig_release_inst((mpr_sig)lsig, cell->id);
+        else
+            _set_value(lsig, cell->id, lsig->type, ASYNC_VALS(cells) + (q->tail & q->mask) * size,
+                       cell->time);
+        /* return the cell to producers for the next lap around the queue */
+        mpr_atomic_store(&cell->seq, q->tail + q->mask + 1);
+        ++q->tail;
+        ++count;
+    }
+    return count;
+}
+
 void mpr_sig_release_inst(mpr_sig sig, mpr_id id)
 {
     int idmap_idx;
@@ -822,6 +950,8 @@ void mpr_sig_release_inst_internal(mpr_local_sig lsig, int idmap_idx)
 
     /* Put instance back in reserve list */
     smap->inst->active = 0;
+    _unlink_active_inst(lsig, smap->inst);
+    _unlink_inst_idmap(lsig, idmap_idx);
     smap->inst = 0;
 }
 
@@ -842,6 +972,7 @@ void mpr_sig_remove_inst(mpr_sig sig, mpr_id id)
     }
 
     remove_idx = lsig->inst[i]->idx;
+    _unlink_active_inst(lsig, lsig->inst[i]);
 
     /* Free value and timetag memory held by instance */
     FUNC_IF(free, lsig->inst[i]->val);
@@ -856,6 +987,9 @@ void mpr_sig_remove_inst(mpr_sig sig, mpr_id id)
     /* Remove instance memory held by map slots */
     mpr_rtr_remove_inst(lsig->obj.graph->net.rtr, lsig, remove_idx);
 
+    memmove(lsig->inst_idmap + remove_idx, lsig->inst_idmap + remove_idx + 1,
+            sizeof(int) * (lsig->num_inst - remove_idx));
+
     for (i = 0; i < lsig->num_inst; i++) {
         if (lsig->inst[i]->idx > remove_idx)
             --lsig->inst[i]->idx;
@@ -1015,6 +1149,76 @@ mpr_list mpr_sig_get_maps(mpr_sig sig, mpr_dir dir)
     return mpr_list_start(q);
 }
 
+/* Add the ids of an idmap to the signal's hash tables. If the tables are too full they are
+ * rebuilt from the current idmaps instead, which also discards stale entries. */
+static void _idmap_tbl_insert(mpr_local_sig lsig, int idmap_idx)
+{
+    int i, j, mask, live = 0;
+    mpr_id_map map;
+    if ((lsig->idmap_tbl.used + 1) * 2 > lsig->idmap_tbl.size) {
+        for (i = 0; i < lsig->idmap_len; i++)
+            live += (lsig->idmaps[i].map != 0);
+        j = 16;
+        while (j < live * 4)
+            j *= 2;
+        if (j != lsig->idmap_tbl.size) {
+            lsig->idmap_tbl.LID = realloc(lsig->idmap_tbl.LID, sizeof(int) * j);
+            lsig->idmap_tbl.GID = realloc(lsig->idmap_tbl.GID, sizeof(int) * j);
+            lsig->idmap_tbl.size = j;
+        }
+        memset(lsig->idmap_tbl.LID, -1, sizeof(int) * j);
+        memset(lsig->idmap_tbl.GID, -1, sizeof(int) * j);
+        lsig->idmap_tbl.used = 0;
+        /* reinsert all idmaps, including the new one */
+        for (i = 0; i < lsig->idmap_len; i++) {
+            if (lsig->idmaps[i].map)
+                _idmap_tbl_insert(lsig, i);
+        }
+        return;
+    }
+    map = lsig->idmaps[idmap_idx].map;
+    mask = lsig->idmap_tbl.size - 1;
+    for (j = mpr_id_hash(map->LID) & mask; lsig->idmap_tbl.LID[j] >= 0; j = (j + 1) & mask) {}
+    lsig->idmap_tbl.LID[j] = idmap_idx;
+    for (j = mpr_id_hash(map->GID) & mask; lsig->idmap_tbl.GID[j] >= 0; j = (j + 1) & mask) {}
+    lsig->idmap_tbl.GID[j] = idmap_idx;
+    ++lsig->idmap_tbl.used;
+}
+
+/* Rebuild the idmap hash tables, e.g. after the GIDs have been updated. */
+void mpr_sig_rehash_idmaps(mpr_local_sig lsig)
+{
+    /* force a rebuild on the next insertion */
+    lsig->idmap_tbl.used = lsig->idmap_tbl.size;
+    _idmap_tbl_insert(lsig, -1);
+}
+
+/* Return the lowest index of an active idmap with the given LID, or -1. */
+static int _find_idmap_with_LID(mpr_local_sig lsig, mpr_id LID)
+{
+    int i, j, mask = lsig->idmap_tbl.size - 1, found = -1;
+    RETURN_ARG_UNLESS(lsig->idmap_tbl.size, -1);
+    for (j = mpr_id_hash(LID) & mask; (i = lsig->idmap_tbl.LID[j]) >= 0; j = (j + 1) & mask) {
+        mpr_sig_idmap_t *m = &lsig->idmaps[i];
+        if (m->inst && m->map && m->map->LID == LID && (found < 0 || i < found))
+            found = i;
+    }
+    return found;
+}
+
+/* Return the lowest index of an idmap with the given GID, or -1. */
+static int _find_idmap_with_GID(mpr_local_sig lsig, mpr_id GID)
+{
+    int i, j, mask = lsig->idmap_tbl.size - 1, found = -1;
+    RETURN_ARG_UNLESS(lsig->idmap_tbl.size, -1);
+    for (j = mpr_id_hash(GID) & mask; (i = lsig->idmap_tbl.GID[j]) >= 0; j = (j + 1) & mask) {
+        mpr_sig_idmap_t *m = &lsig->idmaps[i];
+        if (m->map && m->map->GID == GID && (found < 0 || i < found))
+            found = i;
+    }
+    return found;
+}
+
 static int _init_and_add_idmap(mpr_local_sig lsig, mpr_sig_inst si, mpr_id_map map)
 {
     int i;
@@ -1023,6 +1227,7 @@ static int _init_and_add_idmap(mpr_local_sig lsig, mpr_sig_inst si, mpr_id_map m
         si->has_val = 0;
         mpr_time_set(&si->created, MPR_NOW);
         mpr_time_set(&si->time, si->created);
+        _link_active_inst(lsig, si);
     }
 
     /* find unused signal map */
@@ -1041,12 +1246,36 @@ static int _init_and_add_idmap(mpr_local_sig lsig, mpr_sig_inst si, mpr_id_map m
         lsig->idmaps = realloc(lsig->idmaps, (lsig->idmap_len * sizeof(struct _mpr_sig_idmap)));
         memset(lsig->idmaps + i, 0, ((lsig->idmap_len - i) * sizeof(struct _mpr_sig_idmap)));
     }
+    _unlink_inst_idmap(lsig, i);
     lsig->idmaps[i].map = map;
     lsig->idmaps[i].inst = si;
     lsig->idmaps[i].status = 0;
+    lsig->inst_idmap[si->idx] = i;
+    _idmap_tbl_insert(lsig, i);
     return i;
 }
 
+/* Called before the instance is removed from an idmap to keep the instance index table current. */
+static void _unlink_inst_idmap(mpr_local_sig lsig, int idmap_idx)
+{
+    int i;
+    mpr_sig_inst si = lsig->idmaps[idmap_idx].inst;
+    RETURN_UNLESS(si && lsig->inst_idmap[si->idx] == idmap_idx);
+
+    /* the instance may still be referenced by another idmap */
+    for (i = 0; i < lsig->idmap_len; i++) {
+        if (i != idmap_idx && lsig->idmaps[i].inst == si)
+            break;
+    }
+    lsig->inst_idmap[si->idx] = (i < lsig->idmap_len) ? i : -1;
+}
+
+int mpr_sig_get_idmap_with_inst_idx(mpr_local_sig lsig, int inst_idx)
+{
+    RETURN_ARG_UNLESS(inst_idx >= 0 && inst_idx < lsig->num_inst, -1);
+    return lsig->inst_idmap[inst_idx];
+}
+
 void mpr_sig_send_state(mpr_sig sig, net_msg_t cmd)
 {
     char str[BUFFSIZE];
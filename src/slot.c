@@ -29,6 +29,10 @@ static int slot_mask(mpr_slot slot)
 
 void mpr_slot_free(mpr_slot slot)
 {
+    if (slot->is_local) {
+        FUNC_IF(free, ((mpr_local_slot)slot)->tmpl.data);
+        FUNC_IF(free, ((mpr_local_slot)slot)->tmpl.types);
+    }
     free(slot);
 }
 
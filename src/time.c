@@ -40,6 +40,7 @@ int gettimeofday(struct timeval * tp, struct timezone * tzp)
 
 #else
 #include <sys/time.h>
+#include <time.h>
 #endif
 
 #include "mapper_internal.h"
@@ -60,6 +61,17 @@ double mpr_get_current_time()
 #endif
 }
 
+/*! Internal function to get a time that is not affected by changes to the system clock. */
+double mpr_get_monotonic_time()
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+        return (double)ts.tv_sec + ((double)ts.tv_nsec) * 0.000000001;
+#endif
+    return mpr_get_current_time();
+}
+
 double mpr_time_get_diff(const mpr_time l, const mpr_time r)
 {
     return ((double)l.sec - (double)r.sec
@@ -14,6 +14,10 @@
  #endif
 #endif
 
+#ifdef HAVE_LIBPTHREAD
+ #include <pthread.h>
+#endif
+
 #include <mapper/mapper_constants.h>
 
 #ifdef HAVE_INTTYPES_H
@@ -108,6 +112,17 @@ typedef struct _mpr_subscription {
 #define SERVER_UDP      0
 #define SERVER_TCP      1
 
+/*! Mutex used when local devices are polled by worker threads. */
+#ifdef HAVE_LIBPTHREAD
+typedef pthread_mutex_t mpr_mutex_t;
+#else
+#ifdef HAVE_WIN32_THREADS
+typedef CRITICAL_SECTION mpr_mutex_t;
+#else
+typedef int mpr_mutex_t;
+#endif
+#endif
+
 /*! A structure that keeps information about network communications. */
 typedef struct _mpr_net {
     struct _mpr_graph *graph;
@@ -141,6 +156,11 @@ typedef struct _mpr_net {
                                      *   multicast bus/mesh. */
     int msg_type;
     int num_devs;
+    int num_workers;                /*!< Number of local devices polled by worker threads. */
+    char *recv_buf;                 /*!< Buffer for batched datagram receives, shared by the
+                                     *   local devices. */
+    volatile unsigned int recv_buf_busy;    /*!< Non-zero while recv_buf is in use. */
+    mpr_mutex_t admin_lock;         /*!< Held by the thread handling administrative messages. */
     uint32_t next_bus_ping;
     uint32_t next_sub_ping;
     uint8_t generic_dev_methods_added;
@@ -279,12 +299,28 @@ typedef struct _mpr_graph {
 
 typedef struct _mpr_value_buffer
 {
-    void *samps;                /*!< Value for each sample of stored history. */
-    mpr_time *times;            /*!< Time for each sample of stored history. */
-    int8_t pos;                 /*!< Current position in the circular buffer. */
+    void *samps;                /*!< Value for each sample of stored history, within the arena. */
+    mpr_time *times;            /*!< Time for each sample of stored history, within the arena. */
+    int pos;                    /*!< Current position in the circular buffer. */
     uint8_t full;               /*!< Indicates whether complete buffer contains valid data. */
+    unsigned int count;         /*!< Number of samples written, advanced by at least the history
+                                 *   size whenever the stored values change in any other way. */
 } mpr_value_buffer_t, *mpr_value_buffer;
 
+/*! Running sums and extremes of the current values of the active instances of a value, updated
+ *  as samples are set and instances are released so that instance reductions can be read
+ *  without visiting every instance. */
+typedef struct _mpr_value_agg
+{
+    double *sum;                /*!< Sum of each vector element. */
+    double *max;                /*!< Maximum of each vector element. */
+    double *min;                /*!< Minimum of each vector element. */
+    uint8_t *max_inst;          /*!< Instance holding each maximum. */
+    uint8_t *min_inst;          /*!< Instance holding each minimum. */
+    int updates;                /*!< Number of updates since the sums were recomputed. */
+    uint8_t stale;              /*!< Indicates that an instance holding an extreme has moved. */
+} mpr_value_agg_t, *mpr_value_agg;
+
 typedef struct _mpr_value
 {
     mpr_value_buffer inst;      /*!< Array of value histories for each signal instance. */
@@ -292,7 +328,11 @@ typedef struct _mpr_value
     uint8_t num_inst;           /*!< Number of instances. */
     uint8_t num_active_inst;    /*!< Number of active instances. */
     mpr_type type;              /*!< The type of this signal. */
-    int16_t mlen;               /*!< History size of the buffer. */
+    int mlen;                   /*!< History size of the buffer, always a power of two. */
+    void *samps;                /*!< Arena of samples laid out as [instance][history][vector]. */
+    mpr_time *times;            /*!< Arena of sample times laid out as [instance][history]. */
+    int num_alloc_inst;         /*!< Number of instances with space in the arenas. */
+    mpr_value_agg agg;          /*!< Running aggregates over the instances, or 0 if unused. */
 } mpr_value_t, *mpr_value;
 
 /*! Bit flags for indicating instance id_map status. */
@@ -318,11 +358,36 @@ typedef struct _mpr_sig_inst
     void *val;                  /*!< The current value of this signal instance. */
     mpr_time time;              /*!< The time associated with the current value. */
 
+    struct _mpr_sig_inst *prev; /*!< Next older active instance. */
+    struct _mpr_sig_inst *next; /*!< Next newer active instance. */
+
     uint8_t idx;                /*!< Index for accessing value history. */
     uint8_t has_val;            /*!< Indicates whether this instance has a value. */
     uint8_t active;             /*!< Status of this instance. */
 } mpr_sig_inst_t, *mpr_sig_inst;
 
+/*! A signal update pushed from another thread, waiting to be routed by the polling thread. */
+typedef struct _mpr_sig_async_cell
+{
+    volatile unsigned int seq;  /*!< Sequence number used to claim and publish the cell. */
+    int release;                /*!< Non-zero if the instance should be released. */
+    mpr_id id;                  /*!< Instance id. */
+    mpr_time time;              /*!< Time of the update. */
+} mpr_sig_async_cell_t;
+
+/*! Bounded lock-free queue of updates for a single signal. Any number of threads may push
+ *  updates but only the polling thread may pop them. Values are stored in the signal's type. */
+typedef struct _mpr_sig_async_queue
+{
+    mpr_sig_async_cell_t * volatile cells;  /*!< Allocated by the first push, followed by the
+                                             *   value storage of one signal vector per cell. */
+    volatile unsigned int head; /*!< Next position to be claimed by a producer. */
+    unsigned int tail;          /*!< Next position to be popped by the polling thread. */
+    unsigned int mask;          /*!< Number of cells minus one. */
+    volatile int pending;       /*!< Non-zero if the signal is on its device's pending stack. */
+    struct _mpr_local_sig *next;/*!< Next signal on the device's pending stack. */
+} mpr_sig_async_queue_t;
+
 /* plan: remove inst, add map/slot resource index (is this the same for all source signals?) */
 typedef struct _mpr_sig_idmap
 {
@@ -366,7 +431,19 @@ typedef struct _mpr_local_sig
 
     struct _mpr_sig_idmap *idmaps;  /*!< ID maps and active instances. */
     int idmap_len;
+    int *inst_idmap;                /*!< Index of the idmap for each instance index, or -1. */
+
+    /*! Open-addressed hash tables of idmap indices keyed on LID and GID. Entries are only
+     *  added, so lookups verify the key and stale entries are dropped when tables are rebuilt. */
+    struct {
+        int *LID;
+        int *GID;
+        int size;                   /*!< Number of slots, always a power of two. */
+        int used;                   /*!< Number of occupied slots. */
+    } idmap_tbl;
     struct _mpr_sig_inst **inst;    /*!< Array of pointers to the signal insts. */
+    struct _mpr_sig_inst *oldest;   /*!< Active instances ordered by activation time. */
+    struct _mpr_sig_inst *newest;
     char *vec_known;                /*!< Bitflags when entire vector is known. */
     char *updated_inst;             /*!< Bitflags to indicate updated instances. */
 
@@ -376,6 +453,9 @@ typedef struct _mpr_local_sig
     int event_flags;                /*! Flags for deciding when to call the
                                      *  instance event handler. */
 
+    struct _mpr_rtr_sig *rsig;      /*!< Router entry for this signal, or 0 if unmapped. */
+    mpr_sig_async_queue_t async;    /*!< Updates pushed from other threads. */
+
     mpr_sig_group group;            /* TODO: replace with hierarchical instancing */
     uint8_t locked;
     uint8_t updated;                /* TODO: fold into updated_inst bitflags. */
@@ -383,9 +463,40 @@ typedef struct _mpr_local_sig
 
 /**** Router ****/
 
+/*! A typed value update queued on a local-only link. Types and values are stored in the data
+ *  buffer of the owning queue so that no OSC message needs to be built or parsed. */
+typedef struct _mpr_local_msg {
+    struct _mpr_local_sig *sig;     /*!< Destination signal, or 0 if it has been freed. */
+    mpr_id GID;                     /*!< Instance id, or 0 for non-instanced updates. */
+    int slot;                       /*!< Destination slot id, or -1 if none. */
+    int len;                        /*!< Vector length of the update. */
+    size_t types;                   /*!< Offset of the type vector in the data buffer. */
+    size_t vals;                    /*!< Offset of the values in the data buffer, or 0 if none. */
+} mpr_local_msg_t, *mpr_local_msg;
+
+typedef struct _mpr_local_msg_queue {
+    mpr_local_msg msgs;
+    char *data;
+    size_t data_len;
+    size_t data_size;
+    int num_msgs;
+    int size_msgs;
+    mpr_time time;                  /*!< Timestamp of the first queued update. */
+} mpr_local_msg_queue_t;
+
+/*! An OSC bundle serialized directly into a buffer that is reused between polls. */
+typedef struct _mpr_send_buf {
+    char *data;
+    size_t len;
+    size_t size;
+    int num_msgs;
+} mpr_send_buf_t;
+
 typedef struct _mpr_bundle {
     lo_bundle udp;
     lo_bundle tcp;
+    mpr_send_buf_t buf;             /*!< Serialized UDP updates, reused between polls. */
+    mpr_local_msg_queue_t local;    /*!< Updates for local-only links, reused between polls. */
 } mpr_bundle_t, *mpr_bundle;
 
 #define NUM_BUNDLES 1
@@ -401,6 +512,8 @@ typedef struct _mpr_link {
         lo_address admin;               /*!< Network address of remote endpoint */
         lo_address udp;                 /*!< Network address of remote endpoint */
         lo_address tcp;                 /*!< Network address of remote endpoint */
+        void *udp_sa;                   /*!< Resolved socket address for udp, or 0. */
+        int udp_sa_len;
     } addr;
 
     int is_local_only;
@@ -429,9 +542,24 @@ typedef struct _mpr_slot {
     struct _mpr_map *map;           /*!< Pointer to parent map */
 } mpr_slot_t, *mpr_slot;
 
+/*! A serialized OSC message used as a template for map updates. Only the values and instance id
+ *  are rewritten for each update; the template is rebuilt if the destination or types change. */
+typedef struct _mpr_msg_tmpl {
+    char *data;                     /*!< Serialized message, starting with the destination path. */
+    mpr_type *types;                /*!< Value types used to build the template. */
+    int len;                        /*!< Length of the serialized message in bytes. */
+    int size;                       /*!< Allocated size of the data buffer. */
+    int num_types;
+    int types_size;                 /*!< Allocated size of the types array. */
+    int vals;                       /*!< Offset of the first value. */
+    int GID;                        /*!< Offset of the instance id, or 0 if none. */
+    int slot;                       /*!< Slot id included in the message, or -1 if none. */
+} mpr_msg_tmpl_t, *mpr_msg_tmpl;
+
 typedef struct _mpr_local_slot {
     MPR_SLOT_STRUCT_ITEMS
     struct _mpr_local_map *map;     /*!< Pointer to parent map */
+    mpr_msg_tmpl_t tmpl;            /*!< Template for updates tagged with this slot. */
 
     /* each slot can point to local signal or a remote link structure */
     struct _mpr_rtr_sig *rsig;      /*!< Parent signal if local */
@@ -475,17 +603,36 @@ typedef struct _mpr_local_map {
     const char **var_names;         /*!< User variables names. */
     int num_vars;                   /*!< Number of user variables. */
     int num_inst;                   /*!< Number of local instances. */
+    mpr_msg_tmpl_t tmpl;            /*!< Template for updates without a slot id. */
+
+    struct {
+        int *status;                /*!< Evaluation status of each updated instance. */
+        mpr_type *types;            /*!< Output types of each updated instance. */
+        int num_inst;               /*!< Number of instances allocated. */
+        int len;                    /*!< Vector length allocated for each instance. */
+        uint8_t ready;              /*!< 1 if results are waiting to be sent. */
+    } eval;                         /*!< Results of evaluating the updated instances. */
+
+    struct _mpr_local_map *next_updated;    /*!< Next map in the device worklist. */
+    struct _mpr_map_worklist *worklist;     /*!< Worklist holding this map, or 0. */
 
     uint8_t is_local_only;
     uint8_t one_src;
-    uint8_t updated;
+    uint8_t updated;                /*!< Non-zero if the map is queued on a device worklist. */
 } mpr_local_map_t, *mpr_local_map;
 
-/*! The rtr_sig is a linked list containing a signal and a list of mapping
- *  slots.  TODO: This should be replaced with a more efficient approach
- *  such as a hash table or search tree. */
+/*! Intrusive FIFO of maps with updated instances, linked through map->next_updated. */
+typedef struct _mpr_map_worklist {
+    mpr_local_map head;
+    mpr_local_map tail;
+} mpr_map_worklist_t;
+
+/*! The rtr_sig is a doubly-linked list containing a signal and a list of mapping
+ *  slots. Each local signal also stores a pointer to its own rtr_sig so lookup,
+ *  insertion and removal do not depend on the number of mapped signals. */
 typedef struct _mpr_rtr_sig {
     struct _mpr_rtr_sig *next;      /*!< The next rtr_sig in the list. */
+    struct _mpr_rtr_sig *prev;      /*!< The previous rtr_sig in the list. */
 
     struct _mpr_rtr *link;          /*!< The parent link. */
     struct _mpr_local_sig *sig;     /*!< The associated signal. */
@@ -508,6 +655,8 @@ typedef struct _mpr_rtr {
  *  remote and local instances. */
 typedef struct _mpr_id_map {
     struct _mpr_id_map *next;       /*!< The next id map in the list. */
+    struct _mpr_id_map *next_LID;   /*!< The next id map in the same LID hash bucket. */
+    struct _mpr_id_map *next_GID;   /*!< The next id map in the same GID hash bucket. */
 
     mpr_id GID;                     /*!< Hash for originating device. */
     mpr_id LID;                     /*!< Local instance id to map. */
@@ -515,6 +664,14 @@ typedef struct _mpr_id_map {
     int GID_refcount;
 } mpr_id_map_t, *mpr_id_map;
 
+/*! Hash tables indexing the active id maps of a signal group by LID and GID. */
+typedef struct _mpr_id_map_tbl {
+    struct _mpr_id_map **LID;       /*!< Buckets chained through next_LID. */
+    struct _mpr_id_map **GID;       /*!< Buckets chained through next_GID. */
+    int size;                       /*!< Number of buckets, always a power of two. */
+    int count;                      /*!< Number of active id maps. */
+} mpr_id_map_tbl_t;
+
 /**** Device ****/
 
 #define MPR_DEV_STRUCT_ITEMS                                            \
@@ -553,18 +710,42 @@ struct _mpr_local_dev {
     struct {
         struct _mpr_id_map **active;    /*!< The list of active instance id maps. */
         struct _mpr_id_map *reserve;    /*!< The list of reserve instance id maps. */
+        mpr_id_map_tbl_t *tbls;         /*!< Hash tables of active id maps for each group. */
     } idmaps;
 
     mpr_expr_stack expr_stack;
     mpr_thread_data thread_data;
+    struct _mpr_eval_pool *eval_pool;   /*!< Threads evaluating outgoing maps, or 0. */
+
+    mpr_map_worklist_t maps_in;         /*!< Updated maps to be processed at this device. */
+    mpr_map_worklist_t maps_out;        /*!< Updated maps to be sent from this device. */
+    struct _mpr_local_sig * volatile async_sigs;    /*!< Signals with updates from other
+                                                     *   threads, pushed without locking. */
+    struct _mpr_link **send_links;      /*!< Links with serialized bundles to send. */
+    int send_links_size;
+    double stats[MPR_DEV_NUM_STATS];    /*!< Statistics reported by mpr_dev_get_stat(). */
+    int recv_budget;                    /*!< Messages to receive per poll, or 0 for default. */
+    double tcp_checked;                 /*!< When accepted TCP connections were last serviced by
+                                         *   mpr_dev_process_timers(). */
+    void *wake_sa;                      /*!< Loopback address of the UDP server, used to
+                                         *   interrupt a blocking poll from other threads. */
+    int wake_sa_len;
+    int wake_fd;                        /*!< Socket used to send wakeup datagrams, or -1. */
+    mpr_mutex_t lock;                   /*!< Held by the data plane while processing updates,
+                                         *   and by the control thread while it mutates the
+                                         *   graph, once any device uses a worker thread. */
 
     mpr_time time;
+    mpr_time bundle_time;               /*!< Timetag of the bundle being dispatched. */
     int num_sig_groups;
     uint8_t time_is_stale;
     uint8_t polling;
     uint8_t bundle_idx;
     uint8_t sending;
     uint8_t receiving;
+    uint8_t tcp_clients;                /*!< 1 once the TCP server has accepted a connection. */
+    uint8_t is_worker;                  /*!< 1 if the data plane is polled by a worker thread. */
+    uint8_t data_locked;                /*!< 1 while the data plane holds the device lock. */
 };
 
 /**** Messages ****/
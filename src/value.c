@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <limits.h>
+#include <float.h>
 #include <assert.h>
 
 #include "mapper_internal.h"
@@ -12,90 +13,219 @@
 
 MPR_INLINE static int _min(int a, int b) { return a < b ? a : b; }
 
+/* Round up to a power of two, starting from 'size' if it is non-zero. */
+MPR_INLINE static int _pow2(int size, int min)
+{
+    if (size < 1)
+        size = 1;
+    while (size < min)
+        size <<= 1;
+    return size;
+}
+
+/* Return vector element 'el' of sample 's' as a double. */
+MPR_INLINE static double _get_el(mpr_value v, const void *s, int el)
+{
+    switch (v->type) {
+        case MPR_INT32: return ((int*)s)[el];
+        case MPR_FLT:   return ((float*)s)[el];
+        default:        return ((double*)s)[el];
+    }
+}
+
+/* Recompute the running aggregates from the current values of the active instances. */
+static void _agg_scan(mpr_value v)
+{
+    mpr_value_agg a = v->agg;
+    int i, j;
+    double d;
+    for (j = 0; j < v->vlen; j++) {
+        a->sum[j] = 0;
+        a->max[j] = -DBL_MAX;
+        a->min[j] = DBL_MAX;
+        a->max_inst[j] = a->min_inst[j] = 0;
+    }
+    for (i = 0; i < v->num_inst; i++) {
+        void *s;
+        if (v->inst[i].pos < 0)
+            continue;
+        s = mpr_value_get_samp(v, i);
+        for (j = 0; j < v->vlen; j++) {
+            d = _get_el(v, s, j);
+            a->sum[j] += d;
+            if (d > a->max[j]) {
+                a->max[j] = d;
+                a->max_inst[j] = i;
+            }
+            if (d < a->min[j]) {
+                a->min[j] = d;
+                a->min_inst[j] = i;
+            }
+        }
+    }
+    a->updates = 0;
+    a->stale = 0;
+}
+
+/* Replace the contribution of instance 'idx' to the running aggregates. Either sample may be
+ * null if the instance is becoming active or inactive. */
+static void _agg_update(mpr_value v, int idx, const void *old, const void *new)
+{
+    mpr_value_agg a = v->agg;
+    int j;
+    double d;
+    for (j = 0; j < v->vlen; j++) {
+        if (old)
+            a->sum[j] -= _get_el(v, old, j);
+        if (!new) {
+            if (idx == a->max_inst[j] || idx == a->min_inst[j])
+                a->stale = 1;
+            continue;
+        }
+        d = _get_el(v, new, j);
+        a->sum[j] += d;
+        if (d >= a->max[j]) {
+            a->max[j] = d;
+            a->max_inst[j] = idx;
+        }
+        else if (idx == a->max_inst[j])
+            a->stale = 1;
+        if (d <= a->min[j]) {
+            a->min[j] = d;
+            a->min_inst[j] = idx;
+        }
+        else if (idx == a->min_inst[j])
+            a->stale = 1;
+    }
+    ++a->updates;
+}
+
+mpr_value_agg mpr_value_get_agg(mpr_value v)
+{
+    mpr_value_agg a = v->agg;
+    if (!a) {
+        size_t size = sizeof(mpr_value_agg_t) + v->vlen * (3 * sizeof(double) + 2);
+        RETURN_ARG_UNLESS(a = v->agg = malloc(size), 0);
+        a->sum = (double*)(a + 1);
+        a->max = a->sum + v->vlen;
+        a->min = a->max + v->vlen;
+        a->max_inst = (uint8_t*)(a->min + v->vlen);
+        a->min_inst = a->max_inst + v->vlen;
+        a->stale = 1;
+    }
+    if (a->stale || (MPR_INT32 != v->type && a->updates >= v->num_inst))
+        _agg_scan(v);
+    return a;
+}
+
+/* Point the buffers of instances [from, to) at consecutive slices of the arenas. */
+static void _set_bufs(mpr_value v, int samp_size, int from, int to)
+{
+    int i;
+    for (i = from; i < to; i++) {
+        mpr_value_buffer b = &v->inst[i];
+        b->samps = (char*)v->samps + i * v->mlen * samp_size;
+        b->times = v->times + i * v->mlen;
+        b->pos = -1;
+        b->full = 0;
+        /* sample counts of existing buffers must not repeat */
+        b->count = i < v->num_alloc_inst ? b->count + v->mlen : 0;
+    }
+}
+
+/* Values are stored in a single arena laid out as [instance][history][vector], with a parallel
+ * arena for the timetags. History sizes are rounded up to a power of two so that positions can
+ * wrap with a mask, and room for instances grows by doubling. */
 void mpr_value_realloc(mpr_value v, unsigned int vlen, mpr_type type, unsigned int mlen,
                        unsigned int num_inst, int is_input)
 {
-    int i, samp_size;
-    mpr_value_buffer_t *b, tmp;
+    int i, samp_size, num_alloc;
+    mpr_value_buffer b;
+    void *samps;
+    mpr_time *times;
     RETURN_UNLESS(v && mlen && num_inst >= v->num_inst);
     samp_size = vlen * mpr_type_get_size(type);
+    mlen = _pow2(1, mlen);
+    num_alloc = _pow2(v->num_alloc_inst, num_inst);
+
+    if (!v->samps || !is_input || vlen != v->vlen || type != v->type) {
+        /* discard stored values and initialize all instances to 0 */
+        FUNC_IF(free, v->samps);
+        FUNC_IF(free, v->times);
+        FUNC_IF(free, v->agg);
+        v->agg = 0;
+        v->samps = calloc(1, num_alloc * mlen * samp_size);
+        v->times = calloc(1, num_alloc * mlen * sizeof(mpr_time));
+        v->inst = realloc(v->inst, sizeof(mpr_value_buffer_t) * num_alloc);
+        v->mlen = mlen;
+        _set_bufs(v, samp_size, 0, num_alloc);
+        v->num_alloc_inst = num_alloc;
+        v->num_active_inst = 0;
+        goto done;
+    }
 
-    if (!v->inst || num_inst > v->num_inst) {
-        if (v->inst)
-            v->inst = realloc(v->inst, sizeof(mpr_value_buffer_t) * num_inst);
-        else {
-            v->inst = malloc(sizeof(mpr_value_buffer_t) * num_inst);
-            v->num_inst = 0;
+    if (mlen == v->mlen) {
+        if (num_alloc > v->num_alloc_inst) {
+            /* grow the arenas; instance buffers may have been reordered by removals so they are
+             * moved by their offset rather than reassigned */
+            int size = v->mlen * samp_size;
+            samps = realloc(v->samps, num_alloc * size);
+            times = realloc(v->times, num_alloc * mlen * sizeof(mpr_time));
+            for (i = 0; i < v->num_alloc_inst; i++) {
+                b = &v->inst[i];
+                b->samps = (char*)samps + ((char*)b->samps - (char*)v->samps);
+                b->times = times + (b->times - v->times);
+            }
+            v->samps = samps;
+            v->times = times;
+            v->inst = realloc(v->inst, sizeof(mpr_value_buffer_t) * num_alloc);
+            _set_bufs(v, samp_size, v->num_alloc_inst, num_alloc);
+            v->num_alloc_inst = num_alloc;
         }
         /* initialize new instances */
         for (i = v->num_inst; i < num_inst; i++) {
             b = &v->inst[i];
-            b->samps = calloc(1, mlen * samp_size);
-            b->times = calloc(1, mlen * sizeof(mpr_time));
-            b->pos = -1;
-            b->full = 0;
-        }
-    }
-
-    if (!is_input || vlen != v->vlen || type != v->type) {
-        /* reallocate old instances (v->num_inst has not yet been updated) */
-        for (i = 0; i < v->num_inst; i++) {
-            b = &v->inst[i];
-            b->samps = realloc(b->samps, mlen * samp_size);
-            b->times = realloc(b->times, mlen * sizeof(mpr_time));
-            /* Initialize entire value to 0 */
             memset(b->samps, 0, mlen * samp_size);
             memset(b->times, 0, mlen * sizeof(mpr_time));
             b->pos = -1;
             b->full = 0;
+            b->count += mlen;
         }
         goto done;
     }
 
-    if (mlen == v->mlen)
-        goto done;
-
-    /* only the memory size is different */
-
+    /* the history size is different: copy the stored values into new arenas */
+    samps = calloc(1, num_alloc * mlen * samp_size);
+    times = calloc(1, num_alloc * mlen * sizeof(mpr_time));
     for (i = 0; i < v->num_inst; i++) {
+        char *dst_samps = (char*)samps + i * mlen * samp_size;
+        mpr_time *dst_times = times + i * mlen;
         b = &v->inst[i];
-        tmp.samps = malloc(samp_size * mlen);
-        tmp.times = malloc(sizeof(mpr_time) * mlen);
-
-        /* TODO: don't bother copying memory if pos is -1 */
-        if (mlen > v->mlen) {
-            int opos = b->pos < 0 ? 0 : b->pos;
-            int npos = v->mlen - opos;
-            /* copy from [v->pos, v->mlen] to [0, v->mlen - v->pos] */
-            memcpy(tmp.samps, (char*)b->samps + opos * samp_size, npos * samp_size);
-            memcpy(tmp.times, &b->times[opos], npos * sizeof(mpr_time));
-            /* copy from [0, v->pos] to [v->mlen - v->pos, v->mlen] */
-            memcpy((char*)tmp.samps + npos * samp_size, b->samps, opos * samp_size);
-            memcpy(&tmp.times[npos], b->times, opos * sizeof(mpr_time));
-            /* zero remainder */
-            memset((char*)tmp.samps + v->mlen * samp_size, 0, (mlen - v->mlen) * samp_size);
-            memset(&tmp.times[v->mlen], 0, (mlen - v->mlen) * sizeof(mpr_time));
-            b->pos = b->pos < 0 ? -1 : v->mlen;
-            b->full = 0;
-        }
-        else {
-            int opos = b->pos < 0 ? 0 : b->pos;
-            int len = _min(v->mlen - opos, mlen);
-            memcpy(tmp.samps, (char*)b->samps + opos * samp_size, len * samp_size);
-            memcpy(tmp.times, &b->times[opos], len * sizeof(mpr_time));
-            if (mlen > len) {
-                memcpy((char*)tmp.samps + len * samp_size, b->samps, (mlen - len) * samp_size);
-                memcpy(&tmp.times[len], b->times, (mlen - len) * sizeof(mpr_time));
+
+        if (b->pos >= 0) {
+            /* copy the most recent samples, oldest first */
+            int j, n = _min(v->mlen, mlen);
+            for (j = 0; j < n; j++) {
+                int src = mpr_value_hist_pos(v, b->pos, j - n + 1);
+                memcpy(dst_samps + j * samp_size, (char*)b->samps + src * samp_size, samp_size);
+                dst_times[j] = b->times[src];
             }
-            b->pos = b->pos < 0 ? -1 : len;
-            b->full = (b->pos > mlen);
+            b->full = mlen <= v->mlen && (b->full || b->pos + 1 >= mlen);
+            b->pos = n - 1;
         }
-
-        free(b->samps);
-        free(b->times);
-        b->samps = tmp.samps;
-        b->times = tmp.times;
+        b->count += mlen;
+        b->samps = dst_samps;
+        b->times = dst_times;
     }
+    free(v->samps);
+    free(v->times);
+    v->samps = samps;
+    v->times = times;
+    v->mlen = mlen;
+    if (num_alloc > v->num_alloc_inst)
+        v->inst = realloc(v->inst, sizeof(mpr_value_buffer_t) * num_alloc);
+    _set_bufs(v, samp_size, v->num_inst, num_alloc);
+    v->num_alloc_inst = num_alloc;
 
 done:
     v->vlen = vlen;
@@ -107,18 +237,33 @@ done:
 int mpr_value_remove_inst(mpr_value v, int idx)
 {
     int i;
+    mpr_value_buffer_t b;
     RETURN_ARG_UNLESS(idx >= 0 && idx < v->num_inst, v->num_inst);
-    free(v->inst[idx].samps);
-    free(v->inst[idx].times);
-    if (v->inst[idx].pos >= 0)
+    b = v->inst[idx];
+    if (b.pos >= 0)
         --v->num_active_inst;
+    if (v->agg) {
+        if (b.pos >= 0)
+            _agg_update(v, idx, mpr_value_get_samp(v, idx), 0);
+        /* instances above the removed one will be shifted down */
+        for (i = 0; i < v->vlen; i++) {
+            if (v->agg->max_inst[i] > idx)
+                --v->agg->max_inst[i];
+            if (v->agg->min_inst[i] > idx)
+                --v->agg->min_inst[i];
+        }
+    }
     for (i = idx + 1; i < v->num_inst; i++) {
         /* shift values down */
         memcpy(&(v->inst[i-1]), &(v->inst[i]), sizeof(mpr_value_buffer_t));
     }
     --v->num_inst;
     assert(v->num_inst >= 0);
-    v->inst = realloc(v->inst, sizeof(mpr_value_buffer_t) * v->num_inst);
+    /* keep the removed slice of the arena for a later instance */
+    b.pos = -1;
+    b.full = 0;
+    b.count += v->mlen;
+    v->inst[v->num_inst] = b;
     return v->num_inst;
 }
 
@@ -127,19 +272,25 @@ void mpr_value_reset_inst(mpr_value v, int idx)
     mpr_value_buffer b;
     RETURN_UNLESS(v->inst);
     b = &v->inst[idx % v->num_inst];
+    if (v->agg && b->pos >= 0)
+        _agg_update(v, idx % v->num_inst, mpr_value_get_samp(v, idx), 0);
     memset(b->samps, 0, v->mlen * v->vlen * mpr_type_get_size(v->type));
     memset(b->times, 0, v->mlen * sizeof(mpr_time));
     if (b->pos >= 0)
         --v->num_active_inst;
     b->pos = -1;
     b->full = 0;
+    b->count += v->mlen;
 }
 
 void mpr_value_set_samp(mpr_value v, int idx, void *s, mpr_time t)
 {
     mpr_value_buffer b = &v->inst[(idx = idx % v->num_inst)];
+    if (v->agg)
+        _agg_update(v, idx, b->pos < 0 ? 0 : mpr_value_get_samp(v, idx), s);
     if (b->pos < 0)
         ++v->num_active_inst;
+    ++b->count;
     b->pos += 1;
     if (b->pos >= v->mlen) {
         b->pos = 0;
@@ -150,14 +301,16 @@ void mpr_value_set_samp(mpr_value v, int idx, void *s, mpr_time t)
 }
 
 void mpr_value_free(mpr_value v) {
-    int i;
     RETURN_UNLESS(v->inst);
-    for (i = 0; i < v->num_inst; i++) {
-        FUNC_IF(free, v->inst[i].samps);
-        FUNC_IF(free, v->inst[i].times);
-    }
+    FUNC_IF(free, v->samps);
+    FUNC_IF(free, v->times);
+    FUNC_IF(free, v->agg);
     free(v->inst);
     v->inst = 0;
+    v->samps = 0;
+    v->times = 0;
+    v->agg = 0;
+    v->num_alloc_inst = 0;
 }
 
 #ifdef DEBUG
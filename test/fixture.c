@@ -0,0 +1,201 @@
+#include "fixture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+#include <signal.h>
+#include <string.h>
+
+/* Map requests are sent in batches, since a burst of hundreds of them can overflow the
+ * receive buffers of the devices and requests that are dropped are not repeated. */
+#define MAP_BATCH 50
+
+int verbose = 1;
+int terminate = 0;
+int shared_graph = 0;
+int fast = 0;
+int done = 0;
+
+mpr_dev fixture_devs[FIXTURE_MAX_DEVS];
+int fixture_num_devs = 0;
+
+static const char *iface = 0;
+
+static void poll_devs(int block_ms)
+{
+    int i;
+    for (i = 0; i < fixture_num_devs; i++)
+        mpr_dev_poll(fixture_devs[i], block_ms);
+}
+
+fixture_poll_fn *fixture_poll = poll_devs;
+
+void eprintf(const char *format, ...)
+{
+    va_list args;
+    if (!verbose)
+        return;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+/*! Internal function to get the current time. */
+double current_time(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void segv(int sig)
+{
+    printf("\x1B[31m(SEGV)\n\x1B[0m");
+    exit(1);
+}
+
+static void ctrlc(int signal)
+{
+    done = 1;
+}
+
+int fixture_init(int argc, char **argv, const char *name, const char *usage,
+                 fixture_opt_fn *opt)
+{
+    int i, j;
+
+    /* process flags for -v verbose, -t terminate, -h help */
+    for (i = 1; i < argc; i++) {
+        if (argv[i] && argv[i][0] == '-') {
+            int len = strlen(argv[i]);
+            for (j = 1; j < len; j++) {
+                switch (argv[i][j]) {
+                    case 'h':
+                        printf("%s.c: possible arguments "
+                               "-f fast (execute quickly), "
+                               "-q quiet (suppress output), "
+                               "-t terminate automatically, "
+                               "-s shared (use one mpr_graph only), "
+                               "-h help, "
+                               "%s"
+                               "--iface network interface\n", name, usage ? usage : "");
+                        return 1;
+                        break;
+                    case 'f':
+                        fast = 1;
+                        break;
+                    case 'q':
+                        verbose = 0;
+                        break;
+                    case 't':
+                        terminate = 1;
+                        break;
+                    case 's':
+                        shared_graph = 1;
+                        break;
+                    case '-':
+                        if (argc <= i + 1)
+                            break;
+                        if (strcmp(argv[i], "--iface")==0) {
+                            i++;
+                            iface = argv[i];
+                            j = len;
+                        }
+                        else if (opt && opt(argv[i], argv[i + 1])) {
+                            i++;
+                            j = len;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    }
+
+    signal(SIGSEGV, segv);
+    signal(SIGINT, ctrlc);
+    return 0;
+}
+
+mpr_dev fixture_dev_new(const char *name, mpr_graph g)
+{
+    mpr_dev dev;
+    if (fixture_num_devs >= FIXTURE_MAX_DEVS)
+        return 0;
+    dev = mpr_dev_new(name, g);
+    if (!dev)
+        return 0;
+    fixture_devs[fixture_num_devs++] = dev;
+    if (iface)
+        mpr_graph_set_interface(mpr_obj_get_graph((mpr_obj)dev), iface);
+    eprintf("device '%s' created using interface %s.\n", name,
+            mpr_graph_get_interface(mpr_obj_get_graph((mpr_obj)dev)));
+    return dev;
+}
+
+static int all_ready(void)
+{
+    int i;
+    for (i = 0; i < fixture_num_devs; i++) {
+        if (!mpr_dev_get_is_ready(fixture_devs[i]))
+            return 0;
+    }
+    return 1;
+}
+
+void fixture_wait_ready(void)
+{
+    while (!done && !all_ready())
+        fixture_poll(25);
+}
+
+int fixture_map_sigs(int num, mpr_sig *srcs, mpr_sig *dsts, mpr_map *maps)
+{
+    int i, j, n;
+    for (i = 0; i < num && !done; i += n) {
+        n = num - i < MAP_BATCH ? num - i : MAP_BATCH;
+        for (j = i; j < i + n; j++) {
+            maps[j] = mpr_map_new(1, &srcs[j], 1, &dsts[j]);
+            mpr_obj_push(maps[j]);
+        }
+        /* wait until the batch has been established */
+        j = i;
+        while (!done && j < i + n) {
+            fixture_poll(10);
+            while (j < i + n && mpr_map_get_is_ready(maps[j]))
+                ++j;
+        }
+    }
+    return done;
+}
+
+void fixture_cleanup(mpr_graph g)
+{
+    int i;
+    for (i = 0; i < fixture_num_devs; i++) {
+        eprintf("Freeing device '%s'.. ", mpr_obj_get_prop_as_str((mpr_obj)fixture_devs[i],
+                                                                 MPR_PROP_NAME, NULL));
+        fflush(stdout);
+        mpr_dev_free(fixture_devs[i]);
+        eprintf("ok\n");
+    }
+    fixture_num_devs = 0;
+    if (g)
+        mpr_graph_free(g);
+}
+
+int fixture_report(int result, const char *details)
+{
+    printf("\r..................................................Test %s\x1B[0m.",
+           result ? "\x1B[31mFAILED" : "\x1B[32mPASSED");
+    if (details)
+        printf(" (%s)", details);
+    printf("\n");
+    return result;
+}
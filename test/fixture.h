@@ -0,0 +1,56 @@
+#ifndef __MPR_TEST_FIXTURE_H__
+#define __MPR_TEST_FIXTURE_H__
+
+#include <mapper/mapper.h>
+
+/* Setup shared by the tests that pass updates between local devices: command line flags,
+ * creating and freeing devices, waiting for devices and maps to become ready, and printing
+ * the result. */
+
+#define FIXTURE_MAX_DEVS 8
+
+extern int verbose;
+extern int terminate;
+extern int shared_graph;
+extern int fast;
+extern int done;
+
+/* Devices created using fixture_dev_new(), in order of creation. */
+extern mpr_dev fixture_devs[FIXTURE_MAX_DEVS];
+extern int fixture_num_devs;
+
+/* Handler for test-specific "--name value" options. Returns nonzero if the option was used. */
+typedef int fixture_opt_fn(const char *name, const char *value);
+
+/* Function used to poll the fixture devices while waiting, blocking for up to block_ms. The
+ * default calls mpr_dev_poll() on each device; tests using their own event loop replace it. */
+typedef void fixture_poll_fn(int block_ms);
+extern fixture_poll_fn *fixture_poll;
+
+void eprintf(const char *format, ...);
+
+double current_time(void);
+
+/* Parse the common flags -f, -q, -t, -s, -h and --iface, passing any other "--name value"
+ * options to 'opt', and install the signal handlers. 'usage' lists the test-specific options
+ * for the help text. Returns nonzero if the test should exit. */
+int fixture_init(int argc, char **argv, const char *name, const char *usage,
+                 fixture_opt_fn *opt);
+
+/* Create a device using the interface given on the command line. */
+mpr_dev fixture_dev_new(const char *name, mpr_graph g);
+
+/* Poll until all fixture devices are ready. */
+void fixture_wait_ready(void);
+
+/* Map each source signal to the corresponding destination signal and poll until the maps are
+ * ready. Returns nonzero if the test was interrupted. */
+int fixture_map_sigs(int num, mpr_sig *srcs, mpr_sig *dsts, mpr_map *maps);
+
+/* Free the fixture devices and the graph 'g' if given. */
+void fixture_cleanup(mpr_graph g);
+
+/* Print the test result, followed by 'details' if given. Returns 'result'. */
+int fixture_report(int result, const char *details);
+
+#endif /* __MPR_TEST_FIXTURE_H__ */
@@ -0,0 +1,224 @@
+#include "fixture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <string.h>
+
+#if defined(WIN32) || defined(_MSC_VER)
+#define HAVE_WIN32_THREADS 1
+#define SLEEP_MS(x) Sleep(x)
+#else
+#include <pthread.h>
+#define SLEEP_MS(x) usleep((x)*1000)
+#endif
+
+#define NUM_THREADS 4
+#define THREAD_SCALE 1000000
+
+mpr_dev src = 0;
+mpr_dev dst = 0;
+mpr_sig sendsig = 0;
+mpr_sig recvsig = 0;
+mpr_map map = 0;
+
+int iterations = 100000;
+volatile int num_running = 0;
+int sent[NUM_THREADS];
+int retries[NUM_THREADS];
+
+int received = 0;
+int out_of_order = 0;
+int last[NUM_THREADS];
+
+int setup_src(mpr_graph g)
+{
+    int mn = 0, mx = NUM_THREADS * THREAD_SCALE, num_inst = NUM_THREADS;
+
+    src = fixture_dev_new("testasync-send", g);
+    if (!src)
+        goto error;
+
+    sendsig = mpr_sig_new(src, MPR_DIR_OUT, "outsig", 1, MPR_INT32, NULL,
+                          &mn, &mx, &num_inst, NULL, 0);
+    if (!sendsig)
+        goto error;
+    eprintf("Output signal 'outsig' registered.\n");
+    return 0;
+
+  error:
+    return 1;
+}
+
+void handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
+             mpr_type type, const void *value, mpr_time t)
+{
+    int idx, count;
+    if (!value)
+        return;
+    ++received;
+    idx = *(int*)value / THREAD_SCALE;
+    count = *(int*)value % THREAD_SCALE;
+    if (idx < 0 || idx >= NUM_THREADS)
+        return;
+    /* updates from each thread should arrive in the order they were pushed */
+    if (count <= last[idx]) {
+        eprintf("thread %d: received %d after %d\n", idx, count, last[idx]);
+        ++out_of_order;
+    }
+    last[idx] = count;
+}
+
+int setup_dst(mpr_graph g)
+{
+    int num_inst = NUM_THREADS;
+
+    dst = fixture_dev_new("testasync-recv", g);
+    if (!dst)
+        goto error;
+
+    recvsig = mpr_sig_new(dst, MPR_DIR_IN, "insig", 1, MPR_INT32, NULL,
+                          NULL, NULL, &num_inst, handler, MPR_SIG_UPDATE);
+    if (!recvsig)
+        goto error;
+    eprintf("Input signal 'insig' registered.\n");
+    return 0;
+
+  error:
+    return 1;
+}
+
+/* Push updates for one instance as fast as possible, retrying whenever the queue is full. */
+#ifdef HAVE_WIN32_THREADS
+unsigned __stdcall update_thread(void *context)
+#else
+void *update_thread(void *context)
+#endif
+{
+    int idx = *(int*)context, value;
+    while (sent[idx] < iterations && !done) {
+        value = idx * THREAD_SCALE + sent[idx];
+        if (mpr_sig_set_value_async(sendsig, idx, 1, MPR_INT32, &value))
+            ++sent[idx];
+        else {
+            ++retries[idx];
+            SLEEP_MS(0);
+        }
+    }
+#ifdef HAVE_WIN32_THREADS
+    InterlockedDecrement((volatile long*)&num_running);
+#else
+    __sync_fetch_and_sub(&num_running, 1);
+#endif
+    return 0;
+}
+
+int loop()
+{
+    int i, result = 0, idx[NUM_THREADS];
+#ifdef HAVE_WIN32_THREADS
+    HANDLE threads[NUM_THREADS];
+#else
+    pthread_t threads[NUM_THREADS];
+#endif
+
+    num_running = NUM_THREADS;
+    for (i = 0; i < NUM_THREADS; i++) {
+        idx[i] = i;
+        last[i] = -1;
+#ifdef HAVE_WIN32_THREADS
+        if (!(threads[i] = (HANDLE)_beginthreadex(NULL, 0, &update_thread, &idx[i], 0, NULL))) {
+            printf("Error creating thread (_beginthreadex)\n");
+            exit(1);
+        }
+#else
+        if (pthread_create(&threads[i], 0, update_thread, &idx[i])) {
+            perror("error: pthread_create");
+            exit(1);
+        }
+#endif
+    }
+
+    /* poll both devices while the producer threads are running */
+    while (num_running > 0) {
+        mpr_dev_poll(src, 0);
+        mpr_dev_poll(dst, 1);
+        if (verbose) {
+            printf("\r  Sent: %8i, Received: %8i   ", sent[0] + sent[1] + sent[2] + sent[3],
+                   received);
+            fflush(stdout);
+        }
+    }
+    eprintf("\n");
+
+    for (i = 0; i < NUM_THREADS; i++) {
+#ifdef HAVE_WIN32_THREADS
+        if (WaitForSingleObject(threads[i], INFINITE))
+            printf("Error closing thread (WaitForSingleObject)\n");
+        CloseHandle(threads[i]);
+#else
+        if (pthread_join(threads[i], NULL))
+            printf("Error closing thread (pthread_join)\n");
+#endif
+    }
+
+    /* allow remaining updates to be routed and received */
+    for (i = 0; i < 100 && !done; i++) {
+        mpr_dev_poll(src, 0);
+        mpr_dev_poll(dst, 10);
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        eprintf("thread %d: pushed %d updates (%d retries), last received %d\n",
+                i, sent[i], retries[i], last[i]);
+        if (last[i] != sent[i] - 1)
+            result = 1;
+    }
+    if (out_of_order) {
+        eprintf("%d updates were received out of order.\n", out_of_order);
+        result = 1;
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    mpr_graph g;
+
+    if (fixture_init(argc, argv, "testasync", NULL, NULL))
+        return 1;
+    if (fast)
+        iterations = 10000;
+
+    g = shared_graph ? mpr_graph_new(0) : 0;
+
+    if (setup_dst(g)) {
+        eprintf("Error initializing destination.\n");
+        result = 1;
+        goto done;
+    }
+
+    if (setup_src(g)) {
+        eprintf("Error initializing source.\n");
+        result = 1;
+        goto done;
+    }
+
+    fixture_wait_ready();
+
+    if (fixture_map_sigs(1, &sendsig, &recvsig, &map)) {
+        eprintf("Error setting map.\n");
+        result = 1;
+        goto done;
+    }
+
+    result = loop();
+
+  done:
+    fixture_cleanup(g);
+    return fixture_report(result, NULL);
+}
@@ -0,0 +1,242 @@
+#include "fixture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_NUM_SIGS 256
+#define MAX_VEC_LEN 32
+#define MAX_LOG 65536
+
+mpr_dev src = 0;
+mpr_dev dst = 0;
+mpr_sig sendsigs[MAX_NUM_SIGS];
+mpr_sig recvsigs[MAX_NUM_SIGS];
+mpr_map maps[MAX_NUM_SIGS];
+
+int num_sigs = 32;
+int vec_len = 16;
+int num_threads = 4;
+int iterations = 200;
+int received = 0;
+
+/* Updates received during a pass, in order of arrival. */
+typedef struct {
+    int sig;
+    float value;
+} update_t;
+
+update_t logs[2][MAX_LOG];
+int log_size[2];
+int pass = 0;
+
+int setup_src(mpr_graph g)
+{
+    int i, j;
+    char name[32];
+    float mn[MAX_VEC_LEN], mx[MAX_VEC_LEN];
+
+    src = fixture_dev_new("testevalpool-send", g);
+    if (!src)
+        goto error;
+
+    /* give each map a different linear scaling */
+    for (i = 0; i < num_sigs; i++) {
+        snprintf(name, 32, "outsig%d", i);
+        for (j = 0; j < vec_len; j++) {
+            mn[j] = 0;
+            mx[j] = i + j + 1;
+        }
+        sendsigs[i] = mpr_sig_new(src, MPR_DIR_OUT, name, vec_len, MPR_FLT, NULL,
+                                  mn, mx, NULL, NULL, 0);
+        if (!sendsigs[i])
+            goto error;
+    }
+    return 0;
+
+  error:
+    return 1;
+}
+
+void handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
+             mpr_type type, const void *value, mpr_time t)
+{
+    int i;
+    float sum = 0;
+    if (!value)
+        return;
+    ++received;
+    if (log_size[pass] >= MAX_LOG)
+        return;
+    for (i = 0; i < length; i++)
+        sum += ((float*)value)[i];
+    for (i = 0; i < num_sigs; i++) {
+        if (sig == recvsigs[i])
+            break;
+    }
+    logs[pass][log_size[pass]].sig = i;
+    logs[pass][log_size[pass]].value = sum;
+    ++log_size[pass];
+}
+
+int setup_dst(mpr_graph g)
+{
+    int i;
+    char name[32];
+    float mn[MAX_VEC_LEN], mx[MAX_VEC_LEN];
+
+    dst = fixture_dev_new("testevalpool-recv", g);
+    if (!dst)
+        goto error;
+
+    for (i = 0; i < vec_len; i++) {
+        mn[i] = 0;
+        mx[i] = 1;
+    }
+    for (i = 0; i < num_sigs; i++) {
+        snprintf(name, 32, "insig%d", i);
+        recvsigs[i] = mpr_sig_new(dst, MPR_DIR_IN, name, vec_len, MPR_FLT, NULL,
+                                  mn, mx, NULL, handler, MPR_SIG_UPDATE);
+        if (!recvsigs[i])
+            goto error;
+    }
+    return 0;
+
+  error:
+    return 1;
+}
+
+/* Update every signal once per frame, time the processing of the outgoing maps and wait for the
+ * updates to arrive before starting the next frame. */
+double loop()
+{
+    int i, j, k, expected;
+    float value[MAX_VEC_LEN];
+    double elapsed = 0, then;
+    received = 0;
+    for (i = 0; i < iterations && !done; i++) {
+        then = current_time();
+        for (j = 0; j < num_sigs; j++) {
+            for (k = 0; k < vec_len; k++)
+                value[k] = (i + j + k) % 100;
+            mpr_sig_set_value(sendsigs[j], 0, vec_len, MPR_FLT, value);
+        }
+        mpr_dev_update_maps(src);
+        elapsed += current_time() - then;
+        expected = (i + 1) * num_sigs;
+        for (j = 0; j < 100 && received < expected && !done; j++)
+            fixture_poll(10);
+    }
+    return elapsed;
+}
+
+/* Check that both passes received the same values in the same order. */
+int compare_logs()
+{
+    int i;
+    if (log_size[0] != log_size[1]) {
+        eprintf("Received %d updates without threads and %d with threads.\n",
+                log_size[0], log_size[1]);
+        return 1;
+    }
+    for (i = 0; i < log_size[0]; i++) {
+        if (logs[0][i].sig != logs[1][i].sig || logs[0][i].value != logs[1][i].value) {
+            eprintf("Update %d differs: insig%d=%g without threads, insig%d=%g with threads.\n",
+                    i, logs[0][i].sig, logs[0][i].value, logs[1][i].sig, logs[1][i].value);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_opt(const char *name, const char *value)
+{
+    if (strcmp(name, "--num_sigs") == 0)
+        num_sigs = atoi(value);
+    else if (strcmp(name, "--vec_len") == 0)
+        vec_len = atoi(value);
+    else if (strcmp(name, "--threads") == 0)
+        num_threads = atoi(value);
+    else
+        return 0;
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    char usage[192], details[128];
+    double elapsed[2] = {0, 0};
+    mpr_graph g;
+
+    snprintf(usage, 192, "--num_sigs <int> (default %d, max %d), --vec_len <int> (default %d, "
+             "max %d), --threads <int> (default %d), ", num_sigs, MAX_NUM_SIGS, vec_len,
+             MAX_VEC_LEN, num_threads);
+    if (fixture_init(argc, argv, "testevalpool", usage, parse_opt))
+        return 1;
+    if (fast)
+        iterations = 50;
+
+    /* the pool is only used for passes with enough updated maps */
+    if (num_sigs < 16)
+        num_sigs = 16;
+    else if (num_sigs > MAX_NUM_SIGS)
+        num_sigs = MAX_NUM_SIGS;
+    if (vec_len < 1)
+        vec_len = 1;
+    else if (vec_len > MAX_VEC_LEN)
+        vec_len = MAX_VEC_LEN;
+    if (num_threads < 2)
+        num_threads = 2;
+    if (iterations * num_sigs > MAX_LOG)
+        iterations = MAX_LOG / num_sigs;
+
+    g = shared_graph ? mpr_graph_new(0) : 0;
+
+    if (setup_dst(g)) {
+        eprintf("Error initializing destination.\n");
+        result = 1;
+        goto done;
+    }
+
+    if (setup_src(g)) {
+        eprintf("Error initializing source.\n");
+        result = 1;
+        goto done;
+    }
+
+    fixture_wait_ready();
+
+    if (fixture_map_sigs(num_sigs, sendsigs, recvsigs, maps)) {
+        eprintf("Error setting maps.\n");
+        result = 1;
+        goto done;
+    }
+
+    eprintf("Updating %d maps without threads.\n", num_sigs);
+    elapsed[0] = loop();
+
+    if (mpr_dev_set_num_eval_threads(src, num_threads)) {
+        eprintf("Error starting %d evaluation threads.\n", num_threads);
+        result = 1;
+        goto done;
+    }
+    eprintf("Updating %d maps using %d threads.\n", num_sigs, num_threads);
+    pass = 1;
+    elapsed[1] = loop();
+
+    if (log_size[0] != iterations * num_sigs) {
+        eprintf("Expected %d updates, received %d.\n", iterations * num_sigs, log_size[0]);
+        result = 1;
+    }
+    else
+        result = compare_logs();
+
+  done:
+    fixture_cleanup(g);
+    if (result)
+        return fixture_report(result, NULL);
+    snprintf(details, 128, "%d maps: %.3f us per frame, %.3f us with %d threads", num_sigs,
+             elapsed[0] * 1000000. / iterations, elapsed[1] * 1000000. / iterations,
+             num_threads);
+    return fixture_report(result, details);
+}
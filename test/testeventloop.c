@@ -0,0 +1,211 @@
+#include "fixture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef WIN32
+#include <io.h>
+#include <winsock2.h>
+#else
+#include <unistd.h>
+#include <sys/select.h>
+#endif
+#include <string.h>
+
+#define MAX_FDS 8
+
+mpr_dev src = 0;
+mpr_dev dst = 0;
+mpr_sig sendsig = 0;
+mpr_sig recvsig = 0;
+mpr_map map = 0;
+
+int iterations = 1000;
+int sent = 0;
+int received = 0;
+int wakeups = 0;
+
+int setup_src(mpr_graph g)
+{
+    int mn = 0, mx = 1000;
+
+    src = fixture_dev_new("testeventloop-send", g);
+    if (!src)
+        goto error;
+
+    sendsig = mpr_sig_new(src, MPR_DIR_OUT, "outsig", 1, MPR_INT32, NULL,
+                          &mn, &mx, NULL, NULL, 0);
+    if (!sendsig)
+        goto error;
+    eprintf("Output signal 'outsig' registered.\n");
+    return 0;
+
+  error:
+    return 1;
+}
+
+void handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
+             mpr_type type, const void *value, mpr_time t)
+{
+    if (value) {
+        eprintf("handler: Got %d\n", *(int*)value);
+        ++received;
+    }
+}
+
+int setup_dst(mpr_graph g)
+{
+    dst = fixture_dev_new("testeventloop-recv", g);
+    if (!dst)
+        goto error;
+
+    recvsig = mpr_sig_new(dst, MPR_DIR_IN, "insig", 1, MPR_INT32, NULL,
+                          NULL, NULL, NULL, handler, MPR_SIG_UPDATE);
+    if (!recvsig)
+        goto error;
+    eprintf("Input signal 'insig' registered.\n");
+    return 0;
+
+  error:
+    return 1;
+}
+
+/* Wait on the file descriptors of both devices until one is readable, a timer is due or
+ * block_ms has elapsed. */
+void wait_and_process(int block_ms)
+{
+    mpr_dev devs[2] = {src, dst};
+    int i, j, num, fds[2][MAX_FDS], num_fds[2], timeout, max_fd = -1;
+    struct timeval tv;
+    fd_set set;
+
+    FD_ZERO(&set);
+    timeout = mpr_dev_get_timeout(src);
+    for (i = 0; i < 2; i++) {
+        num_fds[i] = mpr_dev_get_fds(devs[i], fds[i], MAX_FDS);
+        if (num_fds[i] > MAX_FDS)
+            num_fds[i] = MAX_FDS;
+        for (j = 0; j < num_fds[i]; j++) {
+            FD_SET(fds[i][j], &set);
+            if (fds[i][j] > max_fd)
+                max_fd = fds[i][j];
+        }
+        num = mpr_dev_get_timeout(devs[i]);
+        if (num < timeout)
+            timeout = num;
+    }
+    if (timeout > block_ms)
+        timeout = block_ms;
+    tv.tv_sec = 0;
+    tv.tv_usec = timeout * 1000;
+
+    num = select(max_fd + 1, &set, NULL, NULL, &tv);
+    if (num > 0) {
+        ++wakeups;
+        for (i = 0; i < 2; i++) {
+            for (j = 0; j < num_fds[i]; j++) {
+                if (FD_ISSET(fds[i][j], &set))
+                    mpr_dev_process_fd(devs[i], fds[i][j]);
+            }
+        }
+    }
+    for (i = 0; i < 2; i++) {
+        if (!mpr_dev_get_timeout(devs[i]))
+            mpr_dev_process_timers(devs[i]);
+    }
+}
+
+/* Send 'num' updates, blocking for up to block_ms at a time until each one has been received.
+ * Returns the longest time taken to receive an update. */
+double loop(int num, int block_ms)
+{
+    int i, start = sent;
+    double then, latency, max_latency = 0;
+    eprintf("Polling device..\n");
+    while ((!terminate || sent - start < num) && !done) {
+        eprintf("Updating signal %s to %d\n", mpr_obj_get_prop_as_str(sendsig, MPR_PROP_NAME, NULL),
+                sent);
+        then = current_time();
+        mpr_sig_set_value(sendsig, 0, 1, MPR_INT32, &sent);
+        ++sent;
+        mpr_dev_update_maps(src);
+
+        /* block until the update has been received, giving up after ten waits */
+        for (i = 0; i < 10 && received < sent && !done; i++)
+            wait_and_process(block_ms);
+        latency = current_time() - then;
+        if (latency > max_latency)
+            max_latency = latency;
+
+        if (!verbose) {
+            printf("\r  Sent: %4i, Received: %4i   ", sent, received);
+            fflush(stdout);
+        }
+    }
+    return max_latency;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    mpr_graph g;
+
+    if (fixture_init(argc, argv, "testeventloop", NULL, NULL))
+        return 1;
+    if (fast)
+        iterations = 100;
+    fixture_poll = wait_and_process;
+
+    g = shared_graph ? mpr_graph_new(0) : 0;
+
+    if (setup_dst(g)) {
+        eprintf("Error initializing destination.\n");
+        result = 1;
+        goto done;
+    }
+
+    if (setup_src(g)) {
+        eprintf("Error initializing source.\n");
+        result = 1;
+        goto done;
+    }
+
+    fixture_wait_ready();
+
+    if (fixture_map_sigs(1, &sendsig, &recvsig, &map)) {
+        eprintf("Error setting map.\n");
+        result = 1;
+        goto done;
+    }
+
+    /* wake up at least every 100ms so that ctrl-c is handled promptly */
+    loop(iterations, 100);
+
+    /* Updates of TCP maps arrive over a connection accepted by the destination, which is not
+     * among its file descriptors. Block for longer than the network timers to check that they are
+     * still handled promptly. */
+    if (!done && sent == received) {
+        int i, proto = MPR_PROTO_TCP;
+        double latency;
+        mpr_obj_set_prop(map, MPR_PROP_PROTOCOL, NULL, 1, MPR_INT32, &proto, 1);
+        mpr_obj_push(map);
+        for (i = 0; i < 10; i++)
+            wait_and_process(50);
+        latency = loop(iterations / 10, 10000);
+        eprintf("Longest wait for an update over TCP: %f seconds.\n", latency);
+        if (latency > 0.5) {
+            eprintf("Updates over TCP were delayed.\n");
+            result = 1;
+        }
+    }
+
+    if (sent != received) {
+        eprintf("Not all sent messages were received.\n");
+        eprintf("Updated value %d time%s, but received %d of them.\n",
+                sent, sent == 1 ? "" : "s", received);
+        result = 1;
+    }
+    eprintf("Processed %d updates using %d wakeups.\n", received, wakeups);
+
+  done:
+    fixture_cleanup(g);
+    return fixture_report(result, NULL);
+}
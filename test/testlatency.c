@@ -0,0 +1,173 @@
+#include "fixture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <string.h>
+
+#if defined(WIN32) || defined(_MSC_VER)
+#define SLEEP_MS(x) Sleep(x)
+#else
+#define SLEEP_MS(x) usleep((x)*1000)
+#endif
+
+/* Without a wakeup, updates wait for the polling thread's 100ms timeout slice. */
+#define MAX_MEAN_LATENCY_MS 25
+
+mpr_dev src = 0;
+mpr_dev dst = 0;
+mpr_sig sendsig = 0;
+mpr_sig recvsig = 0;
+mpr_map map = 0;
+
+int iterations = 100;
+int sent = 0;
+int received = 0;
+
+double sent_time = 0;
+double total_latency = 0;
+double max_latency = 0;
+
+int setup_src(mpr_graph g)
+{
+    int mn = 0, mx = 1000;
+
+    src = fixture_dev_new("testlatency-send", g);
+    if (!src)
+        goto error;
+
+    sendsig = mpr_sig_new(src, MPR_DIR_OUT, "outsig", 1, MPR_INT32, NULL,
+                          &mn, &mx, NULL, NULL, 0);
+    if (!sendsig)
+        goto error;
+    eprintf("Output signal 'outsig' registered.\n");
+    return 0;
+
+  error:
+    return 1;
+}
+
+void handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
+             mpr_type type, const void *value, mpr_time t)
+{
+    double latency;
+    if (!value)
+        return;
+    latency = current_time() - sent_time;
+    total_latency += latency;
+    if (latency > max_latency)
+        max_latency = latency;
+    eprintf("handler: Got %d after %f ms\n", *(int*)value, latency * 1000);
+    ++received;
+}
+
+int setup_dst(mpr_graph g)
+{
+    dst = fixture_dev_new("testlatency-recv", g);
+    if (!dst)
+        goto error;
+
+    recvsig = mpr_sig_new(dst, MPR_DIR_IN, "insig", 1, MPR_INT32, NULL,
+                          NULL, NULL, NULL, handler, MPR_SIG_UPDATE);
+    if (!recvsig)
+        goto error;
+    eprintf("Input signal 'insig' registered.\n");
+    return 0;
+
+  error:
+    return 1;
+}
+
+/* Push updates from this thread while the source device is polled by its own thread, and wait
+ * for each update to reach the destination handler. */
+int loop()
+{
+    int i;
+    mpr_dev_start_polling(src);
+
+    /* let the polling thread settle into a blocking wait */
+    SLEEP_MS(200);
+
+    while (sent < iterations && !done) {
+        sent_time = current_time();
+        if (!mpr_sig_set_value_async(sendsig, 0, 1, MPR_INT32, &sent)) {
+            eprintf("Error: async update queue is full.\n");
+            break;
+        }
+        ++sent;
+        /* wait up to 1 second for the update to be received */
+        for (i = 0; i < 1000 && received < sent && !done; i++)
+            mpr_dev_poll(dst, 1);
+        if (received < sent)
+            break;
+        if (!verbose) {
+            printf("\r  Sent: %4i, Received: %4i   ", sent, received);
+            fflush(stdout);
+        }
+        /* stagger updates so they arrive at different points in the poll timeout */
+        mpr_dev_poll(dst, 7 + sent % 13);
+    }
+
+    mpr_dev_stop_polling(src);
+
+    if (received < sent) {
+        eprintf("Update %d was not received.\n", sent - 1);
+        return 1;
+    }
+    if (!received)
+        return 1;
+    eprintf("Mean latency %f ms, max %f ms.\n", total_latency * 1000 / received,
+            max_latency * 1000);
+    if (total_latency * 1000 / received > MAX_MEAN_LATENCY_MS) {
+        eprintf("Mean latency exceeds %d ms.\n", MAX_MEAN_LATENCY_MS);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    mpr_graph g;
+
+    if (fixture_init(argc, argv, "testlatency", NULL, NULL))
+        return 1;
+    if (fast)
+        iterations = 20;
+
+    g = shared_graph ? mpr_graph_new(0) : 0;
+
+    if (setup_dst(g)) {
+        eprintf("Error initializing destination.\n");
+        result = 1;
+        goto done;
+    }
+
+    if (setup_src(g)) {
+        eprintf("Error initializing source.\n");
+        result = 1;
+        goto done;
+    }
+
+    fixture_wait_ready();
+
+    if (fixture_map_sigs(1, &sendsig, &recvsig, &map)) {
+        eprintf("Error setting map.\n");
+        result = 1;
+        goto done;
+    }
+
+    result = loop();
+
+  done:
+    fixture_cleanup(g);
+    if (received) {
+        char details[64];
+        snprintf(details, 64, "%f ms mean latency", total_latency * 1000 / received);
+        return fixture_report(result, details);
+    }
+    return fixture_report(result, NULL);
+}
@@ -0,0 +1,187 @@
+#include "fixture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Signals are currently limited to 128 instances, so touches are spread across several signals. */
+#define MAX_NUM_SIGS 8
+#define MAX_INST_PER_SIG 100
+
+mpr_dev src = 0;
+mpr_dev dst = 0;
+mpr_sig sendsigs[MAX_NUM_SIGS];
+mpr_sig recvsigs[MAX_NUM_SIGS];
+mpr_map maps[MAX_NUM_SIGS];
+
+int num_inst = 200;
+int num_sigs = 0;
+int iterations = 1000;
+int num_eval_threads = 0;
+int received = 0;
+
+/* Return the number of instances assigned to signal 'idx'. */
+static int sig_num_inst(int idx)
+{
+    int n = num_inst - idx * MAX_INST_PER_SIG;
+    return n > MAX_INST_PER_SIG ? MAX_INST_PER_SIG : n;
+}
+
+int setup_src(mpr_graph g)
+{
+    int i, n;
+    char name[32];
+    float mn = 0, mx = 1;
+
+    src = fixture_dev_new("testmultitouch-send", g);
+    if (!src)
+        goto error;
+    if (num_eval_threads && mpr_dev_set_num_eval_threads(src, num_eval_threads))
+        goto error;
+
+    for (i = 0; i < num_sigs; i++) {
+        n = sig_num_inst(i);
+        snprintf(name, 32, "touch%d", i);
+        sendsigs[i] = mpr_sig_new(src, MPR_DIR_OUT, name, 2, MPR_FLT, NULL,
+                                  &mn, &mx, &n, NULL, 0);
+        if (!sendsigs[i])
+            goto error;
+        eprintf("Output signal '%s' has %d instances.\n", name,
+                mpr_sig_get_num_inst(sendsigs[i], MPR_STATUS_ANY));
+    }
+    return 0;
+
+  error:
+    return 1;
+}
+
+void handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
+             mpr_type type, const void *value, mpr_time t)
+{
+    if (value)
+        ++received;
+}
+
+int setup_dst(mpr_graph g)
+{
+    int i, n;
+    char name[32];
+
+    dst = fixture_dev_new("testmultitouch-recv", g);
+    if (!dst)
+        goto error;
+
+    for (i = 0; i < num_sigs; i++) {
+        n = sig_num_inst(i);
+        snprintf(name, 32, "touch%d", i);
+        recvsigs[i] = mpr_sig_new(dst, MPR_DIR_IN, name, 2, MPR_FLT, NULL,
+                                  NULL, NULL, &n, handler, MPR_SIG_UPDATE);
+        if (!recvsigs[i])
+            goto error;
+    }
+    return 0;
+
+  error:
+    return 1;
+}
+
+/* Update every active touch once per frame and time the processing of outgoing maps. */
+double loop()
+{
+    int i, j, k, n;
+    float value[2];
+    double elapsed = 0, then;
+    for (i = 0; i < iterations && !done; i++) {
+        then = current_time();
+        for (j = 0; j < num_sigs; j++) {
+            n = sig_num_inst(j);
+            for (k = 0; k < n; k++) {
+                value[0] = (i + k) % 100 * 0.01f;
+                value[1] = (i + j) % 100 * 0.01f;
+                mpr_sig_set_value(sendsigs[j], k, 2, MPR_FLT, value);
+            }
+        }
+        mpr_dev_update_maps(src);
+        elapsed += current_time() - then;
+        fixture_poll(0);
+        if (verbose && !(i % 100)) {
+            printf("\r  frame %d: received %d updates", i, received);
+            fflush(stdout);
+        }
+    }
+    eprintf("\n");
+    return elapsed;
+}
+
+static int parse_opt(const char *name, const char *value)
+{
+    if (strcmp(name, "--num_inst") == 0)
+        num_inst = atoi(value);
+    else if (strcmp(name, "--threads") == 0)
+        num_eval_threads = atoi(value);
+    else
+        return 0;
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int i, result = 0;
+    char usage[128], details[64];
+    double elapsed = 0;
+    mpr_graph g;
+
+    snprintf(usage, 128, "--num_inst <int> (default %d, max %d), "
+             "--threads <int> evaluate maps using several threads, ", num_inst,
+             MAX_NUM_SIGS * MAX_INST_PER_SIG);
+    if (fixture_init(argc, argv, "testmultitouch", usage, parse_opt))
+        return 1;
+    if (fast)
+        iterations = 100;
+
+    if (num_inst < 1)
+        num_inst = 1;
+    else if (num_inst > MAX_NUM_SIGS * MAX_INST_PER_SIG)
+        num_inst = MAX_NUM_SIGS * MAX_INST_PER_SIG;
+    num_sigs = (num_inst + MAX_INST_PER_SIG - 1) / MAX_INST_PER_SIG;
+
+    g = shared_graph ? mpr_graph_new(0) : 0;
+
+    if (setup_dst(g)) {
+        eprintf("Error initializing destination.\n");
+        result = 1;
+        goto done;
+    }
+
+    if (setup_src(g)) {
+        eprintf("Error initializing source.\n");
+        result = 1;
+        goto done;
+    }
+
+    fixture_wait_ready();
+
+    if (fixture_map_sigs(num_sigs, sendsigs, recvsigs, maps)) {
+        eprintf("Error setting maps.\n");
+        result = 1;
+        goto done;
+    }
+
+    elapsed = loop();
+
+    /* allow remaining messages to be received */
+    for (i = 0; i < 10; i++)
+        fixture_poll(10);
+    eprintf("%d instance updates sent, %d received.\n", iterations * num_inst, received);
+    if (!received) {
+        eprintf("No updates were received.\n");
+        result = 1;
+    }
+
+  done:
+    fixture_cleanup(g);
+    if (result)
+        return fixture_report(result, NULL);
+    snprintf(details, 64, "%d instances: %f us per frame", num_inst,
+             elapsed * 1000000. / iterations);
+    return fixture_report(result, details);
+}
@@ -331,12 +331,18 @@ int parse_and_eval(int expectation, int max_tokens, int check, int exp_updates)
     }
     user_vars_p = user_vars;
 
-    eprintf("Parser returned %d tokens...", e->n_tokens);
+    eprintf("Parser returned %d tokens (%d before optimization)...", e->n_tokens,
+            mpr_expr_get_num_tokens(e, 0));
     if (max_tokens && e->n_tokens > max_tokens) {
         eprintf(" (expected %d)\n", max_tokens);
         result = 1;
         goto free;
     }
+    else if (e->n_tokens > mpr_expr_get_num_tokens(e, 0)) {
+        eprintf(" (optimization added tokens)\n");
+        result = 1;
+        goto free;
+    }
     else {
         eprintf(" OK\n");
     }
@@ -424,9 +430,321 @@ fail:
     return 1;
 }
 
-int run_tests()
+#define LONG_VEC_LEN 64
+
+/*! Fill a long input vector, placing its minimum in the last element so that it is handled by
+ *  the scalar tail of the vector kernels. */
+static void long_vec_vals(double *v, int len, mpr_type type)
 {
     int i;
+    for (i = 0; i < len; i++) {
+        v[i] = 0.5 + fmod(i * 0.37, 4.5);
+        if (MPR_FLT == type)
+            v[i] = (float)v[i];
+    }
+    v[len - 1] = -v[len - 1];
+}
+
+/*! Evaluate an expression once on a long vector and compare the output with values computed by
+ *  scalar loops. Vector kernels may sum in a different order, so a relative tolerance is used. */
+static int check_long_vec(const char *expr_str, mpr_type type, int len, int out_len,
+                          const double *expect)
+{
+    mpr_value_t in_val, out_val;
+    mpr_value in_p = &in_val;
+    mpr_type types[LONG_VEC_LEN];
+    float flt[LONG_VEC_LEN];
+    double dbl[LONG_VEC_LEN], tol = MPR_FLT == type ? 1e-5 : 1e-12;
+    void *out;
+    int i, result = 0;
+    mpr_expr expr;
+
+    eprintf("Evaluating '%s' on %s vector of length %d... ", expr_str,
+            MPR_FLT == type ? "float" : "double", len);
+    expr = mpr_expr_new_from_str(eval_stk, expr_str, 1, &type, &len, type, out_len);
+    if (!expr) {
+        eprintf("parser FAILED\n");
+        return 1;
+    }
+    memset(&in_val, 0, sizeof(mpr_value_t));
+    memset(&out_val, 0, sizeof(mpr_value_t));
+    mpr_value_realloc(&in_val, len, type, mpr_expr_get_in_hist_size(expr, 0), 1, 0);
+    mpr_value_realloc(&out_val, out_len, type, mpr_expr_get_out_hist_size(expr), 1, 1);
+
+    long_vec_vals(dbl, len, type);
+    for (i = 0; i < len; i++)
+        flt[i] = dbl[i];
+    mpr_time_set(&time_in, MPR_NOW);
+    mpr_value_set_samp(&in_val, 0, MPR_FLT == type ? (void*)flt : (void*)dbl, time_in);
+
+    if (!(mpr_expr_eval(eval_stk, expr, &in_p, &user_vars_p, &out_val, &time_in, types, 0)
+          & MPR_SIG_UPDATE)) {
+        eprintf("evaluation FAILED\n");
+        result = 1;
+    }
+    else {
+        out = mpr_value_get_samp(&out_val, 0);
+        for (i = 0; i < out_len; i++) {
+            double val = MPR_FLT == type ? ((float*)out)[i] : ((double*)out)[i];
+            if (fabs(val - expect[i]) > tol * (fabs(expect[i]) + 1)) {
+                eprintf("error at index %d: got %g, expected %g\n", i, val, expect[i]);
+                result = 1;
+                break;
+            }
+        }
+        if (!result)
+            eprintf("OK\n");
+    }
+
+    mpr_value_free(&in_val);
+    mpr_value_free(&out_val);
+    mpr_expr_free(expr);
+    return result;
+}
+
+#define BATCH_INST 70
+
+/*! Evaluate an expression for several instances at once using mpr_expr_eval_batch() and compare
+ *  the output, output types and status of each instance with those of mpr_expr_eval(). */
+static int check_batch(const char *expr_str, mpr_type type, int len, int rounds)
+{
+    mpr_value_t in_val, out_batch, out_single;
+    mpr_value in_p = &in_val;
+    mpr_type types_batch[BATCH_INST * 3], types_single[3];
+    int idx[BATCH_INST], status_batch[BATCH_INST], status, i, j, r, result = 0;
+    int ival[3];
+    float fval[3];
+    double dval[3];
+    size_t size = mpr_type_get_size(type) * len;
+    mpr_expr expr;
+
+    eprintf("Evaluating '%s' for %d instances in %d rounds... ", expr_str, BATCH_INST, rounds);
+    expr = mpr_expr_new_from_str(eval_stk, expr_str, 1, &type, &len, type, len);
+    if (!expr) {
+        eprintf("parser FAILED\n");
+        return 1;
+    }
+    memset(&in_val, 0, sizeof(mpr_value_t));
+    memset(&out_batch, 0, sizeof(mpr_value_t));
+    memset(&out_single, 0, sizeof(mpr_value_t));
+    mpr_value_realloc(&in_val, len, type, mpr_expr_get_in_hist_size(expr, 0), BATCH_INST, 0);
+    mpr_value_realloc(&out_batch, len, type, mpr_expr_get_out_hist_size(expr), BATCH_INST, 1);
+    mpr_value_realloc(&out_single, len, type, mpr_expr_get_out_hist_size(expr), BATCH_INST, 1);
+
+    for (r = 0; r < rounds && !result; r++) {
+        mpr_time_set(&time_in, MPR_NOW);
+        for (i = 0; i < BATCH_INST; i++) {
+            for (j = 0; j < len; j++) {
+                dval[j] = (i + 1) * 0.25 + r * 1.5 - j;
+                fval[j] = dval[j];
+                ival[j] = i * 3 + r - j;
+            }
+            mpr_value_set_samp(&in_val, i, MPR_INT32 == type ? (void*)ival
+                               : MPR_FLT == type ? (void*)fval : (void*)dval, time_in);
+            idx[i] = i;
+        }
+        mpr_expr_eval_batch(eval_stk, expr, &in_p, &user_vars_p, &out_batch, &time_in,
+                            types_batch, status_batch, idx, BATCH_INST);
+        for (i = 0; i < BATCH_INST; i++) {
+            status = mpr_expr_eval(eval_stk, expr, &in_p, &user_vars_p, &out_single, &time_in,
+                                   types_single, i);
+            if (status != status_batch[i]) {
+                eprintf("error in round %d: instance %d status %d, expected %d\n", r, i,
+                        status_batch[i], status);
+                result = 1;
+                break;
+            }
+            if (memcmp(types_single, types_batch + i * len, len)
+                || memcmp(mpr_value_get_samp(&out_single, i), mpr_value_get_samp(&out_batch, i),
+                          size)) {
+                eprintf("error in round %d: instance %d output differs\n", r, i);
+                result = 1;
+                break;
+            }
+        }
+    }
+    if (!result)
+        eprintf("OK\n");
+
+    mpr_value_free(&in_val);
+    mpr_value_free(&out_batch);
+    mpr_value_free(&out_single);
+    mpr_expr_free(expr);
+    return result;
+}
+
+#define FILT_STEPS 40
+
+/*! Return element 'el' of the input used for filter tests at update 't'. */
+static double filt_input(int t, int el)
+{
+    return sin(0.3 * t + el) * (el + 1);
+}
+
+/*! Run a filter on a long vector input for several updates and compare each output element with
+ *  the same filter run on a scalar input, using a separate instance per element, or with a direct
+ *  FIR sum if coefficients are given. */
+static int check_filter(const char *expr_str, mpr_type type, int len, const double *coefs,
+                        int n_taps)
+{
+    mpr_value_t in_long, out_long, in_one, out_one;
+    mpr_value in_long_p = &in_long, in_one_p = &in_one;
+    mpr_type types[LONG_VEC_LEN];
+    float flt[LONG_VEC_LEN];
+    double dbl[LONG_VEC_LEN], got, expect;
+    int one = 1, i, k, t, result = 0;
+    mpr_expr e_long, e_one;
+
+    eprintf("Filtering %s vector of length %d with '%s' for %d updates... ",
+            MPR_FLT == type ? "float" : "double", len, expr_str, FILT_STEPS);
+    e_long = mpr_expr_new_from_str(eval_stk, expr_str, 1, &type, &len, type, len);
+    e_one = mpr_expr_new_from_str(eval_stk, expr_str, 1, &type, &one, type, 1);
+    if (!e_long || !e_one) {
+        eprintf("parser FAILED\n");
+        result = 1;
+        goto done;
+    }
+    memset(&in_long, 0, sizeof(mpr_value_t));
+    memset(&out_long, 0, sizeof(mpr_value_t));
+    memset(&in_one, 0, sizeof(mpr_value_t));
+    memset(&out_one, 0, sizeof(mpr_value_t));
+    mpr_value_realloc(&in_long, len, type, mpr_expr_get_in_hist_size(e_long, 0), 1, 0);
+    mpr_value_realloc(&out_long, len, type, mpr_expr_get_out_hist_size(e_long), 1, 1);
+    mpr_value_realloc(&in_one, 1, type, mpr_expr_get_in_hist_size(e_one, 0), len, 0);
+    mpr_value_realloc(&out_one, 1, type, mpr_expr_get_out_hist_size(e_one), len, 1);
+
+    for (t = 0; t < FILT_STEPS && !result; t++) {
+        mpr_time_set(&time_in, MPR_NOW);
+        for (i = 0; i < len; i++)
+            flt[i] = dbl[i] = filt_input(t, i);
+        mpr_value_set_samp(&in_long, 0, MPR_FLT == type ? (void*)flt : (void*)dbl, time_in);
+        mpr_expr_eval(eval_stk, e_long, &in_long_p, &user_vars_p, &out_long, &time_in, types, 0);
+        for (i = 0; i < len; i++) {
+            got = (MPR_FLT == type ? ((float*)mpr_value_get_samp(&out_long, 0))[i]
+                                   : ((double*)mpr_value_get_samp(&out_long, 0))[i]);
+            if (coefs) {
+                /* filters start from the steady state for their first input */
+                for (k = 0, expect = 0; k < n_taps; k++)
+                    expect += coefs[k] * filt_input(t > k ? t - k : 0, i);
+                if (fabs(got - expect) <= 1e-9 * (fabs(expect) + 1))
+                    continue;
+            }
+            else {
+                mpr_value_set_samp(&in_one, i, MPR_FLT == type ? (void*)&flt[i] : (void*)&dbl[i],
+                                   time_in);
+                mpr_expr_eval(eval_stk, e_one, &in_one_p, &user_vars_p, &out_one, &time_in,
+                              types, i);
+                expect = (MPR_FLT == type ? *(float*)mpr_value_get_samp(&out_one, i)
+                                          : *(double*)mpr_value_get_samp(&out_one, i));
+                if (got == expect)
+                    continue;
+            }
+            eprintf("error at update %d, index %d: got %g, expected %g\n", t, i, got, expect);
+            result = 1;
+            break;
+        }
+    }
+    if (!result)
+        eprintf("OK\n");
+
+    mpr_value_free(&in_long);
+    mpr_value_free(&out_long);
+    mpr_value_free(&in_one);
+    mpr_value_free(&out_one);
+  done:
+    if (e_long)
+        mpr_expr_free(e_long);
+    if (e_one)
+        mpr_expr_free(e_one);
+    return result;
+}
+
+/* Maps evaluate their expression without inputs when it is set, to initialise literals. This
+ * must leave the initialised history in place for the first update. */
+static int check_init_eval(const char *expr_str, int x, int expect)
+{
+    mpr_value_t in, out;
+    mpr_value in_p = &in;
+    mpr_type type = MPR_INT32, types[1];
+    int one = 1, got, result = 0;
+    mpr_expr ex;
+
+    eprintf("Evaluating '%s' without inputs before the first update... ", expr_str);
+    ex = mpr_expr_new_from_str(eval_stk, expr_str, 1, &type, &one, type, 1);
+    if (!ex) {
+        eprintf("parser FAILED\n");
+        return 1;
+    }
+    memset(&in, 0, sizeof(mpr_value_t));
+    memset(&out, 0, sizeof(mpr_value_t));
+    mpr_value_realloc(&in, 1, type, mpr_expr_get_in_hist_size(ex, 0), 1, 0);
+    mpr_value_realloc(&out, 1, type, mpr_expr_get_out_hist_size(ex), 1, 1);
+
+    mpr_time_set(&time_in, MPR_NOW);
+    mpr_expr_eval(eval_stk, ex, 0, &user_vars_p, &out, &time_in, types, 0);
+    mpr_value_set_samp(&in, 0, &x, time_in);
+    mpr_expr_eval(eval_stk, ex, &in_p, &user_vars_p, &out, &time_in, types, 0);
+    got = *(int*)mpr_value_get_samp(&out, 0);
+    if (got != expect) {
+        eprintf("got %d, expected %d\n", got, expect);
+        result = 1;
+    }
+    else
+        eprintf("OK\n");
+
+    mpr_value_free(&in);
+    mpr_value_free(&out);
+    mpr_expr_free(ex);
+    return result;
+}
+
+#define REDUCE_INST 4
+
+/* Instance reductions must visit every active instance: evaluate with instances holding 1, 2, 3
+ * and 4 and compare the output of the first instance. */
+static int check_inst_reduce(const char *expr_str, int expect)
+{
+    mpr_value_t in, out;
+    mpr_value in_p = &in;
+    mpr_type type = MPR_INT32, types[1];
+    int one = 1, got, i, result = 0;
+    mpr_expr ex;
+
+    eprintf("Evaluating '%s' over %d instances... ", expr_str, REDUCE_INST);
+    ex = mpr_expr_new_from_str(eval_stk, expr_str, 1, &type, &one, type, 1);
+    if (!ex) {
+        eprintf("parser FAILED\n");
+        return 1;
+    }
+    memset(&in, 0, sizeof(mpr_value_t));
+    memset(&out, 0, sizeof(mpr_value_t));
+    mpr_value_realloc(&in, 1, type, mpr_expr_get_in_hist_size(ex, 0), REDUCE_INST, 0);
+    mpr_value_realloc(&out, 1, type, mpr_expr_get_out_hist_size(ex), REDUCE_INST, 1);
+
+    mpr_time_set(&time_in, MPR_NOW);
+    for (i = 0; i < REDUCE_INST; i++) {
+        int val = i + 1;
+        mpr_value_set_samp(&in, i, &val, time_in);
+    }
+    mpr_expr_eval(eval_stk, ex, &in_p, &user_vars_p, &out, &time_in, types, 0);
+    got = *(int*)mpr_value_get_samp(&out, 0);
+    if (got != expect) {
+        eprintf("got %d, expected %d\n", got, expect);
+        result = 1;
+    }
+    else
+        eprintf("OK\n");
+
+    mpr_value_free(&in);
+    mpr_value_free(&out);
+    mpr_expr_free(ex);
+    return result;
+}
+
+int run_tests()
+{
+    int i, j;
+    mpr_expr e2, e3;
     mpr_type types[3] = {MPR_INT32, MPR_FLT, MPR_DBL};
     int lens[3] = {2, 3, 2};
 
@@ -573,13 +891,13 @@ int run_tests()
         return 1;
 
     /* 19) Invalid history index */
-    set_expr_str("y=x{-101}");
+    set_expr_str("y=x{-32768}");
     setup_test(MPR_INT32, 1, MPR_INT32, 1);
     if (parse_and_eval(EXPECT_FAILURE, 0, 1, iterations))
         return 1;
 
     /* 20) Invalid history index */
-    set_expr_str("y=x-y{-101}");
+    set_expr_str("y=x-y{-32768}");
     setup_test(MPR_INT32, 1, MPR_INT32, 1);
     if (parse_and_eval(EXPECT_FAILURE, 0, 1, iterations))
         return 1;
@@ -1495,6 +1813,236 @@ int run_tests()
     if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
         return 1;
 
+    /* 117) Scaling with history reads, compiled to fused instructions */
+    set_expr_str("y=2-x*3+x{-1}*2;");
+    setup_test(MPR_INT32, 2, MPR_INT32, 2);
+    expect_int[0] = 2 - src_int[0] * 3 + (iterations > 1 ? src_int[0] * 2 : 0);
+    expect_int[1] = 2 - src_int[1] * 3 + (iterations > 1 ? src_int[1] * 2 : 0);
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 118) Variables that are not read must still be assigned since their values are published */
+    set_expr_str("a=x*2;b=x+1;y=a;");
+    setup_test(MPR_INT32, 1, MPR_INT32, 1);
+    expect_int[0] = src_int[0] * 2;
+    if (parse_and_eval(EXPECT_SUCCESS, 10, 1, iterations))
+        return 1;
+    if (*(int*)mpr_value_get_samp_hist(&user_vars[1], 0, 0) != src_int[0] + 1) {
+        eprintf("Error: expected variable 'b' to be %d\n", src_int[0] + 1);
+        return 1;
+    }
+
+    /* 119) Repeated subexpression should be computed once */
+    set_expr_str("y=(x-1)*(x-1)+sin(x-1);");
+    setup_test(MPR_FLT, 1, MPR_FLT, 1);
+    expect_flt[0] = (src_flt[0] - 1) * (src_flt[0] - 1) + sinf(src_flt[0] - 1);
+    if (parse_and_eval(EXPECT_SUCCESS, 11, 1, iterations))
+        return 1;
+
+    /* but not if copying it would take more tokens than computing it again */
+    set_expr_str("y=x.norm()+x.norm();");
+    setup_test(MPR_FLT, 3, MPR_FLT, 1);
+    expect_flt[0] = 2 * sqrtf(src_flt[0] * src_flt[0] + src_flt[1] * src_flt[1]
+                              + src_flt[2] * src_flt[2]);
+    if (parse_and_eval(EXPECT_SUCCESS, 6, 1, iterations))
+        return 1;
+
+    /* 120) Power with small integer exponent and division by a power of two */
+    set_expr_str("y=pow(x,2)/4;");
+    setup_test(MPR_DBL, 3, MPR_DBL, 3);
+    for (i = 0; i < 3; i++)
+        expect_dbl[i] = src_dbl[i] * src_dbl[i] / 4;
+    if (parse_and_eval(EXPECT_SUCCESS, 6, 1, iterations))
+        return 1;
+
+    /* 121) Power with unit exponent */
+    set_expr_str("y=pow(x,1)*3;");
+    setup_test(MPR_FLT, 2, MPR_FLT, 2);
+    expect_flt[0] = src_flt[0] * 3;
+    expect_flt[1] = src_flt[1] * 3;
+    if (parse_and_eval(EXPECT_SUCCESS, 4, 1, iterations))
+        return 1;
+
+    /* 122) Identical expressions should share their parsed tokens */
+    set_expr_str("y=x*0.5+0.5;");
+    setup_test(MPR_FLT, 2, MPR_FLT, 2);
+    eprintf("Parsing string '%s' three times\n", str);
+    e = mpr_expr_new_from_str(eval_stk, str, n_sources, src_types, src_lens, dst_type, dst_len);
+    e2 = mpr_expr_new_from_str(eval_stk, str, n_sources, src_types, src_lens, dst_type, dst_len);
+    e3 = mpr_expr_new_from_str(eval_stk, str, n_sources, src_types, src_lens, MPR_DBL, dst_len);
+    i = !e || !e2 || !e3 || e == e2 || e->tokens != e2->tokens || e->tokens == e3->tokens;
+    if (e)
+        mpr_expr_free(e);
+    if (e2)
+        mpr_expr_free(e2);
+    if (e3)
+        mpr_expr_free(e3);
+    e = 0;
+    if (i) {
+        eprintf("Error: expected tokens to be shared only between matching expressions\n");
+        return 1;
+    }
+
+    /* 123) Long delay */
+    set_expr_str("y=x{-1000}");
+    setup_test(MPR_INT32, 1, MPR_INT32, 1);
+    expect_int[0] = iterations > 1000 ? src_int[0] : 0;
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 124) Windowed mean over a long history */
+    set_expr_str("y=x.history(2000).mean();");
+    setup_test(MPR_FLT, 1, MPR_FLT, 1);
+    expect_flt[0] = 0.f;
+    for (i = 0; i < iterations && i < 2000; i++)
+        expect_flt[0] += src_flt[0];
+    expect_flt[0] /= 2000.f;
+    if (parse_and_eval(EXPECT_SUCCESS, 2, 1, iterations))
+        return 1;
+
+    /* 125) Windowed maximum */
+    set_expr_str("y=x.history(5).max();");
+    setup_test(MPR_INT32, 2, MPR_INT32, 2);
+    for (i = 0; i < 2; i++)
+        expect_int[i] = iterations < 5 && src_int[i] < 0 ? 0 : src_int[i];
+    if (parse_and_eval(EXPECT_SUCCESS, 2, 1, iterations))
+        return 1;
+
+    /* 126) Windowed minimum with type conversion */
+    set_expr_str("y=x.history(3).min();");
+    setup_test(MPR_DBL, 1, MPR_FLT, 1);
+    expect_flt[0] = (float)(iterations < 3 && src_dbl[0] > 0 ? 0 : src_dbl[0]);
+    if (parse_and_eval(EXPECT_SUCCESS, 2, 1, iterations))
+        return 1;
+
+    /* 127) Biquad lowpass of a constant input */
+    set_expr_str("y=lowpass(x,0.1,0.707);");
+    setup_test(MPR_FLT, 3, MPR_FLT, 3);
+    for (i = 0; i < 3; i++)
+        expect_flt[i] = src_flt[i];
+    if (parse_and_eval(EXPECT_SUCCESS, 5, 1, iterations))
+        return 1;
+
+    /* 128) One-pole smoothing */
+    set_expr_str("y=onepole(x,0.05);");
+    setup_test(MPR_DBL, 1, MPR_DBL, 1);
+    expect_dbl[0] = src_dbl[0];
+    if (parse_and_eval(EXPECT_SUCCESS, 4, 1, iterations))
+        return 1;
+
+    /* 129) FIR filter with coefficients moved out of the stack */
+    set_expr_str("y=fir(x,[0.25,0.5,0.25]);");
+    setup_test(MPR_FLT, 2, MPR_FLT, 2);
+    for (i = 0; i < 2; i++)
+        expect_flt[i] = src_flt[i];
+    if (parse_and_eval(EXPECT_SUCCESS, 3, 1, iterations))
+        return 1;
+
+    /* 130) FIR filter with non-constant coefficients */
+    set_expr_str("y=fir(x,x);");
+    setup_test(MPR_FLT, 1, MPR_FLT, 1);
+    if (parse_and_eval(EXPECT_FAILURE, 0, 1, iterations))
+        return 1;
+
+    /* 131) Pooled instance mean read from running aggregates */
+    set_expr_str("y=x.instance.mean();");
+    setup_test(MPR_INT32, 3, MPR_INT32, 3);
+    for (i = 0; i < 3; i++)
+        expect_int[i] = src_int[i];
+    if (parse_and_eval(EXPECT_SUCCESS, 2, 1, iterations))
+        return 1;
+
+    /* 132) Pooled instance center read from running aggregates */
+    set_expr_str("y=x-x.instance.center();");
+    setup_test(MPR_FLT, 2, MPR_FLT, 2);
+    expect_flt[0] = expect_flt[1] = 0.f;
+    if (parse_and_eval(EXPECT_SUCCESS, 8, 1, iterations))
+        return 1;
+
+    /* 133) Reductions and element-wise arithmetic on vectors long enough for the vector
+     * kernels, compiled and interpreted, compared with scalar results */
+    {
+        int lens[] = {16, 17, 64};
+        mpr_type types[] = {MPR_FLT, MPR_DBL};
+        double v[LONG_VEC_LEN], expect[LONG_VEC_LEN], sum, dot, max, min, mean;
+        for (i = 0; i < 2; i++) {
+            for (j = 0; j < 3; j++) {
+                int k, len = lens[j];
+                mpr_type type = types[i];
+                long_vec_vals(v, len, type);
+                sum = dot = 0;
+                max = min = v[0];
+                for (k = 0; k < len; k++) {
+                    sum += v[k];
+                    dot += v[k] * v[k];
+                    if (v[k] > max)
+                        max = v[k];
+                    if (v[k] < min)
+                        min = v[k];
+                }
+                mean = sum / len;
+                if (check_long_vec("y=x.sum();", type, len, 1, &sum)
+                    || check_long_vec("y=x.mean();", type, len, 1, &mean)
+                    || check_long_vec("y=x.max();", type, len, 1, &max)
+                    || check_long_vec("y=x.min();", type, len, 1, &min))
+                    return 1;
+                expect[0] = (max + min) * 0.5;
+                if (check_long_vec("y=x.center();", type, len, 1, expect))
+                    return 1;
+                expect[0] = sqrt(dot);
+                if (check_long_vec("y=x.norm();", type, len, 1, expect)
+                    || check_long_vec("y=dot(x,x);", type, len, 1, &dot))
+                    return 1;
+                for (k = 0; k < len; k++)
+                    expect[k] = v[k] * v[k] - v[k] / (v[k] + 2) + v[k];
+                if (check_long_vec("y=x*x-x/(x+2)+x;", type, len, len, expect))
+                    return 1;
+                /* the vector function keeps this expression from being compiled */
+                for (k = 0; k < len; k++)
+                    expect[k] = v[k] * v[k] - v[k] / (v[k] + mean) + v[k];
+                if (check_long_vec("y=x*x-x/(x+x.mean())+x;", type, len, len, expect))
+                    return 1;
+            }
+        }
+    }
+
+    /* 134) Batched evaluation of several instances, compiled and interpreted */
+    if (check_batch("y=x*2-x{-1}+y{-1}*0.5;", MPR_FLT, 2, 4)
+        || check_batch("y=sin(x)*3+1;", MPR_DBL, 3, 4)
+        || check_batch("y=x*3-2;", MPR_INT32, 1, 4)
+        || check_batch("y=x*2+x.sum();", MPR_FLT, 3, 4))
+        return 1;
+
+    /* 135) Filters on vectors long enough for the vector kernels, and a long FIR filter */
+    {
+        double coefs[17];
+        char fir[MAX_STR_LEN];
+        snprintf(fir, MAX_STR_LEN, "y=fir(x,[");
+        for (i = 0; i < 17; i++) {
+            coefs[i] = (i + 1) / 64.;
+            snprintf(fir + strlen(fir), MAX_STR_LEN - strlen(fir), "%s%g", i ? "," : "",
+                     coefs[i]);
+        }
+        snprintf(fir + strlen(fir), MAX_STR_LEN - strlen(fir), "]);");
+        if (   check_filter("y=onepole(x,0.05);", MPR_FLT, 20, 0, 0)
+            || check_filter("y=onepole(x,0.05);", MPR_DBL, 16, 0, 0)
+            || check_filter("y=lowpass(x,0.1,0.707);", MPR_DBL, 17, 0, 0)
+            || check_filter("y=bandpass(x,0.2,2);", MPR_FLT, 64, 0, 0)
+            || check_filter(fir, MPR_DBL, 2, coefs, 17))
+            return 1;
+    }
+
+    /* 136) History initialisation after evaluating without inputs */
+    if (   check_init_eval("y=x+y{-1}; y{-1}=100", 3, 103)
+        || check_init_eval("y=x-y{-2}; y{-2}=10", 3, -7))
+        return 1;
+
+    /* 137) Instance reductions over several active instances */
+    if (   check_inst_reduce("y=x.instance.sum()", 10)
+        || check_inst_reduce("y=(x*2).instance.sum()", 20)
+        || check_inst_reduce("y=(x-1).instance.max()", 3))
+        return 1;
+
     return 0;
 }
 
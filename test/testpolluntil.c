@@ -0,0 +1,91 @@
+#include "fixture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DEADLINE_MS 50
+#define TOLERANCE_MS 25
+
+mpr_dev dev = 0;
+int iterations = 20;
+
+/* Call mpr_dev_poll_until() with a deadline DEADLINE_MS in the future and check that it returns
+ * neither before the deadline nor more than TOLERANCE_MS after it. */
+int check_deadline(const char *desc)
+{
+    mpr_time deadline;
+    double then, elapsed_ms;
+
+    mpr_time_set(&deadline, MPR_NOW);
+    mpr_time_add_dbl(&deadline, DEADLINE_MS * 0.001);
+    then = current_time();
+    mpr_dev_poll_until(dev, deadline);
+    elapsed_ms = (current_time() - then) * 1000;
+
+    if (elapsed_ms < DEADLINE_MS - 1 || elapsed_ms > DEADLINE_MS + TOLERANCE_MS) {
+        eprintf("%s: returned after %.3f ms, expected %d ms.\n", desc, elapsed_ms, DEADLINE_MS);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i, result = 0;
+    char details[64];
+    double rate = 0;
+    mpr_graph g;
+
+    if (fixture_init(argc, argv, "testpolluntil", NULL, NULL))
+        return 1;
+    if (fast)
+        iterations = 5;
+
+    g = shared_graph ? mpr_graph_new(0) : 0;
+
+    dev = fixture_dev_new("testpolluntil", g);
+    if (!dev) {
+        eprintf("Error initializing device.\n");
+        result = 1;
+        goto done;
+    }
+    if (!mpr_sig_new(dev, MPR_DIR_IN, "insig", 1, MPR_FLT, NULL, NULL, NULL, NULL, NULL, 0)) {
+        eprintf("Error initializing signal.\n");
+        result = 1;
+        goto done;
+    }
+
+    /* an unregistered device must still wait for the deadline */
+    if (check_deadline("Unregistered device")) {
+        result = 1;
+        goto done;
+    }
+
+    fixture_wait_ready();
+
+    for (i = 0; i < iterations && !done && !result; i++)
+        result = check_deadline("Idle device");
+    if (result)
+        goto done;
+
+    rate = mpr_dev_get_stat(dev, MPR_DEV_STAT_LOOP_RATE);
+    eprintf("Loop rate: %.0f iterations per second.\n", rate);
+    if (rate <= 0) {
+        eprintf("Loop rate was not reported.\n");
+        result = 1;
+        goto done;
+    }
+
+    /* busy polling may be unsupported or disallowed, but must not affect the deadline */
+    eprintf("SO_BUSY_POLL %s.\n", mpr_dev_set_busy_poll(dev, 50) ? "set" : "not available");
+    for (i = 0; i < iterations && !done && !result; i++)
+        result = check_deadline("Idle device with busy polling");
+    mpr_dev_set_busy_poll(dev, 0);
+
+  done:
+    fixture_cleanup(g);
+    if (result)
+        return fixture_report(result, NULL);
+    snprintf(details, 64, "%.0f iterations per second", rate);
+    return fixture_report(result, details);
+}
@@ -0,0 +1,202 @@
+#include "fixture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_NUM_SIGS 4000
+#define NUM_STAGES 4
+/* Per-update cost allowed at the largest stage, relative to the smallest. */
+#define MAX_COST_RATIO 4
+
+mpr_dev src = 0;
+mpr_dev dst = 0;
+mpr_sig sendsigs[MAX_NUM_SIGS];
+mpr_sig recvsigs[MAX_NUM_SIGS];
+mpr_map maps[MAX_NUM_SIGS];
+
+int num_sigs = 2000;
+int num_mapped = 0;
+int iterations = 100000;
+int received = 0;
+
+double times[NUM_STAGES];
+int stage_sizes[NUM_STAGES];
+
+int setup_src(mpr_graph g)
+{
+    int i;
+    char name[32];
+    mpr_list l;
+
+    src = fixture_dev_new("testrouter-send", g);
+    if (!src)
+        goto error;
+
+    for (i = 0; i < num_sigs; i++) {
+        snprintf(name, 32, "outsig%d", i);
+        sendsigs[i] = mpr_sig_new(src, MPR_DIR_OUT, name, 1, MPR_FLT, NULL,
+                                  NULL, NULL, NULL, NULL, 0);
+        if (!sendsigs[i])
+            goto error;
+    }
+
+    l = mpr_dev_get_sigs(src, MPR_DIR_OUT);
+    eprintf("Number of outputs: %d\n", mpr_list_get_size(l));
+    mpr_list_free(l);
+    return 0;
+
+  error:
+    return 1;
+}
+
+void handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
+             mpr_type type, const void *value, mpr_time t)
+{
+    if (value)
+        ++received;
+}
+
+int setup_dst(mpr_graph g)
+{
+    int i;
+    char name[32];
+    mpr_list l;
+
+    dst = fixture_dev_new("testrouter-recv", g);
+    if (!dst)
+        goto error;
+
+    for (i = 0; i < num_sigs; i++) {
+        snprintf(name, 32, "insig%d", i);
+        recvsigs[i] = mpr_sig_new(dst, MPR_DIR_IN, name, 1, MPR_FLT, NULL,
+                                  NULL, NULL, NULL, handler, MPR_SIG_UPDATE);
+        if (!recvsigs[i])
+            goto error;
+    }
+
+    l = mpr_dev_get_sigs(dst, MPR_DIR_IN);
+    eprintf("Number of inputs: %d\n", mpr_list_get_size(l));
+    mpr_list_free(l);
+    return 0;
+
+  error:
+    return 1;
+}
+
+/* Map signals until 'count' signals are mapped. */
+int map_sigs(int count)
+{
+    if (fixture_map_sigs(count - num_mapped, sendsigs + num_mapped, recvsigs + num_mapped,
+                         maps + num_mapped))
+        return 1;
+    num_mapped = count;
+    eprintf("%d signals mapped.\n", num_mapped);
+    return 0;
+}
+
+/* Time signal updates on the signal that was mapped first, since it is the
+ * oldest entry in the router. Devices are polled between batches of updates
+ * but the polling is not included in the timing. Returns the time per update
+ * of the fastest batch, which is not inflated by preemption. */
+double time_updates()
+{
+    int i, j;
+    float value;
+    double elapsed, best = -1, then;
+    for (i = 0; i < iterations && !done; i += 100) {
+        then = current_time();
+        for (j = 0; j < 100; j++) {
+            value = i + j;
+            mpr_sig_set_value(sendsigs[0], 0, 1, MPR_FLT, &value);
+        }
+        elapsed = current_time() - then;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+        fixture_poll(0);
+    }
+    return best / 100;
+}
+
+static int parse_opt(const char *name, const char *value)
+{
+    if (strcmp(name, "--num_sigs") == 0)
+        num_sigs = atoi(value);
+    else
+        return 0;
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int i, j, result = 0;
+    char usage[64], details[256];
+    mpr_graph g;
+
+    snprintf(usage, 64, "--num_sigs <int> (default %d, max %d), ", num_sigs, MAX_NUM_SIGS);
+    if (fixture_init(argc, argv, "testrouter", usage, parse_opt))
+        return 1;
+    if (fast) {
+        num_sigs = 200;
+        iterations = 10000;
+    }
+
+    if (num_sigs < NUM_STAGES)
+        num_sigs = NUM_STAGES;
+    else if (num_sigs > MAX_NUM_SIGS)
+        num_sigs = MAX_NUM_SIGS;
+
+    g = shared_graph ? mpr_graph_new(0) : 0;
+
+    if (setup_dst(g)) {
+        eprintf("Error initializing destination.\n");
+        result = 1;
+        goto done;
+    }
+
+    if (setup_src(g)) {
+        eprintf("Error initializing source.\n");
+        result = 1;
+        goto done;
+    }
+
+    fixture_wait_ready();
+
+    /* grow the number of mapped signals geometrically and time updates at each stage */
+    for (i = 0; i < NUM_STAGES && !done; i++) {
+        stage_sizes[i] = num_sigs;
+        for (j = i; j < NUM_STAGES - 1; j++)
+            stage_sizes[i] /= 10;
+        if (stage_sizes[i] < 1)
+            stage_sizes[i] = 1;
+        if (map_sigs(stage_sizes[i])) {
+            result = 1;
+            goto done;
+        }
+        times[i] = time_updates();
+        eprintf("%5d mapped signals: %f us per update\n", stage_sizes[i], times[i] * 1000000.);
+    }
+
+    /* allow remaining messages to be received */
+    for (i = 0; i < 10; i++)
+        fixture_poll(10);
+    if (!received) {
+        eprintf("No updates were received.\n");
+        result = 1;
+    }
+    else if (!done && times[NUM_STAGES - 1] > times[0] * MAX_COST_RATIO) {
+        /* updating a signal should not depend on how many other signals are mapped */
+        eprintf("Updates with %d mapped signals cost more than %d times those with %d.\n",
+                stage_sizes[NUM_STAGES - 1], MAX_COST_RATIO, stage_sizes[0]);
+        result = 1;
+    }
+
+  done:
+    fixture_cleanup(g);
+    if (result)
+        return fixture_report(result, NULL);
+    for (i = 0, j = 0; i < NUM_STAGES; i++)
+        j += snprintf(details + j, 256 - j, "%s%d sigs: %.3f us", i ? ", " : "", stage_sizes[i],
+                      times[i] * 1000000.);
+    snprintf(details + j, 256 - j, " per update");
+    return fixture_report(result, details);
+}
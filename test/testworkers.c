@@ -0,0 +1,194 @@
+#include "fixture.h"
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <string.h>
+
+#if defined(WIN32) || defined(_MSC_VER)
+#define SLEEP_MS(x) Sleep(x)
+#else
+#define SLEEP_MS(x) usleep((x)*1000)
+#endif
+
+#define NUM_PAIRS 4
+
+mpr_graph graph = 0;
+mpr_dev srcs[NUM_PAIRS];
+mpr_dev dsts[NUM_PAIRS];
+mpr_sig sendsigs[NUM_PAIRS];
+mpr_sig recvsigs[NUM_PAIRS];
+mpr_sig extrasig;
+
+int iterations = 10000;
+int sent[NUM_PAIRS];
+
+/* each destination is only updated by its own worker thread */
+int received[NUM_PAIRS];
+int out_of_order[NUM_PAIRS];
+int last[NUM_PAIRS];
+
+void handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
+             mpr_type type, const void *value, mpr_time t)
+{
+    int idx;
+    if (!value)
+        return;
+    for (idx = 0; idx < NUM_PAIRS; idx++) {
+        if (sig == recvsigs[idx])
+            break;
+    }
+    if (idx >= NUM_PAIRS)
+        return;
+    ++received[idx];
+    if (*(int*)value <= last[idx])
+        ++out_of_order[idx];
+    last[idx] = *(int*)value;
+}
+
+int setup_devs()
+{
+    int i, mn = 0, mx = 1000000;
+    graph = mpr_graph_new(0);
+
+    for (i = 0; i < NUM_PAIRS; i++) {
+        srcs[i] = fixture_dev_new("testworkers-send", graph);
+        dsts[i] = fixture_dev_new("testworkers-recv", graph);
+        if (!srcs[i] || !dsts[i])
+            return 1;
+        sendsigs[i] = mpr_sig_new(srcs[i], MPR_DIR_OUT, "outsig", 1, MPR_INT32, NULL,
+                                  &mn, &mx, NULL, NULL, 0);
+        recvsigs[i] = mpr_sig_new(dsts[i], MPR_DIR_IN, "insig", 1, MPR_INT32, NULL,
+                                  NULL, NULL, NULL, handler, MPR_SIG_UPDATE);
+        if (!sendsigs[i] || !recvsigs[i])
+            return 1;
+        last[i] = -1;
+    }
+    extrasig = mpr_sig_new(dsts[NUM_PAIRS - 1], MPR_DIR_IN, "extrasig", 1, MPR_INT32, NULL,
+                           NULL, NULL, NULL, NULL, 0);
+    return extrasig ? 0 : 1;
+}
+
+/* Run the devices on worker threads while this thread pushes updates. If mixed is set the last
+ * destination has no worker and is polled here, which must also handle the graph; otherwise a
+ * control thread handles the graph. */
+int loop(int mixed)
+{
+    int i, j, pending = 1, result = 0;
+    mpr_dev polled = mixed ? dsts[NUM_PAIRS - 1] : 0;
+
+    for (i = 0; i < NUM_PAIRS; i++) {
+        sent[i] = received[i] = out_of_order[i] = 0;
+        last[i] = -1;
+        if (mpr_dev_start_worker(srcs[i])
+            || (dsts[i] != polled && mpr_dev_start_worker(dsts[i]))) {
+            eprintf("Error starting worker threads.\n");
+            return 1;
+        }
+    }
+    if (polled) {
+        /* administrative messages must still be handled by the device without a worker */
+        mpr_map map = mpr_map_new(1, &sendsigs[0], 1, &extrasig);
+        mpr_obj_push(map);
+        for (i = 0; i < 500 && !done && !mpr_map_get_is_ready(map); i++)
+            mpr_dev_poll(polled, 10);
+        if (!mpr_map_get_is_ready(map)) {
+            eprintf("Map was not established without a graph poller.\n");
+            result = 1;
+        }
+    }
+    else
+        mpr_graph_start_polling(graph);
+
+    while (pending && !done && !result) {
+        pending = 0;
+        for (i = 0; i < NUM_PAIRS; i++) {
+            if (sent[i] >= iterations)
+                continue;
+            pending = 1;
+            if (mpr_sig_set_value_async(sendsigs[i], 0, 1, MPR_INT32, &sent[i]))
+                ++sent[i];
+        }
+        if (polled)
+            mpr_dev_poll(polled, 0);
+        if (verbose) {
+            printf("\r  Sent: %8i, Received: %8i   ", sent[0], received[0]);
+            fflush(stdout);
+        }
+    }
+    eprintf("\n");
+
+    /* allow remaining updates to be routed */
+    for (i = 0; i < 100 && !done; i++) {
+        pending = 0;
+        for (j = 0; j < NUM_PAIRS; j++) {
+            if (last[j] != sent[j] - 1)
+                pending = 1;
+        }
+        if (!pending)
+            break;
+        if (polled) {
+            mpr_time t;
+            mpr_time_set(&t, MPR_NOW);
+            mpr_time_add_dbl(&t, 0.01);
+            mpr_dev_poll_until(polled, t);
+        }
+        else
+            SLEEP_MS(10);
+    }
+
+    if (!polled)
+        mpr_graph_stop_polling(graph);
+    for (i = 0; i < NUM_PAIRS; i++) {
+        mpr_dev_stop_polling(srcs[i]);
+        if (dsts[i] != polled)
+            mpr_dev_stop_polling(dsts[i]);
+    }
+
+    for (i = 0; i < NUM_PAIRS; i++) {
+        eprintf("pair %d: sent %d updates, received %d, last %d\n", i, sent[i], received[i],
+                last[i]);
+        if (last[i] != sent[i] - 1 || out_of_order[i])
+            result = 1;
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    mpr_map maps[NUM_PAIRS];
+
+    if (fixture_init(argc, argv, "testworkers", NULL, NULL))
+        return 1;
+    if (fast)
+        iterations = 1000;
+
+    if (setup_devs()) {
+        eprintf("Error initializing devices.\n");
+        result = 1;
+        goto done;
+    }
+
+    fixture_wait_ready();
+
+    if (fixture_map_sigs(NUM_PAIRS, sendsigs, recvsigs, maps)) {
+        eprintf("Error setting maps.\n");
+        result = 1;
+        goto done;
+    }
+
+    eprintf("Polling the graph from a control thread\n");
+    result = loop(0);
+    if (!result) {
+        eprintf("Polling the graph from a device without a worker\n");
+        result = loop(1);
+    }
+
+  done:
+    fixture_cleanup(graph);
+    return fixture_report(result, NULL);
+}